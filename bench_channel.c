@@ -0,0 +1,215 @@
+/*
+ *  通道微基准：
+ *  - ping-pong：两个协程通过两个容量为 1 的通道来回传递一个整数，测量一次往返的时延，
+ *    分别在同一个调度器上和在两个调度器（线程）上；
+ *  - fan-in：P 个生产者协程向同一个有界通道发送，一个消费者接收，测量吞吐，
+ *    生产者与消费者在同一个调度器上 / 每个生产者独占一个调度器（线程）；
+ *  - 4KB 消息按值复制与指针模式（只传指针）的 fan-in 吞吐对比。
+ *
+ *  make bench_channel
+ *  ./bench_channel [往返次数] [每个生产者的消息数]
+ */
+
+
+
+#include "coroutine.h"
+
+#include <time.h>
+
+#define BENCH_ROUNDS		200000
+#define BENCH_MESSAGES		200000
+#define BENCH_PRODUCERS		4
+#define BENCH_CAPACITY		1024
+#define BENCH_BIG_MSG		4096
+
+
+struct bench_msg {
+	char data[BENCH_BIG_MSG];
+};
+
+
+static long rounds, messages;
+static coroutine_channel *ping, *pong, *fanin;
+static int big, by_pointer; // fan-in 消息为 4KB；按指针传递
+static atomic_int producers_left;
+
+
+static uint64_t bench_nsec_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+static void bench_pinger(void *arg) {
+	long i = 0, v = 0;
+
+	for (i = 0;i < rounds;i ++) {
+		coroutine_channel_send(ping, &i);
+		coroutine_channel_recv(pong, &v);
+	}
+	coroutine_channel_close(ping);
+}
+
+
+static void bench_ponger(void *arg) {
+	long v = 0;
+
+	while (coroutine_channel_recv(ping, &v) == 0) {
+		coroutine_channel_send(pong, &v);
+	}
+}
+
+
+static void bench_producer(void *arg) {
+	static __thread struct bench_msg msg; // 按值发送的 4KB 消息，只用作数据源
+	long i = 0;
+
+	for (i = 0;i < messages;i ++) {
+		if (by_pointer) {
+			struct bench_msg *m = malloc(sizeof(struct bench_msg));
+			m->data[0] = (char)i;
+			coroutine_channel_send_ptr(fanin, m);
+		} else if (big) {
+			msg.data[0] = (char)i;
+			coroutine_channel_send(fanin, &msg);
+		} else {
+			coroutine_channel_send(fanin, &i);
+		}
+	}
+
+	if (atomic_fetch_sub(&producers_left, 1) == 1) { // 最后一个生产者关闭通道，消费者取完后退出
+		coroutine_channel_close(fanin);
+	}
+}
+
+
+static void bench_consumer(void *arg) {
+	static __thread struct bench_msg msg;
+	long *received = arg;
+	long v = 0;
+
+	while (1) {
+		if (by_pointer) {
+			struct bench_msg *m = coroutine_channel_recv_ptr(fanin);
+			if (m == NULL) break;
+			free(m);
+		} else if (coroutine_channel_recv(fanin, big ? (void *)&msg : (void *)&v) != 0) {
+			break;
+		}
+		(*received) ++;
+	}
+}
+
+
+struct bench_thread {
+	proc_coroutine func[2];
+	int ncoroutines;
+	void *arg;
+};
+
+
+static void *bench_thread_main(void *arg) {
+	struct bench_thread *bt = arg;
+	int i = 0;
+
+	schedule_create(0, SCHEDULE_SHARED_STACK);
+	for (i = 0;i < bt->ncoroutines;i ++) {
+		coroutine *co = NULL;
+		coroutine_create(&co, bt->func[i], bt->arg);
+	}
+	schedule_run();
+
+	return NULL;
+}
+
+
+
+// cross 为 0 时两个协程在同一个调度器上，否则各自一个线程
+static double bench_pingpong(int cross) {
+	ping = coroutine_channel_create(sizeof(long), 1);
+	pong = coroutine_channel_create(sizeof(long), 1);
+
+	uint64_t begin = bench_nsec_now();
+	if (cross) {
+		struct bench_thread a = {{bench_pinger}, 1, NULL}, b = {{bench_ponger}, 1, NULL};
+		pthread_t ta, tb;
+		pthread_create(&tb, NULL, bench_thread_main, &b);
+		pthread_create(&ta, NULL, bench_thread_main, &a);
+		pthread_join(ta, NULL);
+		pthread_join(tb, NULL);
+	} else {
+		struct bench_thread a = {{bench_pinger, bench_ponger}, 2, NULL};
+		bench_thread_main(&a);
+	}
+	double nsec = (double)(bench_nsec_now() - begin) / rounds;
+
+	coroutine_channel_free(ping);
+	coroutine_channel_free(pong);
+
+	return nsec;
+}
+
+
+// 返回每秒消息数
+static double bench_fanin(int nproducers, int cross, size_t elem_size) {
+	long received = 0;
+	int i = 0;
+
+	fanin = coroutine_channel_create(elem_size, BENCH_CAPACITY);
+	atomic_store(&producers_left, nproducers);
+
+	uint64_t begin = bench_nsec_now();
+	if (cross) {
+		struct bench_thread consumer = {{bench_consumer}, 1, &received};
+		struct bench_thread producer = {{bench_producer}, 1, NULL};
+		pthread_t tc, tp[nproducers];
+
+		pthread_create(&tc, NULL, bench_thread_main, &consumer);
+		for (i = 0;i < nproducers;i ++) {
+			pthread_create(&tp[i], NULL, bench_thread_main, &producer);
+		}
+		for (i = 0;i < nproducers;i ++) {
+			pthread_join(tp[i], NULL);
+		}
+		pthread_join(tc, NULL);
+	} else {
+		schedule_create(0, SCHEDULE_SHARED_STACK);
+		coroutine *co = NULL;
+		coroutine_create(&co, bench_consumer, &received);
+		for (i = 0;i < nproducers;i ++) {
+			coroutine_create(&co, bench_producer, NULL);
+		}
+		schedule_run();
+	}
+	double seconds = (double)(bench_nsec_now() - begin) / 1e9;
+
+	assert(received == nproducers * messages);
+	coroutine_channel_free(fanin);
+
+	return received / seconds;
+}
+
+
+
+int main(int argc, char *argv[]) {
+	rounds = argc > 1 ? atol(argv[1]) : BENCH_ROUNDS;
+	messages = argc > 2 ? atol(argv[2]) : BENCH_MESSAGES;
+
+	printf("ping-pong %ld rounds\n", rounds);
+	printf("%24s %12.0f ns/round trip\n", "same scheduler", bench_pingpong(0));
+	printf("%24s %12.0f ns/round trip\n", "two threads", bench_pingpong(1));
+
+	printf("fan-in %d producers x %ld messages, capacity %d\n", BENCH_PRODUCERS, messages, BENCH_CAPACITY);
+	printf("%24s %12.0f msgs/s\n", "same scheduler", bench_fanin(BENCH_PRODUCERS, 0, sizeof(long)));
+	printf("%24s %12.0f msgs/s\n", "thread per producer", bench_fanin(BENCH_PRODUCERS, 1, sizeof(long)));
+
+	big = 1;
+	printf("%24s %12.0f msgs/s\n", "4KB by value", bench_fanin(BENCH_PRODUCERS, 0, sizeof(struct bench_msg)));
+	by_pointer = 1;
+	printf("%24s %12.0f msgs/s\n", "4KB by pointer", bench_fanin(BENCH_PRODUCERS, 0, 0));
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+/*
+ *  写合并（coroutine_cork）微基准：本机回环上的流水线请求/响应。
+ *  客户端每个连接一次发出 P 个 32 字节的请求，再收齐 P 个响应；服务端每收到一个请求就单独 send 一个响应，
+ *  对比服务端不打开 cork（每个响应一次系统调用）与打开 cork（每轮调度一次系统调用）时的吞吐，两种后端各测一次。
+ *
+ *  make bench_cork
+ *  ./bench_cork [连接数] [每个连接的轮数] [每轮的请求数]
+ */
+
+
+
+#include "coroutine.h"
+
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <time.h>
+
+#define BENCH_PORT			19400
+#define BENCH_CONNECTIONS	32
+#define BENCH_ROUNDS		5000
+#define BENCH_PIPELINE		16
+#define BENCH_MSG_SIZE		32
+#define BENCH_CORK_BYTES	(64 * 1024)
+
+
+struct bench_case {
+	const char *name;
+	int flags; // 服务端调度器的 flags
+	int cork; // 服务端是否打开写合并
+	unsigned short port;
+	int nconns;
+	long rounds;
+	int pipeline;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int listening;
+	double seconds;
+};
+
+
+static uint64_t bench_nsec_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static void bench_nodelay(int fd) {
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // 每个 send 都立即成为一个报文，体现系统调用次数的差别
+}
+
+
+struct bench_conn {
+	int fd;
+	int cork;
+};
+
+
+static void bench_server_conn(void *arg) {
+	struct bench_conn *bcn = arg;
+	int fd = bcn->fd;
+	char buf[BENCH_MSG_SIZE * 256];
+	size_t have = 0;
+
+	if (bcn->cork) coroutine_cork(fd, BENCH_CORK_BYTES, 0);
+	free(bcn);
+
+	while (1) {
+		ssize_t n = recv(fd, buf + have, sizeof(buf) - have, 0);
+		if (n <= 0) break;
+		have += n;
+
+		size_t off = 0;
+		for (off = 0;off + BENCH_MSG_SIZE <= have;off += BENCH_MSG_SIZE) { // 每个请求单独回复
+			if (send(fd, buf + off, BENCH_MSG_SIZE, 0) != BENCH_MSG_SIZE) goto out;
+		}
+		memmove(buf, buf + off, have - off);
+		have -= off;
+	}
+out:
+	close(fd);
+}
+
+
+static void bench_acceptor(void *arg) {
+	struct bench_case *bc = arg;
+	int i = 0;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(bc->port);
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0 || listen(fd, SOMAXCONN) != 0) {
+		printf("bind/listen port %d failed, errno %d\n", bc->port, errno);
+		exit(1);
+	}
+
+	pthread_mutex_lock(&bc->mutex);
+	bc->listening = 1;
+	pthread_cond_signal(&bc->cond);
+	pthread_mutex_unlock(&bc->mutex);
+
+	for (i = 0;i < bc->nconns;i ++) { // 所有连接建立后退出，连接全部关闭后服务端调度器结束
+		int cli_fd = accept(fd, NULL, NULL);
+		if (cli_fd < 0) break;
+		bench_nodelay(cli_fd);
+
+		struct bench_conn *bcn = malloc(sizeof(struct bench_conn));
+		bcn->fd = cli_fd;
+		bcn->cork = bc->cork;
+
+		coroutine *co = NULL;
+		coroutine_create(&co, bench_server_conn, bcn);
+	}
+	close(fd);
+}
+
+
+static void *bench_server(void *arg) {
+	struct bench_case *bc = arg;
+	coroutine *co = NULL;
+
+	schedule_create(0, bc->flags);
+	coroutine_create(&co, bench_acceptor, bc);
+
+	schedule_run();
+
+	return NULL;
+}
+
+
+static void bench_client(void *arg) {
+	struct bench_case *bc = arg;
+	size_t size = (size_t)bc->pipeline * BENCH_MSG_SIZE;
+	char *buf = malloc(size);
+	long i = 0;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in remote;
+	memset(&remote, 0, sizeof(remote));
+	remote.sin_family = AF_INET;
+	remote.sin_port = htons(bc->port);
+	remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *)&remote, sizeof(remote)) != 0) {
+		printf("connect failed, errno %d\n", errno);
+		exit(1);
+	}
+	bench_nodelay(fd);
+
+	memset(buf, 'x', size);
+	for (i = 0;i < bc->rounds;i ++) {
+		if (send(fd, buf, size, 0) != (ssize_t)size) break; // 一次发出一轮的全部请求
+
+		size_t got = 0;
+		while (got < size) {
+			ssize_t n = recv(fd, buf + got, size - got, 0);
+			if (n <= 0) {
+				printf("recv failed, errno %d\n", errno);
+				exit(1);
+			}
+			got += n;
+		}
+	}
+	close(fd);
+	free(buf);
+}
+
+
+static void *bench_clients(void *arg) {
+	struct bench_case *bc = arg;
+	int i = 0;
+
+	schedule_create(0, SCHEDULE_SHARED_STACK);
+	for (i = 0;i < bc->nconns;i ++) {
+		coroutine *co = NULL;
+		coroutine_create(&co, bench_client, bc);
+	}
+
+	uint64_t begin = bench_nsec_now();
+	schedule_run();
+	bc->seconds = (double)(bench_nsec_now() - begin) / 1e9;
+
+	return NULL;
+}
+
+
+
+int main(int argc, char *argv[]) {
+	int nconns = argc > 1 ? atoi(argv[1]) : BENCH_CONNECTIONS;
+	long rounds = argc > 2 ? atol(argv[2]) : BENCH_ROUNDS;
+	int pipeline = argc > 3 ? atoi(argv[3]) : BENCH_PIPELINE;
+	struct bench_case cases[] = {
+		{.name = "epoll", .flags = SCHEDULE_SHARED_STACK, .cork = 0},
+		{.name = "epoll", .flags = SCHEDULE_SHARED_STACK, .cork = 1},
+		{.name = "io_uring", .flags = SCHEDULE_IO_URING, .cork = 0},
+		{.name = "io_uring", .flags = SCHEDULE_IO_URING, .cork = 1},
+	};
+	int i = 0;
+
+	printf("%d connections x %ld rounds x %d pipelined requests\n", nconns, rounds, pipeline);
+	printf("%10s %6s %14s\n", "server", "cork", "responses/s");
+
+	for (i = 0;i < (int)(sizeof(cases) / sizeof(cases[0]));i ++) {
+		struct bench_case *bc = &cases[i];
+		pthread_t server, clients;
+
+		bc->port = BENCH_PORT + i;
+		bc->nconns = nconns;
+		bc->rounds = rounds;
+		bc->pipeline = pipeline;
+		pthread_mutex_init(&bc->mutex, NULL);
+		pthread_cond_init(&bc->cond, NULL);
+
+		pthread_create(&server, NULL, bench_server, bc);
+
+		pthread_mutex_lock(&bc->mutex);
+		while (!bc->listening) {
+			pthread_cond_wait(&bc->cond, &bc->mutex);
+		}
+		pthread_mutex_unlock(&bc->mutex);
+
+		pthread_create(&clients, NULL, bench_clients, bc);
+		pthread_join(clients, NULL);
+		pthread_join(server, NULL);
+
+		double total = (double)nconns * rounds * pipeline;
+		printf("%10s %6s %14.0f\n", bc->name, bc->cork ? "on" : "off", total / bc->seconds);
+	}
+
+	return 0;
+}
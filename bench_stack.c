@@ -0,0 +1,88 @@
+/*
+ *  共享栈与独立栈模式对比：不同栈深度下一次 resume + yield 往返的耗时
+ *
+ *  make bench_stack
+ */
+
+
+
+#include "coroutine.h"
+
+#include <time.h>
+
+#define BENCH_ROUNDS		(1000 * 1000)
+
+
+struct bench_case {
+	int flags;
+	size_t depth;
+	long rounds;
+	double nsec;
+};
+
+
+static uint64_t bench_nsec_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+void bench_deep(void *arg) { // 占用 depth 字节的栈后反复让出，共享栈模式下每次让出都要拷贝这部分栈
+	size_t depth = ((struct bench_case *)arg)->depth;
+	coroutine *co = coroutine_get_sched()->curr_thread;
+
+	volatile char frame[depth];
+	frame[0] = 1;
+	frame[depth - 1] = frame[0]; // 两端都写到，整块栈帧都在让出时要保存的范围内
+
+	while (1) {
+		coroutine_yield(co);
+	}
+}
+
+
+static void *bench_thread(void *arg) { // 每种情况独占一个线程，也就独占一个调度器
+	struct bench_case *bc = arg;
+	coroutine *co = NULL;
+	long i = 0;
+
+	schedule_create(0, bc->flags);
+	coroutine_create(&co, bench_deep, bc);
+
+	coroutine_resume(co);
+
+	uint64_t begin = bench_nsec_now();
+	for (i = 0;i < bc->rounds;i ++) {
+		coroutine_resume(co);
+	}
+	bc->nsec = (double)(bench_nsec_now() - begin) / bc->rounds;
+
+	return NULL;
+}
+
+
+
+int main(int argc, char *argv[]) {
+	size_t depths[] = {256, 1024, 4 * 1024, 16 * 1024, 30 * 1024, 64 * 1024};
+	long rounds = argc > 1 ? atol(argv[1]) : BENCH_ROUNDS;
+	int i = 0;
+
+	printf("%10s %14s %14s\n", "depth", "shared(ns)", "private(ns)");
+
+	for (i = 0;i < (int)(sizeof(depths) / sizeof(depths[0]));i ++) {
+		struct bench_case shared = {SCHEDULE_SHARED_STACK, depths[i], rounds, 0};
+		struct bench_case private = {SCHEDULE_PRIVATE_STACK, depths[i], rounds, 0};
+		pthread_t tid;
+
+		pthread_create(&tid, NULL, bench_thread, &shared);
+		pthread_join(tid, NULL);
+		pthread_create(&tid, NULL, bench_thread, &private);
+		pthread_join(tid, NULL);
+
+		printf("%10zu %14.1f %14.1f\n", depths[i], shared.nsec, private.nsec);
+	}
+
+	return 0;
+}
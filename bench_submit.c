@@ -0,0 +1,151 @@
+/*
+ *  跨线程投递微基准：
+ *  - submit：P 个普通线程向同一个调度器 schedule_submit 共 N 个函数，测量投递方每次调用的耗时和整体吞吐；
+ *  - wake：普通线程与一个 coroutine_park 挂起的协程来回唤醒，测量一次唤醒的往返时延（调度器每次都阻塞在 epoll_wait 中）。
+ *
+ *  make bench_submit
+ *  ./bench_submit [投递线程数] [每个线程的投递数]
+ */
+
+
+
+#include "coroutine.h"
+
+#include <time.h>
+#include <sched.h>
+
+#define BENCH_PRODUCERS		4
+#define BENCH_SUBMITS		(1000 * 1000)
+#define BENCH_PINGPONG		100000
+
+
+static schedule *target; // 接收投递的调度器
+static coroutine *keeper; // 挂起在调度器上，投递结束前调度器不会退出
+static atomic_long executed;
+
+static atomic_int ping; // 普通线程唤醒协程前置 1，协程醒来后清 0
+static coroutine *ponger;
+
+
+static uint64_t bench_nsec_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static void bench_task(void *arg) {
+	atomic_fetch_add_explicit(&executed, 1, memory_order_relaxed);
+}
+
+
+static void bench_keeper(void *arg) {
+	coroutine_park();
+}
+
+
+static void bench_ponger(void *arg) {
+	long i = 0;
+
+	for (i = 0;i < BENCH_PINGPONG;i ++) {
+		coroutine_park();
+		atomic_store(&ping, 0);
+	}
+}
+
+
+static void *bench_reactor(void *arg) {
+	schedule_create(0, (int)(intptr_t)arg);
+	target = coroutine_get_sched();
+
+	coroutine_create(&keeper, bench_keeper, NULL);
+	coroutine_create(&ponger, bench_ponger, NULL);
+
+	schedule_run();
+
+	return NULL;
+}
+
+
+struct bench_producer {
+	long n;
+	double nsec; // 每次投递的耗时
+};
+
+
+static void *bench_producer_main(void *arg) {
+	struct bench_producer *bp = arg;
+	long i = 0;
+
+	uint64_t begin = bench_nsec_now();
+	for (i = 0;i < bp->n;i ++) {
+		if (schedule_submit(target, bench_task, NULL) != 0) abort();
+	}
+	bp->nsec = (double)(bench_nsec_now() - begin) / bp->n;
+
+	return NULL;
+}
+
+
+
+static void bench_run(const char *name, int flags, int nproducers, long nsubmits) {
+	pthread_t reactor, producers[nproducers];
+	struct bench_producer bp[nproducers];
+	long i = 0;
+
+	atomic_store(&executed, 0);
+	target = NULL;
+
+	pthread_create(&reactor, NULL, bench_reactor, (void *)(intptr_t)flags);
+	while (__atomic_load_n(&target, __ATOMIC_ACQUIRE) == NULL) {
+		usleep(1000);
+	}
+	usleep(10000); // 等调度器阻塞下来
+
+	// 唤醒往返：每次都等协程处理完再唤醒，调度器每次都处于阻塞状态
+	uint64_t begin = bench_nsec_now();
+	for (i = 0;i < BENCH_PINGPONG;i ++) {
+		atomic_store(&ping, 1);
+		coroutine_wake(ponger);
+		while (atomic_load(&ping)) sched_yield();
+	}
+	double wake_nsec = (double)(bench_nsec_now() - begin) / BENCH_PINGPONG;
+
+	// 投递吞吐
+	begin = bench_nsec_now();
+	for (i = 0;i < nproducers;i ++) {
+		bp[i].n = nsubmits;
+		pthread_create(&producers[i], NULL, bench_producer_main, &bp[i]);
+	}
+	for (i = 0;i < nproducers;i ++) {
+		pthread_join(producers[i], NULL);
+	}
+	while (atomic_load(&executed) < (long)nproducers * nsubmits) sched_yield();
+	double seconds = (double)(bench_nsec_now() - begin) / 1e9;
+
+	coroutine_wake(keeper);
+	pthread_join(reactor, NULL);
+
+	double submit_nsec = 0;
+	for (i = 0;i < nproducers;i ++) {
+		submit_nsec += bp[i].nsec / nproducers;
+	}
+
+	printf("%10s %14.1f %14.0f %14.1f\n", name, submit_nsec, nproducers * nsubmits / seconds, wake_nsec / 1000);
+}
+
+
+
+int main(int argc, char *argv[]) {
+	int nproducers = argc > 1 ? atoi(argv[1]) : BENCH_PRODUCERS;
+	long nsubmits = argc > 2 ? atol(argv[2]) : BENCH_SUBMITS;
+
+	printf("%d producers x %ld submits\n", nproducers, nsubmits);
+	printf("%10s %14s %14s %14s\n", "backend", "submit(ns)", "tasks/s", "wake rtt(us)");
+
+	bench_run("epoll", SCHEDULE_SHARED_STACK, nproducers, nsubmits);
+	bench_run("io_uring", SCHEDULE_IO_URING, nproducers, nsubmits);
+
+	return 0;
+}
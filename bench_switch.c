@@ -0,0 +1,62 @@
+/*
+ *  协程切换微基准：测量一次 resume + yield 往返的耗时
+ *
+ *  make bench_switch
+ *  make bench_switch_ucontext
+ *
+ *  两个版本各跑一次即可对比汇编切换与 swapcontext 的差距
+ */
+
+
+
+#include "coroutine.h"
+
+#include <time.h>
+
+#define BENCH_ROUNDS		(5 * 1000 * 1000)
+
+
+static uint64_t bench_nsec_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+void bench_yield(void *arg) { // 不断把控制权交还给调度器
+	coroutine *co = coroutine_get_sched()->curr_thread;
+
+	while (1) {
+		coroutine_yield(co);
+	}
+}
+
+
+
+int main(int argc, char *argv[]) {
+	coroutine *co = NULL;
+	long rounds = argc > 1 ? atol(argv[1]) : BENCH_ROUNDS;
+	long i = 0;
+
+	coroutine_create(&co, bench_yield, NULL);
+
+	for (i = 0;i < 1000;i ++) { // 预热
+		coroutine_resume(co);
+	}
+
+	uint64_t begin = bench_nsec_now();
+	for (i = 0;i < rounds;i ++) {
+		coroutine_resume(co);
+	}
+	uint64_t used = bench_nsec_now() - begin;
+
+#ifdef _USE_UCONTEXT
+	const char *impl = "ucontext";
+#else
+	const char *impl = "asm";
+#endif
+	printf("%-8s rounds: %ld, %.1f ns per resume/yield\n", impl, rounds, (double)used / rounds);
+
+	return 0;
+}
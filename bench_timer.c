@@ -0,0 +1,135 @@
+/*
+ *  定时器微基准：100 万个同时存在的定时器，分别测量插入、撤销、到期取出的平均耗时，
+ *  对比分层时间轮（默认）与睡眠红黑树（SCHEDULE_TIMER_RBTREE）。
+ *  "same" 为所有协程在同一微秒设置相同的超时（大量连接同时设置相同超时的情形）。
+ *
+ *  make bench_timer
+ */
+
+
+
+#include "coroutine.h"
+
+#include <time.h>
+
+#define BENCH_TIMERS		(1000 * 1000)
+#define BENCH_SPREAD_USECS	(60ull * 1000 * 1000) // 超时随机分布在 60 秒内
+
+
+struct bench_case {
+	const char *name;
+	int flags;
+	int same; // 所有定时器到期时间相同
+	long ntimers;
+	double add_nsec;
+	double del_nsec;
+	double expire_nsec;
+};
+
+
+static uint64_t bench_nsec_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static uint64_t bench_rand(uint64_t *x) {
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+
+static void *bench_thread(void *arg) { // 每种情况独占一个线程，也就独占一个调度器
+	struct bench_case *bc = arg;
+	uint64_t seed = 88172645463325252ull;
+	long i = 0, n = bc->ntimers;
+
+	schedule_create(0, bc->flags);
+	schedule *sched = coroutine_get_sched();
+
+	// 只用到协程结构体中的定时器字段，不需要真正运行协程；时间直接传入，不读时钟
+	coroutine *cos = calloc(n, sizeof(coroutine));
+	long *order = malloc(n * sizeof(long));
+	assert(cos != NULL && order != NULL);
+
+	for (i = 0;i < n;i ++) {
+		cos[i].sched = sched;
+		cos[i].sleep_usecs = bc->same ? 3000000 : 1000 + bench_rand(&seed) % BENCH_SPREAD_USECS;
+		order[i] = i;
+	}
+	for (i = n - 1;i > 0;i --) { // 随机的撤销顺序
+		long j = bench_rand(&seed) % (i + 1);
+		long t = order[i]; order[i] = order[j]; order[j] = t;
+	}
+
+	// 插入
+	uint64_t begin = bench_nsec_now();
+	for (i = 0;i < n;i ++) {
+		schedule_timer_add(&cos[i]);
+	}
+	bc->add_nsec = (double)(bench_nsec_now() - begin) / n;
+
+	// 撤销（例如 I/O 在超时之前就绪）
+	begin = bench_nsec_now();
+	for (i = 0;i < n;i ++) {
+		schedule_timer_del(&cos[order[i]]);
+	}
+	bc->del_nsec = (double)(bench_nsec_now() - begin) / n;
+
+	// 重新插入后按时间推进，逐个取出到期的协程
+	for (i = 0;i < n;i ++) {
+		schedule_timer_add(&cos[i]);
+	}
+
+	long expired = 0;
+	uint64_t now = 0;
+	begin = bench_nsec_now();
+	while (expired < n) {
+		now += 1000; // 每次推进 1ms
+		while (schedule_timer_expired(sched, now) != NULL) {
+			expired ++;
+		}
+	}
+	bc->expire_nsec = (double)(bench_nsec_now() - begin) / n;
+
+	assert(schedule_timer_empty(sched));
+
+	free(order);
+	free(cos);
+	schedule_free(sched);
+
+	return NULL;
+}
+
+
+
+int main(int argc, char *argv[]) {
+	long ntimers = argc > 1 ? atol(argv[1]) : BENCH_TIMERS;
+	struct bench_case cases[] = {
+		{.name = "wheel", .flags = 0, .same = 0},
+		{.name = "rbtree", .flags = SCHEDULE_TIMER_RBTREE, .same = 0},
+		{.name = "wheel-same", .flags = 0, .same = 1},
+		{.name = "rbtree-same", .flags = SCHEDULE_TIMER_RBTREE, .same = 1},
+	};
+	int i = 0;
+
+	printf("%ld timers\n", ntimers);
+	printf("%14s %12s %12s %12s\n", "timer", "add(ns)", "cancel(ns)", "expire(ns)");
+
+	for (i = 0;i < (int)(sizeof(cases) / sizeof(cases[0]));i ++) {
+		pthread_t tid;
+
+		cases[i].ntimers = ntimers;
+		pthread_create(&tid, NULL, bench_thread, &cases[i]);
+		pthread_join(tid, NULL);
+
+		printf("%14s %12.1f %12.1f %12.1f\n", cases[i].name,
+			cases[i].add_nsec, cases[i].del_nsec, cases[i].expire_nsec);
+	}
+
+	return 0;
+}
@@ -0,0 +1,250 @@
+/*
+ *  UDP 批量收发微基准：本机回环上一个线程发送 N 个小数据报，另一个线程接收，三种方式各测一次：
+ *  - 每个数据报一次 sendto / recvfrom；
+ *  - coroutine_sendmmsg / coroutine_recvmmsg，每批 64 个；
+ *  - UDP GSO 发送（一次 send 切成最多 64 个数据报，不超过 64KB）+ GRO 接收（内核不支持时跳过）。
+ *  接收端统计从第一个到最后一个数据报的时间，输出每秒收到的数据报数和丢包率（发送端不限速，接收队列满时内核丢包）。
+ *
+ *  make bench_udp
+ *  ./bench_udp [数据报数] [数据报大小]
+ */
+
+
+
+#include "coroutine.h"
+
+#include <arpa/inet.h>
+#include <time.h>
+
+#define BENCH_PORT			19500
+#define BENCH_DATAGRAMS		(2 * 1000 * 1000)
+#define BENCH_DGRAM_SIZE	64
+#define BENCH_BATCH			64
+#define BENCH_IDLE_MS		200 // 接收端这么久没有收到数据报就认为发送结束
+#define BENCH_RCVBUF		(8 * 1024 * 1024)
+#define BENCH_GSO_BYTES		65000 // 一次 GSO 发送的数据不能超过一个 UDP 数据报的上限（65507）
+
+
+enum bench_mode {
+	BENCH_SINGLE,
+	BENCH_MMSG,
+	BENCH_GSO
+};
+
+
+struct bench_case {
+	const char *name;
+	enum bench_mode mode;
+	unsigned short port;
+	long datagrams;
+	int size;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int bound;
+	long received;
+	double seconds;
+};
+
+
+static uint64_t bench_nsec_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static void bench_addr(struct sockaddr_in *addr, unsigned short port) {
+	memset(addr, 0, sizeof(struct sockaddr_in));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(port);
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+
+
+static void bench_receiver(void *arg) {
+	struct bench_case *bc = arg;
+	int seg_bytes = bc->mode == BENCH_GSO ? BENCH_GSO_BYTES : bc->size; // GRO 合并后一个数据报最多是一次 GSO 发送的大小
+	char *bufs = malloc((size_t)seg_bytes * BENCH_BATCH);
+	char ctls[BENCH_BATCH][CMSG_SPACE(sizeof(int))];
+	struct iovec iov[BENCH_BATCH];
+	struct mmsghdr msgs[BENCH_BATCH];
+	uint64_t first = 0, last = 0;
+	int i = 0;
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in local;
+	bench_addr(&local, bc->port);
+	int rcvbuf = BENCH_RCVBUF;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	if (bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0) {
+		printf("bind port %d failed, errno %d\n", bc->port, errno);
+		exit(1);
+	}
+	if (bc->mode == BENCH_GSO) coroutine_udp_gro(fd, 1);
+
+	pthread_mutex_lock(&bc->mutex);
+	bc->bound = 1;
+	pthread_cond_signal(&bc->cond);
+	pthread_mutex_unlock(&bc->mutex);
+
+	while (bc->received < bc->datagrams) {
+		int timeout = first != 0 ? BENCH_IDLE_MS : 5000;
+
+		if (bc->mode == BENCH_SINGLE) {
+			struct timeval tv = {timeout / 1000, (timeout % 1000) * 1000};
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+			if (recvfrom(fd, bufs, bc->size, 0, NULL, NULL) < 0) break;
+			bc->received ++;
+		} else {
+			for (i = 0;i < BENCH_BATCH;i ++) {
+				iov[i].iov_base = bufs + (size_t)i * seg_bytes;
+				iov[i].iov_len = seg_bytes;
+				memset(&msgs[i], 0, sizeof(struct mmsghdr));
+				msgs[i].msg_hdr.msg_iov = &iov[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+				msgs[i].msg_hdr.msg_control = ctls[i];
+				msgs[i].msg_hdr.msg_controllen = sizeof(ctls[i]);
+			}
+
+			int n = coroutine_recvmmsg(fd, msgs, BENCH_BATCH, 0, timeout);
+			if (n <= 0) break;
+
+			for (i = 0;i < n;i ++) { // GRO 合并的数据报按段长拆回原来的个数
+				int seg = coroutine_udp_gro_size(&msgs[i].msg_hdr);
+				bc->received += seg > 0 ? (msgs[i].msg_len + seg - 1) / seg : 1;
+			}
+		}
+
+		last = bench_nsec_now();
+		if (first == 0) first = last;
+	}
+
+	bc->seconds = (double)(last - first) / 1e9;
+	close(fd);
+	free(bufs);
+}
+
+
+static void bench_sender(void *arg) {
+	struct bench_case *bc = arg;
+	char *bufs = calloc(BENCH_BATCH, bc->size);
+	struct iovec iov[BENCH_BATCH];
+	struct mmsghdr msgs[BENCH_BATCH];
+	long sent = 0;
+	int i = 0;
+	int gso_batch = BENCH_GSO_BYTES / bc->size < BENCH_BATCH ? BENCH_GSO_BYTES / bc->size : BENCH_BATCH;
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in remote;
+	bench_addr(&remote, bc->port);
+	if (connect(fd, (struct sockaddr *)&remote, sizeof(remote)) != 0) {
+		printf("connect failed, errno %d\n", errno);
+		exit(1);
+	}
+	if (bc->mode == BENCH_GSO) coroutine_udp_gso(fd, bc->size);
+
+	for (i = 0;i < BENCH_BATCH;i ++) {
+		iov[i].iov_base = bufs + (size_t)i * bc->size;
+		iov[i].iov_len = bc->size;
+		memset(&msgs[i], 0, sizeof(struct mmsghdr));
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < bc->datagrams) {
+		int batch = bc->datagrams - sent < BENCH_BATCH ? (int)(bc->datagrams - sent) : BENCH_BATCH;
+
+		if (bc->mode == BENCH_SINGLE) {
+			if (sendto(fd, bufs, bc->size, 0, NULL, 0) < 0) break;
+			sent ++;
+		} else if (bc->mode == BENCH_MMSG) {
+			int n = coroutine_sendmmsg(fd, msgs, batch, 0, -1);
+			if (n <= 0) break;
+			sent += n;
+		} else {
+			if (batch > gso_batch) batch = gso_batch;
+			if (send(fd, bufs, (size_t)batch * bc->size, 0) < 0) break; // 一次 send 由 GSO 切成 batch 个数据报
+			sent += batch;
+		}
+	}
+
+	close(fd);
+	free(bufs);
+}
+
+
+static void *bench_thread(void *arg) {
+	struct bench_case *bc = arg;
+	coroutine *co = NULL;
+
+	schedule_create(0, SCHEDULE_SHARED_STACK);
+	if (!bc->bound) {
+		coroutine_create(&co, bench_receiver, bc);
+	} else {
+		coroutine_create(&co, bench_sender, bc);
+	}
+	schedule_run();
+
+	return NULL;
+}
+
+
+// 内核是否支持 UDP GSO / GRO
+static int bench_gso_supported(void) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	int ok = coroutine_udp_gso(fd, BENCH_DGRAM_SIZE) == 0 && coroutine_udp_gro(fd, 1) == 0;
+	close(fd);
+
+	return ok;
+}
+
+
+
+int main(int argc, char *argv[]) {
+	long datagrams = argc > 1 ? atol(argv[1]) : BENCH_DATAGRAMS;
+	int size = argc > 2 ? atoi(argv[2]) : BENCH_DGRAM_SIZE;
+	struct bench_case cases[] = {
+		{.name = "sendto/recvfrom", .mode = BENCH_SINGLE},
+		{.name = "sendmmsg/recvmmsg", .mode = BENCH_MMSG},
+		{.name = "GSO/GRO", .mode = BENCH_GSO},
+	};
+	int i = 0;
+
+	printf("%ld datagrams x %d bytes, batch %d\n", datagrams, size, BENCH_BATCH);
+	printf("%20s %14s %8s\n", "api", "datagrams/s", "loss");
+
+	for (i = 0;i < (int)(sizeof(cases) / sizeof(cases[0]));i ++) {
+		struct bench_case *bc = &cases[i];
+		pthread_t receiver, sender;
+
+		if (bc->mode == BENCH_GSO && !bench_gso_supported()) {
+			printf("%20s %14s\n", bc->name, "unsupported");
+			continue;
+		}
+
+		bc->port = BENCH_PORT + i;
+		bc->datagrams = datagrams;
+		bc->size = size;
+		pthread_mutex_init(&bc->mutex, NULL);
+		pthread_cond_init(&bc->cond, NULL);
+
+		pthread_create(&receiver, NULL, bench_thread, bc);
+
+		pthread_mutex_lock(&bc->mutex);
+		while (!bc->bound) {
+			pthread_cond_wait(&bc->cond, &bc->mutex);
+		}
+		pthread_mutex_unlock(&bc->mutex);
+
+		pthread_create(&sender, NULL, bench_thread, bc);
+		pthread_join(sender, NULL);
+		pthread_join(receiver, NULL);
+
+		printf("%20s %14.0f %7.1f%%\n", bc->name, bc->seconds > 0 ? bc->received / bc->seconds : 0,
+			100.0 * (bc->datagrams - bc->received) / bc->datagrams);
+	}
+
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ *  epoll 与 io_uring 后端对比：本机回环上的 echo 往返。
+ *  服务端线程分别使用两种后端，客户端线程固定使用 epoll 后端，C 个连接各做 R 次 64 字节的请求/响应。
+ *  io_uring 后端额外输出平均每个请求的 io_uring_enter 次数。
+ *
+ *  make bench_uring
+ *  ./bench_uring [连接数] [每个连接的请求数]
+ */
+
+
+
+#include "coroutine.h"
+
+#include <arpa/inet.h>
+#include <time.h>
+
+#define BENCH_PORT			19300
+#define BENCH_CONNECTIONS	64
+#define BENCH_REQUESTS		20000
+#define BENCH_MSG_SIZE		64
+
+
+struct bench_case {
+	const char *name;
+	int flags; // 服务端调度器的 flags
+	unsigned short port;
+	int nconns;
+	long requests;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int listening;
+	double seconds;
+	uint64_t enters;
+};
+
+
+static struct bench_case *current; // 正在运行的情况
+
+
+static uint64_t bench_nsec_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static void bench_echo(void *arg) {
+	int fd = (int)(intptr_t)arg;
+	char buf[BENCH_MSG_SIZE];
+
+	while (1) {
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0) break;
+		if (send(fd, buf, n, 0) != n) break;
+	}
+	close(fd);
+
+	// 调度器在 schedule_run 结束时释放，每个连接结束时记一次，最后一个连接记下的就是总数
+	current->enters = schedule_uring_enters(coroutine_get_sched());
+}
+
+
+static void bench_acceptor(void *arg) {
+	struct bench_case *bc = arg;
+	int i = 0;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(bc->port);
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0 || listen(fd, SOMAXCONN) != 0) {
+		printf("bind/listen port %d failed, errno %d\n", bc->port, errno);
+		exit(1);
+	}
+
+	pthread_mutex_lock(&bc->mutex);
+	bc->listening = 1;
+	pthread_cond_signal(&bc->cond);
+	pthread_mutex_unlock(&bc->mutex);
+
+	for (i = 0;i < bc->nconns;i ++) { // 所有连接建立后退出，连接全部关闭后服务端调度器结束
+		int cli_fd = accept(fd, NULL, NULL);
+		if (cli_fd < 0) break;
+
+		coroutine *co = NULL;
+		coroutine_create(&co, bench_echo, (void *)(intptr_t)cli_fd);
+	}
+	close(fd);
+}
+
+
+static void *bench_server(void *arg) {
+	struct bench_case *bc = arg;
+	coroutine *co = NULL;
+
+	schedule_create(0, bc->flags);
+	coroutine_create(&co, bench_acceptor, bc);
+
+	schedule_run();
+
+	return NULL;
+}
+
+
+static void bench_client(void *arg) {
+	struct bench_case *bc = arg;
+	char buf[BENCH_MSG_SIZE];
+	long i = 0;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in remote;
+	memset(&remote, 0, sizeof(remote));
+	remote.sin_family = AF_INET;
+	remote.sin_port = htons(bc->port);
+	remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *)&remote, sizeof(remote)) != 0) {
+		printf("connect failed, errno %d\n", errno);
+		exit(1);
+	}
+
+	memset(buf, 'x', sizeof(buf));
+	for (i = 0;i < bc->requests;i ++) {
+		if (send(fd, buf, sizeof(buf), 0) != sizeof(buf)) break;
+
+		size_t got = 0;
+		while (got < sizeof(buf)) {
+			ssize_t n = recv(fd, buf + got, sizeof(buf) - got, 0);
+			if (n <= 0) {
+				printf("recv failed, errno %d\n", errno);
+				exit(1);
+			}
+			got += n;
+		}
+	}
+	close(fd);
+}
+
+
+static void *bench_clients(void *arg) {
+	struct bench_case *bc = arg;
+	int i = 0;
+
+	schedule_create(0, SCHEDULE_SHARED_STACK);
+	for (i = 0;i < bc->nconns;i ++) {
+		coroutine *co = NULL;
+		coroutine_create(&co, bench_client, bc);
+	}
+
+	uint64_t begin = bench_nsec_now();
+	schedule_run();
+	bc->seconds = (double)(bench_nsec_now() - begin) / 1e9;
+
+	return NULL;
+}
+
+
+
+int main(int argc, char *argv[]) {
+	int nconns = argc > 1 ? atoi(argv[1]) : BENCH_CONNECTIONS;
+	long requests = argc > 2 ? atol(argv[2]) : BENCH_REQUESTS;
+	struct bench_case cases[] = {
+		{.name = "epoll", .flags = SCHEDULE_SHARED_STACK},
+		{.name = "io_uring", .flags = SCHEDULE_IO_URING},
+	};
+	int i = 0;
+
+	printf("%d connections x %ld requests\n", nconns, requests);
+	printf("%10s %14s %14s\n", "server", "requests/s", "enters/req");
+
+	for (i = 0;i < (int)(sizeof(cases) / sizeof(cases[0]));i ++) {
+		struct bench_case *bc = &cases[i];
+		pthread_t server, clients;
+
+		bc->port = BENCH_PORT + i;
+		bc->nconns = nconns;
+		bc->requests = requests;
+		pthread_mutex_init(&bc->mutex, NULL);
+		pthread_cond_init(&bc->cond, NULL);
+		current = bc;
+
+		pthread_create(&server, NULL, bench_server, bc);
+
+		pthread_mutex_lock(&bc->mutex);
+		while (!bc->listening) {
+			pthread_cond_wait(&bc->cond, &bc->mutex);
+		}
+		pthread_mutex_unlock(&bc->mutex);
+
+		pthread_create(&clients, NULL, bench_clients, bc);
+		pthread_join(clients, NULL);
+		pthread_join(server, NULL);
+
+		double total = (double)nconns * requests;
+		printf("%10s %14.0f", bc->name, total / bc->seconds);
+		if (bc->flags & SCHEDULE_IO_URING) {
+			printf(" %14.3f", bc->enters / total);
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
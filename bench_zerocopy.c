@@ -0,0 +1,217 @@
+/*
+ *  大块发送微基准：一个线程的协程通过 TCP 连接发送共 N MB 数据，另一个线程接收并丢弃，比较三种发送方式的吞吐：
+ *  - send：每块复制进内核；
+ *  - coroutine_send_zerocopy：MSG_ZEROCOPY，同时有 4 块在途，按 ticket 等待完成后重用缓冲区；
+ *  - sendfile：从临时文件（已在页缓存中）直接发送。
+ *  本机回环上内核总是复制（完成通知带 SO_EE_CODE_ZEROCOPY_COPIED），coroutine_send_zerocopy 随后退回普通发送，
+ *  输出中标出；零拷贝的收益要在真实网卡上测，第一个参数给出接收端的地址（在对端运行 ./bench_zerocopy -s）。
+ *
+ *  make bench_zerocopy
+ *  ./bench_zerocopy [接收端地址] [总MB数] [每块KB数]
+ *  ./bench_zerocopy -s      只运行接收端
+ */
+
+
+
+#include "coroutine.h"
+
+#include <arpa/inet.h>
+#include <time.h>
+
+#define BENCH_PORT			19600
+#define BENCH_TOTAL_MB		2048
+#define BENCH_CHUNK_KB		1024
+#define BENCH_INFLIGHT		4
+
+
+enum bench_mode {
+	BENCH_SEND,
+	BENCH_ZEROCOPY,
+	BENCH_SENDFILE
+};
+
+
+static const char *host = "127.0.0.1";
+static size_t total_bytes, chunk_bytes;
+static int sink_fd = -1;
+
+
+static uint64_t bench_nsec_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+static void bench_sink_conn(void *arg) {
+	int fd = (int)(intptr_t)arg;
+	static __thread char buf[256 * 1024]; // 不放在共享栈上
+
+	while (recv(fd, buf, sizeof(buf), 0) > 0) ;
+	close(fd);
+}
+
+
+static void bench_sink(void *arg) {
+	while (1) {
+		int fd = accept(sink_fd, NULL, NULL);
+		if (fd < 0) break;
+
+		coroutine *co = NULL;
+		coroutine_create(&co, bench_sink_conn, (void *)(intptr_t)fd);
+	}
+}
+
+
+static void *bench_sink_thread(void *arg) {
+	coroutine *co = NULL;
+
+	schedule_create(0, SCHEDULE_SHARED_STACK);
+	coroutine_create(&co, bench_sink, NULL);
+	schedule_run();
+
+	return NULL;
+}
+
+
+static int bench_listen(void) {
+	int on = 1;
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(BENCH_PORT);
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	sink_fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(sink_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(sink_fd, (struct sockaddr *)&local, sizeof(local)) != 0 || listen(sink_fd, SOMAXCONN) != 0) {
+		printf("bind/listen port %d failed, errno %d\n", BENCH_PORT, errno);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+struct bench_case {
+	const char *name;
+	enum bench_mode mode;
+	double seconds;
+	int copied; // 零拷贝被内核退回了复制
+};
+
+
+static void bench_sender(void *arg) {
+	struct bench_case *bc = arg;
+	char *bufs[BENCH_INFLIGHT];
+	uint32_t tickets[BENCH_INFLIGHT];
+	int file_fd = -1;
+	size_t sent = 0;
+	int i = 0;
+
+	for (i = 0;i < BENCH_INFLIGHT;i ++) {
+		bufs[i] = malloc(chunk_bytes);
+		memset(bufs[i], 'z', chunk_bytes);
+		tickets[i] = 0;
+	}
+
+	if (bc->mode == BENCH_SENDFILE) { // 一块大小的临时文件，反复发送，读取总在页缓存中
+		char path[] = "/tmp/bench_zerocopy_XXXXXX";
+		file_fd = mkstemp(path);
+		unlink(path);
+		if (file_fd < 0 || write(file_fd, bufs[0], chunk_bytes) != (ssize_t)chunk_bytes) {
+			printf("temp file failed, errno %d\n", errno);
+			exit(1);
+		}
+	}
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in remote;
+	memset(&remote, 0, sizeof(remote));
+	remote.sin_family = AF_INET;
+	remote.sin_port = htons(BENCH_PORT);
+	inet_pton(AF_INET, host, &remote.sin_addr);
+	if (connect(fd, (struct sockaddr *)&remote, sizeof(remote)) != 0) {
+		printf("connect %s failed, errno %d\n", host, errno);
+		exit(1);
+	}
+
+	uint64_t begin = bench_nsec_now();
+	for (i = 0;sent < total_bytes;i = (i + 1) % BENCH_INFLIGHT) {
+		ssize_t n = 0;
+
+		if (bc->mode == BENCH_SEND) {
+			n = send(fd, bufs[i], chunk_bytes, 0);
+		} else if (bc->mode == BENCH_ZEROCOPY) {
+			if (coroutine_zerocopy_wait(fd, tickets[i], -1) != 0) break; // 这块缓冲区上一次的发送完成后才能重用
+			n = coroutine_send_zerocopy(fd, bufs[i], chunk_bytes, 0, &tickets[i]);
+		} else {
+			off_t offset = 0;
+			n = sendfile(fd, file_fd, &offset, chunk_bytes);
+		}
+		if (n <= 0) {
+			printf("%s failed, errno %d\n", bc->name, errno);
+			exit(1);
+		}
+		sent += n;
+	}
+	if (bc->mode == BENCH_ZEROCOPY) {
+		for (i = 0;i < BENCH_INFLIGHT;i ++) {
+			coroutine_zerocopy_wait(fd, tickets[i], -1);
+		}
+		bc->copied = coroutine_get_sched()->fds[fd].zc->copied;
+	}
+	bc->seconds = (double)(bench_nsec_now() - begin) / 1e9;
+
+	close(fd);
+	if (file_fd >= 0) close(file_fd);
+	for (i = 0;i < BENCH_INFLIGHT;i ++) {
+		free(bufs[i]);
+	}
+}
+
+
+
+int main(int argc, char *argv[]) {
+	struct bench_case cases[] = {
+		{.name = "send", .mode = BENCH_SEND},
+		{.name = "zerocopy", .mode = BENCH_ZEROCOPY},
+		{.name = "sendfile", .mode = BENCH_SENDFILE},
+	};
+	pthread_t sink;
+	int i = 0;
+
+	if (argc > 1 && strcmp(argv[1], "-s") == 0) { // 只运行接收端
+		if (bench_listen() != 0) return 1;
+		bench_sink_thread(NULL);
+		return 0;
+	}
+
+	if (argc > 1) host = argv[1];
+	total_bytes = (size_t)(argc > 2 ? atol(argv[2]) : BENCH_TOTAL_MB) << 20;
+	chunk_bytes = (size_t)(argc > 3 ? atol(argv[3]) : BENCH_CHUNK_KB) << 10;
+
+	if (strcmp(host, "127.0.0.1") == 0) { // 本机测试时在另一个线程中接收
+		if (bench_listen() != 0) return 1;
+		pthread_create(&sink, NULL, bench_sink_thread, NULL);
+	}
+
+	printf("%zu MB to %s in %zu KB chunks\n", total_bytes >> 20, host, chunk_bytes >> 10);
+	printf("%10s %10s\n", "api", "MB/s");
+
+	for (i = 0;i < (int)(sizeof(cases) / sizeof(cases[0]));i ++) {
+		struct bench_case *bc = &cases[i];
+
+		schedule_create(0, SCHEDULE_SHARED_STACK);
+		coroutine *co = NULL;
+		coroutine_create(&co, bench_sender, bc);
+		schedule_run();
+
+		printf("%10s %10.0f%s\n", bc->name, (total_bytes >> 20) / bc->seconds,
+			bc->copied ? "  (kernel copied, fell back to send)" : "");
+	}
+
+	return 0; // 接收线程阻塞在 accept 中，随进程退出
+}
@@ -0,0 +1,405 @@
+#include "coroutine.h"
+
+
+
+/*
+通道：协程之间传递定长元素的队列，多生产者多消费者，发送方和接收方可以在不同的调度器（线程）上。
+
+- 容量为 CO_CHANNEL_UNBOUNDED 时不限长度，缓冲区满时翻倍扩容，发送从不挂起；否则缓冲区满时发送挂起。
+- 元素按 elem_size 复制进出通道，复制都在发送/接收的协程自己运行时完成，共享栈上的元素也可以直接使用。
+  elem_size 为 0 时为指针模式：通道里只传递指针（coroutine_channel_send_ptr / recv_ptr），消息本身不复制，
+  所有权随指针一起交给接收方。
+- 缓冲区空时接收挂起。等待的协程通过 cond_next 挂在通道的 senders/receivers 队列上，coroutine_park 挂起，
+  另一方改变状态后从队列中取出一个协程 coroutine_wake 唤醒。醒来后重新加锁检查，
+  元素可能已经被其他接收者取走，此时重新排队。
+- coroutine_channel_select 同时等待多个通道上的发送/接收，可以带超时。一个协程只有一个 cond_next，
+  所以 select 在每个通道的 selectors 链表上登记单独分配的节点，通道状态改变时唤醒所有方向匹配的 select 等待者。
+- 关闭后不能再发送；接收方取完剩余的元素后返回 -1，errno 为 EPIPE。关闭时唤醒所有等待者。
+- 等待按协程的截止时间缩短，被取消或超过截止时间时离开队列，返回 -1，errno 为 ECANCELED / ETIMEDOUT；
+  元素已经可以取走（或已经有空位）时以成功为准。
+
+阻塞的发送/接收只能在协程中调用，否则返回 -1，errno 为 EPERM；trysend/tryrecv 和 timeout_ms 为 0 的 select 不会挂起，可以在任何线程中调用。
+*/
+
+
+#define CO_CHANNEL_INIT_SIZE	16 // 不限容量的通道初始缓冲区大小
+
+
+// 协程是否在通道的等待队列上：出队时把 tqe_prev 置空作为标记
+static inline int channel_queued(coroutine *co) {
+	return co->cond_next.tqe_prev != NULL;
+}
+
+static inline void channel_dequeue(coroutine_queue *queue, coroutine *co) {
+	TAILQ_REMOVE(queue, co, cond_next);
+	co->cond_next.tqe_prev = NULL;
+}
+
+
+// 唤醒队列中的第一个协程以及方向为 dir 的所有 select 等待者，调用者持有通道的锁
+static void channel_wake(coroutine_channel *ch, coroutine_queue *queue, int dir) {
+
+	coroutine *co = TAILQ_FIRST(queue);
+	if (co != NULL) {
+		channel_dequeue(queue, co);
+		coroutine_wake(co);
+	}
+
+	coroutine_channel_selector *sel = NULL;
+	LIST_FOREACH(sel, &ch->selectors, next) {
+		if (sel->dir == dir) coroutine_wake(sel->co);
+	}
+}
+
+
+static void channel_wake_all(coroutine_queue *queue) {
+
+	while (!TAILQ_EMPTY(queue)) {
+		coroutine *co = TAILQ_FIRST(queue);
+		channel_dequeue(queue, co);
+		coroutine_wake(co);
+	}
+}
+
+
+// 不限容量的通道扩容，把环形缓冲区展开到新缓冲区的开头
+static int channel_grow(coroutine_channel *ch) {
+
+	size_t size = ch->size ? ch->size * 2 : CO_CHANNEL_INIT_SIZE;
+	char *buf = malloc(size * ch->elem_size);
+	if (buf == NULL) return -1;
+
+	size_t first = ch->size - ch->head < ch->count ? ch->size - ch->head : ch->count;
+	memcpy(buf, ch->buf + ch->head * ch->elem_size, first * ch->elem_size);
+	memcpy(buf + first * ch->elem_size, ch->buf, (ch->count - first) * ch->elem_size);
+
+	free(ch->buf);
+	ch->buf = buf;
+	ch->size = size;
+	ch->head = 0;
+
+	return 0;
+}
+
+
+// 放入一个元素，调用者持有锁。返回 0 成功，-1 缓冲区满，-2 已关闭或内存不足（errno）
+static int channel_put(coroutine_channel *ch, const void *elem) {
+
+	if (ch->closed) {
+		errno = EPIPE;
+		return -2;
+	}
+	if (ch->capacity != CO_CHANNEL_UNBOUNDED && ch->count >= ch->capacity) return -1;
+	if (ch->count == ch->size && channel_grow(ch) != 0) {
+		errno = ENOMEM;
+		return -2;
+	}
+
+	size_t tail = (ch->head + ch->count) % ch->size;
+	memcpy(ch->buf + tail * ch->elem_size, elem, ch->elem_size);
+	ch->count ++;
+
+	channel_wake(ch, &ch->receivers, CO_CHANNEL_RECV);
+	return 0;
+}
+
+
+// 取出一个元素，调用者持有锁。返回 0 成功，-1 缓冲区空，-2 已关闭且取完
+static int channel_take(coroutine_channel *ch, void *elem) {
+
+	if (ch->count == 0) {
+		if (ch->closed) {
+			errno = EPIPE;
+			return -2;
+		}
+		return -1;
+	}
+
+	memcpy(elem, ch->buf + ch->head * ch->elem_size, ch->elem_size);
+	ch->head = (ch->head + 1) % ch->size;
+	ch->count --;
+
+	channel_wake(ch, &ch->senders, CO_CHANNEL_SEND);
+	return 0;
+}
+
+
+static inline int channel_try(coroutine_channel *ch, int dir, void *elem) {
+	return dir == CO_CHANNEL_SEND ? channel_put(ch, elem) : channel_take(ch, elem);
+}
+
+
+
+// 创建通道：elem_size 为 0 时为指针模式；capacity 为 CO_CHANNEL_UNBOUNDED 时不限容量
+coroutine_channel *coroutine_channel_create(size_t elem_size, size_t capacity) {
+
+	coroutine_channel *ch = calloc(1, sizeof(coroutine_channel));
+	if (ch == NULL) return NULL;
+
+	ch->elem_size = elem_size ? elem_size : sizeof(void *);
+	ch->capacity = capacity;
+
+	if (capacity != CO_CHANNEL_UNBOUNDED) { // 有界的通道一次分配好
+		ch->buf = malloc(capacity * ch->elem_size);
+		if (ch->buf == NULL) {
+			free(ch);
+			return NULL;
+		}
+		ch->size = capacity;
+	}
+
+	pthread_mutex_init(&ch->mutex, NULL);
+	TAILQ_INIT(&ch->senders);
+	TAILQ_INIT(&ch->receivers);
+	LIST_INIT(&ch->selectors);
+
+	return ch;
+}
+
+
+// 关闭通道并唤醒所有等待者，重复关闭没有影响
+void coroutine_channel_close(coroutine_channel *ch) {
+
+	pthread_mutex_lock(&ch->mutex);
+
+	ch->closed = 1;
+	channel_wake_all(&ch->senders);
+	channel_wake_all(&ch->receivers);
+
+	coroutine_channel_selector *sel = NULL;
+	LIST_FOREACH(sel, &ch->selectors, next) {
+		coroutine_wake(sel->co);
+	}
+
+	pthread_mutex_unlock(&ch->mutex);
+}
+
+
+// 释放通道，调用者保证已经没有协程在使用它；指针模式下剩余的指针由调用者处理
+void coroutine_channel_free(coroutine_channel *ch) {
+
+	if (ch == NULL) return ;
+
+	pthread_mutex_destroy(&ch->mutex);
+	free(ch->buf);
+	free(ch);
+}
+
+
+size_t coroutine_channel_len(coroutine_channel *ch) {
+
+	pthread_mutex_lock(&ch->mutex);
+	size_t count = ch->count;
+	pthread_mutex_unlock(&ch->mutex);
+
+	return count;
+}
+
+
+
+// 发送/接收一个元素，不成功时在 queue 上排队并挂起，醒来后重试。intr 为 0 时不响应取消和截止时间
+static int channel_op(coroutine_channel *ch, int dir, void *elem, int intr) {
+
+	schedule *sched = coroutine_get_sched();
+	coroutine *co = sched != NULL ? sched->curr_thread : NULL;
+	coroutine_queue *queue = dir == CO_CHANNEL_SEND ? &ch->senders : &ch->receivers;
+
+	if (co == NULL) { // 不在协程中，无法挂起
+		errno = EPERM;
+		return -1;
+	}
+
+	pthread_mutex_lock(&ch->mutex);
+
+	int parked = 0;
+	while (1) {
+		int ret = channel_try(ch, dir, elem);
+		if (ret != -1) {
+			if (channel_queued(co)) channel_dequeue(queue, co); // 醒来之前又被重复唤醒时可能还在队列里
+			pthread_mutex_unlock(&ch->mutex);
+			return ret == 0 ? 0 : -1;
+		}
+
+		if (intr && schedule_interrupted(co) < 0) { // 被取消或超过截止时间，离开队列
+			int err = errno;
+			if (channel_queued(co)) {
+				channel_dequeue(queue, co);
+			} else if (parked && !TAILQ_EMPTY(queue)) { // 可能是被选中唤醒的，把唤醒转给下一个等待者
+				coroutine *next = TAILQ_FIRST(queue);
+				channel_dequeue(queue, next);
+				coroutine_wake(next);
+			}
+			pthread_mutex_unlock(&ch->mutex);
+			errno = err;
+			return -1;
+		}
+
+		if (!channel_queued(co)) {
+			TAILQ_INSERT_TAIL(queue, co, cond_next);
+		}
+		pthread_mutex_unlock(&ch->mutex);
+
+		// 出队和唤醒在对方持锁时完成，唤醒先于挂起到达也不会丢失；截止时间到达或被取消时提前醒来
+		coroutine_park_timeout(intr ? schedule_deadline_msecs(co, -1) : -1);
+		parked = 1;
+
+		pthread_mutex_lock(&ch->mutex);
+	}
+}
+
+
+// 发送一个元素（复制 elem_size 字节），缓冲区满时挂起。返回 0 成功，-1 通道已关闭（errno 为 EPIPE）
+int coroutine_channel_send(coroutine_channel *ch, const void *elem) {
+	return channel_op(ch, CO_CHANNEL_SEND, (void *)elem, 1);
+}
+
+
+// 接收一个元素，缓冲区空时挂起。返回 0 成功，-1 通道已关闭且没有剩余元素（errno 为 EPIPE）
+int coroutine_channel_recv(coroutine_channel *ch, void *elem) {
+	return channel_op(ch, CO_CHANNEL_RECV, elem, 1);
+}
+
+
+// 不响应取消和截止时间的接收，协程组释放时等待子协程结束使用
+int schedule_channel_recv(coroutine_channel *ch, void *elem) {
+	return channel_op(ch, CO_CHANNEL_RECV, elem, 0);
+}
+
+
+// 不挂起的发送，可以在任何线程中调用。返回 0 成功，-1 失败：缓冲区满（EAGAIN）或通道已关闭（EPIPE）
+int coroutine_channel_trysend(coroutine_channel *ch, const void *elem) {
+
+	pthread_mutex_lock(&ch->mutex);
+	int ret = channel_put(ch, elem);
+	pthread_mutex_unlock(&ch->mutex);
+
+	if (ret == -1) errno = EAGAIN;
+	return ret == 0 ? 0 : -1;
+}
+
+
+// 不挂起的接收，可以在任何线程中调用。返回 0 成功，-1 失败：缓冲区空（EAGAIN）或通道已关闭且取完（EPIPE）
+int coroutine_channel_tryrecv(coroutine_channel *ch, void *elem) {
+
+	pthread_mutex_lock(&ch->mutex);
+	int ret = channel_take(ch, elem);
+	pthread_mutex_unlock(&ch->mutex);
+
+	if (ret == -1) errno = EAGAIN;
+	return ret == 0 ? 0 : -1;
+}
+
+
+// 指针模式：只传递指针，消息本身不复制
+int coroutine_channel_send_ptr(coroutine_channel *ch, void *ptr) {
+	return coroutine_channel_send(ch, &ptr);
+}
+
+
+// 指针模式的接收，通道关闭且取完时返回 NULL
+void *coroutine_channel_recv_ptr(coroutine_channel *ch) {
+
+	void *ptr = NULL;
+	if (coroutine_channel_recv(ch, &ptr) != 0) return NULL;
+
+	return ptr;
+}
+
+
+
+// 把 select 在各通道上登记的节点全部摘下
+static void channel_select_unregister(coroutine_channel_op *ops, coroutine_channel_selector *sels, int nregistered) {
+
+	int i = 0;
+	for (i = 0;i < nregistered;i ++) {
+		pthread_mutex_lock(&ops[i].ch->mutex);
+		LIST_REMOVE(&sels[i], next);
+		pthread_mutex_unlock(&ops[i].ch->mutex);
+	}
+}
+
+
+/* 等待多个分支中的任意一个完成：按顺序尝试每个分支，都不能完成时在所有通道上登记后挂起，被唤醒后重新尝试。
+   返回完成的分支下标，ops[i].ret 为 0 表示成功，-1 表示通道已关闭；timeout_ms 内没有分支完成时返回 -1，errno 为 ETIMEDOUT；
+   被取消或超过截止时间返回 -1，errno 为 ECANCELED / ETIMEDOUT。timeout_ms < 0 一直等待，为 0 时只尝试一次 */
+int coroutine_channel_select(coroutine_channel_op *ops, int nops, int64_t timeout_ms) {
+
+	schedule *sched = coroutine_get_sched();
+	coroutine *co = sched != NULL ? sched->curr_thread : NULL;
+	coroutine_channel_selector *sels = NULL;
+	uint64_t deadline = timeout_ms > 0 ? coroutine_usec_now() + timeout_ms * 1000u : 0;
+	int i = 0;
+
+	if (co == NULL && timeout_ms != 0) { // 不在协程中只能尝试一次
+		errno = EPERM;
+		return -1;
+	}
+
+	if (timeout_ms != 0) {
+		sels = calloc(nops, sizeof(coroutine_channel_selector)); // 挂起期间其他线程会访问，不能放在共享栈上
+		if (sels == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	while (1) {
+		int nregistered = 0, selected = -1;
+
+		// 检查与登记在同一次加锁中完成，登记之后的状态改变一定会唤醒本协程
+		for (i = 0;i < nops;i ++) {
+			coroutine_channel *ch = ops[i].ch;
+
+			pthread_mutex_lock(&ch->mutex);
+			int ret = channel_try(ch, ops[i].dir, ops[i].elem);
+			if (ret != -1) {
+				ops[i].ret = ret == 0 ? 0 : -1;
+				selected = i;
+				pthread_mutex_unlock(&ch->mutex);
+				break;
+			}
+			if (sels != NULL) {
+				sels[i].co = co;
+				sels[i].dir = ops[i].dir;
+				LIST_INSERT_HEAD(&ch->selectors, &sels[i], next);
+				nregistered ++;
+			}
+			pthread_mutex_unlock(&ch->mutex);
+		}
+
+		if (selected >= 0) {
+			if (sels != NULL) channel_select_unregister(ops, sels, nregistered);
+			free(sels);
+			return selected;
+		}
+		if (timeout_ms == 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if (schedule_interrupted(co) < 0) { // 被取消或超过截止时间
+			int err = errno;
+			channel_select_unregister(ops, sels, nregistered);
+			free(sels);
+			errno = err;
+			return -1;
+		}
+
+		int64_t wait_ms = -1;
+		if (timeout_ms > 0) {
+			uint64_t now = coroutine_usec_now();
+			wait_ms = now < deadline ? (int64_t)(deadline - now + 999) / 1000 : 0;
+		}
+		wait_ms = schedule_deadline_msecs(co, wait_ms); // 截止时间到达时醒来，下一轮返回 ETIMEDOUT
+
+		int timedout = wait_ms == 0 || coroutine_park_timeout(wait_ms) != 0;
+
+		// 醒来后摘下所有登记，下一轮重新检查并登记
+		channel_select_unregister(ops, sels, nregistered);
+
+		if (timedout) {
+			free(sels);
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+}
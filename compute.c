@@ -0,0 +1,272 @@
+#include <time.h>
+
+#include "coroutine.h"
+
+
+
+/*
+线程池：协程把一个会阻塞（或耗时）的函数交给线程池中的线程执行，自己挂起，调度器继续运行其他协程。
+线程执行完后把协程放回其所属调度器的 defer 队列（schedule_defer_push，调度器阻塞时通过 eventfd 唤醒），协程在原调度器上恢复执行。
+
+每个线程对应一个 coroutine_compute_sched，有自己的任务队列（等待执行的协程，通过 compute_next 链接）。
+提交时优先选择空闲且队列为空的线程，否则轮询。
+
+有两个线程池：
+- 阻塞调用线程池（coroutine_blocking_call）：文件读写、open、getaddrinfo 等大部分时间在等待的调用，线程数可以多于 CPU 数；
+- 计算线程池（coroutine_run_compute）：哈希、压缩等 CPU 密集的任务，线程数默认为 CPU 数，
+  避免一个连接的计算占住调度器线程，使同一调度器上的其他连接得不到处理。
+每个线程池统计排队深度、排队时延和执行时间（coroutine_compute_pool_stats）。
+
+线程池线程上没有调度器，任务函数中调用被 hook 的函数会直接执行原系统调用。
+共享栈模式下协程挂起后其栈上的内容会被其他协程覆盖，任务函数不能访问协程栈上的数据。
+*/
+
+
+static coroutine_compute_pool blocking_pool = { // 阻塞调用（文件读写、open、stat、getaddrinfo 等）
+	.start_mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static coroutine_compute_pool compute_pool = { // CPU 密集的计算
+	.start_mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+
+// 统计用的单调时钟（coroutine_usec_now 是墙上时间，会被调整）
+static inline uint64_t compute_nsec_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void compute_atomic_max_int(atomic_int *max, int v) {
+	int old = atomic_load_explicit(max, memory_order_relaxed);
+	while (v > old && !atomic_compare_exchange_weak_explicit(max, &old, v,
+		memory_order_relaxed, memory_order_relaxed));
+}
+
+static inline void compute_atomic_max_u64(atomic_uint_fast64_t *max, uint64_t v) {
+	uint_fast64_t old = atomic_load_explicit(max, memory_order_relaxed);
+	while (v > old && !atomic_compare_exchange_weak_explicit(max, &old, v,
+		memory_order_relaxed, memory_order_relaxed));
+}
+
+
+
+static void *coroutine_compute_main(void *arg) {
+
+	coroutine_compute_sched *cs = arg;
+	coroutine_compute_pool *pool = cs->pool;
+
+	while (1) {
+		pthread_mutex_lock(&cs->run_mutex);
+		while (TAILQ_EMPTY(&cs->coroutines)) {
+			cs->compute_status = COROUTINE_COMPUTE_FREE;
+			pthread_cond_wait(&cs->run_cond, &cs->run_mutex);
+		}
+		coroutine *co = TAILQ_FIRST(&cs->coroutines);
+		TAILQ_REMOVE(&cs->coroutines, co, compute_next);
+		cs->nqueued --;
+		cs->compute_status = COROUTINE_COMPUTE_BUSY;
+		cs->curr_coroutine = co;
+		pthread_mutex_unlock(&cs->run_mutex);
+
+		uint64_t begin = compute_nsec_now();
+		uint64_t wait = begin - co->task.submit_nsecs;
+
+		errno = 0;
+		co->task.ret = co->task.func(co->task.arg);
+		co->task.err = errno;
+
+		cs->curr_coroutine = NULL;
+
+		// 统计在交回协程之前更新，协程恢复后读到的统计已经包含本次任务
+		atomic_fetch_add_explicit(&pool->wait_nsecs, wait, memory_order_relaxed);
+		atomic_fetch_add_explicit(&pool->run_nsecs, compute_nsec_now() - begin, memory_order_relaxed);
+		compute_atomic_max_u64(&pool->max_wait_nsecs, wait);
+		atomic_fetch_add_explicit(&pool->completed, 1, memory_order_relaxed);
+		atomic_fetch_sub_explicit(&pool->depth, 1, memory_order_relaxed);
+
+		// 交回原调度器。放入 defer 队列之后协程随时可能被恢复，之后不能再访问 co
+		schedule_defer_push(co->sched, &co->defer_node, COROUTINE_DEFER_RETURN);
+	}
+
+	return NULL;
+}
+
+
+// 启动 nthreads 个线程，已经启动过则直接返回
+int coroutine_compute_pool_start(coroutine_compute_pool *pool, int nthreads) {
+
+	int i = 0, ret = 0;
+
+	pthread_mutex_lock(&pool->start_mutex);
+	if (pool->threads != NULL) {
+		pthread_mutex_unlock(&pool->start_mutex);
+		return 0;
+	}
+
+	if (nthreads <= 0) nthreads = 1;
+
+	coroutine_compute_sched *threads = calloc(nthreads, sizeof(coroutine_compute_sched));
+	if (threads == NULL) {
+		pthread_mutex_unlock(&pool->start_mutex);
+		return -1;
+	}
+
+	for (i = 0;i < nthreads;i ++) {
+		coroutine_compute_sched *cs = &threads[i];
+
+		TAILQ_INIT(&cs->coroutines);
+		pthread_mutex_init(&cs->run_mutex, NULL);
+		pthread_cond_init(&cs->run_cond, NULL);
+		pthread_mutex_init(&cs->co_mutex, NULL);
+		cs->compute_status = COROUTINE_COMPUTE_FREE;
+		cs->pool = pool;
+
+		if (pthread_create(&cs->tid, NULL, coroutine_compute_main, cs) != 0) {
+			printf("Failed to create compute thread\n");
+			ret = -1;
+			break;
+		}
+		pthread_detach(cs->tid); // 线程池线程随进程一直存在
+	}
+
+	if (i > 0) {
+		pool->nthreads = i;
+		atomic_thread_fence(memory_order_release);
+		pool->threads = threads;
+	} else {
+		free(threads);
+	}
+	pthread_mutex_unlock(&pool->start_mutex);
+
+	return ret;
+}
+
+
+// 选择执行任务的线程：优先选空闲且队列为空的，否则轮询
+static coroutine_compute_sched *coroutine_compute_pool_pick(coroutine_compute_pool *pool) {
+
+	int i = 0;
+
+	for (i = 0;i < pool->nthreads;i ++) { // 这里读取状态不加锁，只是选择的依据
+		coroutine_compute_sched *cs = &pool->threads[i];
+		if (cs->compute_status == COROUTINE_COMPUTE_FREE && cs->nqueued == 0) {
+			return cs;
+		}
+	}
+
+	return &pool->threads[atomic_fetch_add(&pool->next, 1) % pool->nthreads];
+}
+
+
+/* 在线程池中执行 func(arg)，当前协程挂起（状态标记为 status）直到执行完成，返回 func 的返回值，errno 为 func 执行后的 errno。
+   不在协程中调用时直接在当前线程执行 */
+intptr_t coroutine_compute_pool_call(coroutine_compute_pool *pool, proc_compute func, void *arg, int status) {
+
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || sched->curr_thread == NULL || pool->threads == NULL) {
+		return func(arg);
+	}
+
+	coroutine *co = sched->curr_thread;
+	coroutine_compute_sched *cs = coroutine_compute_pool_pick(pool);
+
+	co->task.func = func;
+	co->task.arg = arg;
+	co->compute_sched = cs;
+	co->status |= BIT(status);
+	co->task.submit_nsecs = compute_nsec_now();
+	sched->noffload ++; // 调度器在协程回来之前不能退出
+
+	atomic_fetch_add_explicit(&pool->submitted, 1, memory_order_relaxed);
+	compute_atomic_max_int(&pool->max_depth, atomic_fetch_add_explicit(&pool->depth, 1, memory_order_relaxed) + 1);
+
+	pthread_mutex_lock(&cs->run_mutex);
+	TAILQ_INSERT_TAIL(&cs->coroutines, co, compute_next);
+	cs->nqueued ++;
+	pthread_cond_signal(&cs->run_cond);
+	pthread_mutex_unlock(&cs->run_mutex);
+
+	// 线程池线程可能在让出之前就执行完了，但协程要等调度器从 defer 队列中取出才会恢复，此时已经让出
+	coroutine_yield(co);
+
+	co->status &= CLEARBIT(status);
+	co->compute_sched = NULL;
+
+	errno = co->task.err;
+	return co->task.ret;
+}
+
+
+
+// 指定阻塞调用线程池的线程数，必须在第一次使用之前调用
+int schedule_blocking_start(int nthreads) {
+	return coroutine_compute_pool_start(&blocking_pool, nthreads);
+}
+
+
+// 在阻塞调用线程池中执行 func(arg)，第一次使用时以 CO_BLOCKING_THREADS 个线程启动
+intptr_t coroutine_blocking_call(proc_compute func, void *arg) {
+
+	if (blocking_pool.threads == NULL) {
+		coroutine_compute_pool_start(&blocking_pool, CO_BLOCKING_THREADS);
+	}
+
+	return coroutine_compute_pool_call(&blocking_pool, func, arg, COROUTINE_STATUS_PENDING_RUNCOMPUTE);
+}
+
+
+
+// 取线程池统计的快照，各项分别读取，并发更新时彼此之间不保证一致
+void coroutine_compute_pool_stats(coroutine_compute_pool *pool, coroutine_compute_stats *stats) {
+
+	memset(stats, 0, sizeof(coroutine_compute_stats));
+
+	stats->nthreads = pool->threads != NULL ? pool->nthreads : 0;
+	stats->depth = atomic_load(&pool->depth);
+	stats->max_depth = atomic_load(&pool->max_depth);
+	stats->submitted = atomic_load(&pool->submitted);
+	stats->completed = atomic_load(&pool->completed);
+	stats->max_wait_nsecs = atomic_load(&pool->max_wait_nsecs);
+
+	if (stats->completed > 0) {
+		stats->avg_wait_nsecs = atomic_load(&pool->wait_nsecs) / stats->completed;
+		stats->avg_run_nsecs = atomic_load(&pool->run_nsecs) / stats->completed;
+	}
+}
+
+
+void coroutine_blocking_stats_get(coroutine_compute_stats *stats) {
+	coroutine_compute_pool_stats(&blocking_pool, stats);
+}
+
+
+
+// 指定计算线程池的线程数（nthreads <= 0 为在线 CPU 数），必须在第一次使用之前调用
+int schedule_compute_start(int nthreads) {
+
+	if (nthreads <= 0) {
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	return coroutine_compute_pool_start(&compute_pool, nthreads);
+}
+
+
+/* 在计算线程池中执行 CPU 密集的 func(arg)，当前协程挂起，调度器继续运行其他协程，
+   完成后协程回到原调度器继续执行，返回 func 的返回值。共享栈模式下 func 不能访问协程栈上的数据 */
+intptr_t coroutine_run_compute(proc_compute func, void *arg) {
+
+	if (compute_pool.threads == NULL) {
+		schedule_compute_start(CO_COMPUTE_THREADS);
+	}
+
+	return coroutine_compute_pool_call(&compute_pool, func, arg, COROUTINE_STATUS_RUNCOMPUTE);
+}
+
+
+void coroutine_compute_stats_get(coroutine_compute_stats *stats) {
+	coroutine_compute_pool_stats(&compute_pool, stats);
+}
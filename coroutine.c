@@ -7,13 +7,109 @@ static pthread_once_t sched_key_once = PTHREAD_ONCE_INIT;
 
 
 
-static void
+#ifdef _USE_UCONTEXT
+
+#define _switch(new_ctx, cur_ctx)	swapcontext((cur_ctx), (new_ctx))
+
+#else
+
+// 保存当前寄存器到 cur_ctx，并从 new_ctx 恢复执行；不涉及信号掩码，全程没有系统调用
+void _switch(cpu_ctx *new_ctx, cpu_ctx *cur_ctx);
+
+#if defined(__x86_64__)
+
+// rdi = new_ctx, rsi = cur_ctx
+// 保存时把返回地址单独存到 rip，rsp 记为返回后的值，恢复时直接 jmp，效果等同于 _switch 正常返回
+__asm__ (
+"	.text\n"
+"	.p2align 4,,15\n"
+"	.globl _switch\n"
+"	.hidden _switch\n"
+"	.type _switch, @function\n"
+"_switch:\n"
+"	movq (%rsp), %rax\n"
+"	leaq 8(%rsp), %rdx\n"
+"	movq %rdx, 0(%rsi)\n"
+"	movq %rax, 8(%rsi)\n"
+"	movq %rbx, 16(%rsi)\n"
+"	movq %rbp, 24(%rsi)\n"
+"	movq %r12, 32(%rsi)\n"
+"	movq %r13, 40(%rsi)\n"
+"	movq %r14, 48(%rsi)\n"
+"	movq %r15, 56(%rsi)\n"
+"	stmxcsr 64(%rsi)\n"
+"	fnstcw 68(%rsi)\n"
+"	movq 16(%rdi), %rbx\n"
+"	movq 24(%rdi), %rbp\n"
+"	movq 32(%rdi), %r12\n"
+"	movq 40(%rdi), %r13\n"
+"	movq 48(%rdi), %r14\n"
+"	movq 56(%rdi), %r15\n"
+"	ldmxcsr 64(%rdi)\n"
+"	fldcw 68(%rdi)\n"
+"	movq 8(%rdi), %rax\n"
+"	movq 0(%rdi), %rsp\n"
+"	movq 72(%rdi), %rdi\n"
+"	jmp *%rax\n"
+"	.size _switch, .-_switch\n"
+);
+
+#elif defined(__aarch64__)
+
+// x0 = new_ctx, x1 = cur_ctx
+// x30(lr) 即返回地址，恢复后 ret 跳回 lr
+__asm__ (
+"	.text\n"
+"	.p2align 4\n"
+"	.globl _switch\n"
+"	.hidden _switch\n"
+"	.type _switch, %function\n"
+"_switch:\n"
+"	mov x9, sp\n"
+"	stp x19, x20, [x1, #0]\n"
+"	stp x21, x22, [x1, #16]\n"
+"	stp x23, x24, [x1, #32]\n"
+"	stp x25, x26, [x1, #48]\n"
+"	stp x27, x28, [x1, #64]\n"
+"	stp x29, x30, [x1, #80]\n"
+"	str x9, [x1, #96]\n"
+"	stp d8, d9, [x1, #104]\n"
+"	stp d10, d11, [x1, #120]\n"
+"	stp d12, d13, [x1, #136]\n"
+"	stp d14, d15, [x1, #152]\n"
+"	ldp x19, x20, [x0, #0]\n"
+"	ldp x21, x22, [x0, #16]\n"
+"	ldp x23, x24, [x0, #32]\n"
+"	ldp x25, x26, [x0, #48]\n"
+"	ldp x27, x28, [x0, #64]\n"
+"	ldp x29, x30, [x0, #80]\n"
+"	ldr x9, [x0, #96]\n"
+"	mov sp, x9\n"
+"	ldp d8, d9, [x0, #104]\n"
+"	ldp d10, d11, [x0, #120]\n"
+"	ldp d12, d13, [x0, #136]\n"
+"	ldp d14, d15, [x0, #152]\n"
+"	ldr x0, [x0, #168]\n"
+"	ret\n"
+"	.size _switch, .-_switch\n"
+);
+
+#endif
+
+#endif
+
+
+
+static __attribute__((noinline)) void // 不能内联：dummy 必须位于调用者栈帧之下，否则 coroutine_yield 的局部变量可能落在保存范围之外
 _save_stack(coroutine *co) {
 	char* top = co->sched->stack + co->sched->stack_size; // 协程堆栈的顶部位置 top，即调度器堆栈加上堆栈大小
 	char dummy = 0;
 	assert(top - &dummy <= CO_MAX_STACKSIZE); // 断言协程的堆栈大小小于等于最大堆栈大小 CO_MAX_STACKSIZE
-	if (co->stack_size < top - &dummy) { // 如果协程的堆栈大小小于等于 top - &dummy，则重新分配堆栈内存
-		co->stack = realloc(co->stack, top - &dummy);
+	if (co->stack_cap < top - &dummy) { // 缓冲区容量不够时换一个更大分级的缓冲区，旧的还给调度器的缓存
+		if (co->stack) {
+			coroutine_pool_stack_release(co->sched, co->stack, co->stack_cap);
+		}
+		co->stack = coroutine_pool_stack_alloc(co->sched, top - &dummy, &co->stack_cap);
 		assert(co->stack != NULL);
 	}
 	co->stack_size = top - &dummy; // 更新栈大小
@@ -27,25 +123,74 @@ _load_stack(coroutine *co) { // 加载协程的堆栈
 	memcpy(co->sched->stack + co->sched->stack_size - co->stack_size, co->stack, co->stack_size);
 }
 
+/* 协程结束：默认（detached）标记后由 coroutine_resume 释放；可以 join 的协程保留结构体和返回值，
+   通知等待的协程和所属的协程组。不会返回 */
+static void coroutine_finish(coroutine *co) {
+
+	if (atomic_load(&co->join_state) == COROUTINE_JOIN_DETACHED) {
+		co->status |= (BIT(COROUTINE_STATUS_EXITED) | BIT(COROUTINE_STATUS_FDEOF) | BIT(COROUTINE_STATUS_DETACH)); // 函数执行完毕后标记协程的状态
+		coroutine_yield(co); // 将控制权交给调度器
+	}
+
+	co->status |= BIT(COROUTINE_STATUS_EXITED);
+
+	// 之后等待者随时可能取走返回值并释放协程，但释放总是在协程所属的调度器线程上、本次 coroutine_resume 返回之后进行
+	coroutine_channel *group = co->group;
+	coroutine *joiner = co->co_join; // 状态为 WAITING 时已经设置好
+	int old = atomic_exchange(&co->join_state, COROUTINE_JOIN_EXITED);
+
+	if (group != NULL) {
+		coroutine_channel_trysend(group, &co); // 不限容量，不会失败
+	} else if (old == COROUTINE_JOIN_WAITING) {
+		coroutine_wake(joiner);
+	}
+
+	coroutine_yield(co);
+}
+
+
 static void _exec(void *lt) { // 执行协程的真正执行函数
 	coroutine *co = (coroutine*)lt; // 接受一个指向协程结构的指针 lt，将其转换为 coroutine 类型
 	co->func(co->arg); // 调用协程的执行函数 co->func
-	co->status |= (BIT(COROUTINE_STATUS_EXITED) | BIT(COROUTINE_STATUS_FDEOF) | BIT(COROUTINE_STATUS_DETACH)); // 函数执行完毕后标记协程的状态
-	coroutine_yield(co); // 将控制权交给调度器
+	coroutine_finish(co);
+}
+
+
+// 结束当前协程，retval 交给 coroutine_join 的调用者
+void coroutine_exit(void *retval) {
+
+	coroutine *co = coroutine_get_sched()->curr_thread;
+
+	co->co_exit_ptr = retval;
+	coroutine_finish(co);
 }
 
 
 
+static void coroutine_release_stack(coroutine *co) {
+
+	if (co->stack) { // 栈还给调度器的缓存，超过缓存上限时才真正释放
+		if (co->sched->flags & SCHEDULE_PRIVATE_STACK) {
+			coroutine_pool_private_stack_release(co->sched, co->stack);
+		} else {
+			coroutine_pool_stack_release(co->sched, co->stack, co->stack_cap);
+		}
+		co->stack = NULL; // 避免重复释放
+	}
+}
+
+
 void coroutine_free(coroutine *co) { // 释放协程内存资源，移出调度器
 	if (co == NULL) return ;
+
+	int expected = COROUTINE_CANCEL_QUEUED; // 其他线程的 coroutine_cancel 节点还在延迟队列中，留给延迟队列处理时释放
+	if (atomic_compare_exchange_strong(&co->cancel_pending, &expected, COROUTINE_CANCEL_FREEING)) return ;
+
 	co->sched->spawned_coroutines --; // 调度器中协程数--
 
-	if (co->stack) {
-		free(co->stack); // 释放栈空间
-		co->stack = NULL; // 避免重复释放
-	}
+	coroutine_release_stack(co);
 
-	free(co); // 释放结构体空间
+	coroutine_pool_release(co->sched, co); // 结构体还给调度器的缓存
     co = NULL; // 避免重复释放
 }
 
@@ -53,16 +198,40 @@ void coroutine_free(coroutine *co) { // 释放协程内存资源，移出调度
 
 static void coroutine_init(coroutine *co) { // 初始化一个协程结构体，为协程设置执行上下文、堆栈、执行函数等，并将其状态设置为就绪状态
 
+	char *stack = co->sched->stack; // 共享栈模式下运行在调度器的栈上
+	if (co->sched->flags & SCHEDULE_PRIVATE_STACK) { // 独立栈模式下运行在自己的栈上，跳过保护页
+		co->stack = coroutine_pool_private_stack_alloc(co->sched);
+		assert(co->stack != NULL);
+		stack = (char *)co->stack + co->sched->page_size;
+	}
+
+#ifdef _USE_UCONTEXT
 	getcontext(&co->ctx); // 初始化协程的上下文
 
     //设置协程部分上下文属性：栈空间、栈大小、链接
-	co->ctx.uc_stack.ss_sp = co->sched->stack; 
+	co->ctx.uc_stack.ss_sp = stack; 
 	co->ctx.uc_stack.ss_size = co->sched->stack_size;
 	co->ctx.uc_link = &co->sched->ctx; // 链接到协程所属的调度器的上下文
 
 	makecontext(&co->ctx, (void (*)(void)) _exec, 1, (void*)co); // 将执行函数 _exec 关联到协程的上下文中
-
-	co->status = BIT(COROUTINE_STATUS_READY); // 将协程的状态设置为就绪状态
+#else
+	uintptr_t top = ((uintptr_t)stack + co->sched->stack_size) & ~(uintptr_t)15; // 栈顶按 16 字节对齐
+
+	memset(&co->ctx, 0, sizeof(cpu_ctx));
+#if defined(__x86_64__)
+	co->ctx.rsp = (void *)(top - sizeof(void *)); // 模拟 call 指令压入返回地址后的栈，_exec 入口处满足 ABI 对齐要求
+	co->ctx.rip = (void *)_exec;
+	co->ctx.rdi = (void *)co;
+	co->ctx.mxcsr = 0x1F80; // 默认的 SSE 舍入模式与异常屏蔽
+	co->ctx.fpucw = 0x037F; // 默认的 x87 控制字
+#elif defined(__aarch64__)
+	co->ctx.sp = (void *)top;
+	co->ctx.lr = (void *)_exec; // _switch 最后的 ret 跳转到 lr
+	co->ctx.x0 = (void *)co;
+#endif
+#endif
+
+	co->status = BIT(COROUTINE_STATUS_READY) | (co->status & BIT(COROUTINE_STATUS_CANCELLED)); // 将协程的状态设置为就绪状态，保留开始运行前收到的取消
 	
 }
 
@@ -72,12 +241,13 @@ void coroutine_yield(coroutine *co) { // 协程让出cpu控制权
 
 	co->ops = 0; // 设置操作码
 
-	if ((co->status & BIT(COROUTINE_STATUS_EXITED)) == 0) { // 通过位与操作检查协程的状态，判断协程是否已经退出
+	if ((co->status & BIT(COROUTINE_STATUS_EXITED)) == 0 &&
+		(co->sched->flags & SCHEDULE_PRIVATE_STACK) == 0) { // 协程未退出且使用共享栈时才需要保存栈，独立栈模式下栈内容原地保留
 
 		_save_stack(co); // 保存协程的堆栈。这是因为协程让出执行权时，需要保存当前的堆栈状态，以便再次执行时能恢复执行状态
 	}
 
-	swapcontext(&co->ctx, &co->sched->ctx); // 将执行权交还给调度器
+	_switch(&co->sched->ctx, &co->ctx); // 将执行权交还给调度器
 
 }
 
@@ -89,7 +259,7 @@ int coroutine_resume(coroutine *co) { // 恢复一个挂起的协程并开始执
 		coroutine_init(co);
 	} 
 	
-	else { // 协程之前已经被执行过
+	else if ((co->sched->flags & SCHEDULE_PRIVATE_STACK) == 0) { // 协程之前已经被执行过，且使用共享栈
 
 		_load_stack(co); // 加载堆栈状态
 	}
@@ -101,7 +271,7 @@ int coroutine_resume(coroutine *co) { // 恢复一个挂起的协程并开始执
 	唯一设置sched->curr_thread的代码*/
 
 	sched->curr_thread = co; // 将调度器中正在运行的协程设置为此协程
-	swapcontext(&sched->ctx, &co->ctx); // 将调度器的上下文切换为协程的上下文，开始执行协程
+	_switch(&co->ctx, &sched->ctx); // 将调度器的上下文切换为协程的上下文，开始执行协程
 	sched->curr_thread = NULL; // 在切换回调度器的上下文后，将sched->curr_thread 设置为 NULL，表示当前线程没有正在执行的协程
 
 
@@ -110,6 +280,8 @@ int coroutine_resume(coroutine *co) { // 恢复一个挂起的协程并开始执
 
 		if (co->status & BIT(COROUTINE_STATUS_DETACH)) { // 需要释放资源
 			coroutine_free(co);
+		} else { // 等待 join：栈已经没用了，先释放，结构体保留到 join 取走返回值
+			coroutine_release_stack(co);
 		}
 		return -1; // 返回 -1，表示协程已经退出
 	} 
@@ -130,25 +302,45 @@ void coroutine_renice(coroutine *co) { // 调整协程的优先级，如果协
 
 
 
-void coroutine_sleep(uint64_t msecs) { // 让当前协程休眠
+// 让当前协程休眠。返回 0；被取消或先到了截止时间时返回 -1，errno 为 ECANCELED / ETIMEDOUT
+int coroutine_sleep(uint64_t msecs) {
 
 	coroutine *co = coroutine_get_sched()->curr_thread; // 获取当前调度器，并从调度器中获取当前正在执行的协程指针 co
+
+	if (schedule_interrupted(co) < 0) return -1;
  
 	if (msecs == 0) { // 表示需要让当前协程立即让出执行权并进入就绪状态
 
 		TAILQ_INSERT_TAIL(&co->sched->ready, co, ready_next); // 将当前协程插入到就绪队列的尾部，以待后续调度
 		coroutine_yield(co); // 将控制权交给调度器
+		return 0;
+	}
+
+	int64_t wait_ms = schedule_deadline_msecs(co, (int64_t)msecs); // 截止时间更早时只睡到截止时间
 
-	} else { // 表示需要将当前协程置于休眠状态
-		schedule_sched_sleepdown(co, msecs); // 将当前协程置于休眠状态
+	schedule_sched_sleepdown(co, wait_ms); // 将当前协程置于休眠状态
+	coroutine_yield(co); // 到期后由调度器恢复执行，被取消时提前恢复
+	co->status &= CLEARBIT(COROUTINE_STATUS_EXPIRED);
+
+	if (co->status & BIT(COROUTINE_STATUS_CANCELLED)) {
+		errno = ECANCELED;
+		return -1;
+	}
+	if (wait_ms < (int64_t)msecs) {
+		errno = ETIMEDOUT;
+		return -1;
 	}
+	return 0;
 }
 
 
 
-void coroutine_detach(void) { // 将当前协程标记为 DETACH 状态
+void coroutine_detach(void) { // 将当前协程标记为 DETACH 状态，可以 join 的协程也改为结束时自动释放（此时不能已经有协程在 join）
 	coroutine *co = coroutine_get_sched()->curr_thread;
 	co->status |= BIT(COROUTINE_STATUS_DETACH);
+
+	int expected = COROUTINE_JOIN_RUNNING;
+	atomic_compare_exchange_strong(&co->join_state, &expected, COROUTINE_JOIN_DETACHED);
 }
 
 static void coroutine_sched_key_destructor(void *data) { // 线程局部存储的析构函数，用于在线程退出时释放线程局部存储中的数据
@@ -166,14 +358,21 @@ static void coroutine_sched_key_creator(void) { // 创建线程局部存储的
 
 
 
-int coroutine_create(coroutine **new_co, proc_coroutine func, void *arg) { // 创建一个新的协程，并将其添加到调度器的就绪队列
+void coroutine_sched_key_init(void) { // 直接调用 schedule_create 之前也需要先创建好键
 
-	assert(pthread_once(&sched_key_once, coroutine_sched_key_creator) == 0); // 保证调度器的键只会被创建一次: 确保 coroutine_sched_key_creator 函数只会被执行一次，用于创建线程局部存储的键保证调度器的键只会被创建一次
+	assert(pthread_once(&sched_key_once, coroutine_sched_key_creator) == 0); // 确保 coroutine_sched_key_creator 函数只会被执行一次，用于创建线程局部存储的键
+}
+
+
+
+static int coroutine_new(coroutine **new_co, proc_coroutine func, void *arg, int joinable, coroutine_group *group) {
+
+	coroutine_sched_key_init(); // 保证调度器的键只会被创建一次
 	schedule *sched = coroutine_get_sched(); // 获取当前线程的调度器
 
 	if (sched == NULL) { // 当前线程尚未拥有调度器，需要先创建调度器:
 
-		schedule_create(0); // 创建调度器 
+		schedule_create(0, SCHEDULE_SHARED_STACK); // 创建调度器 
 		
 		sched = coroutine_get_sched();
 		if (sched == NULL) { // 创建调度器失败
@@ -182,7 +381,7 @@ int coroutine_create(coroutine **new_co, proc_coroutine func, void *arg) { // 
 		}
 	}
 
-	coroutine *co = calloc(1, sizeof(coroutine)); // 为新的协程分配内存空间
+	coroutine *co = coroutine_pool_alloc(sched); // 为新的协程分配内存空间，优先复用调度器缓存的结构体
 	if (co == NULL) { // 分配失败
 		printf("Failed to allocate memory for new coroutine\n");
 		return -2;
@@ -197,14 +396,161 @@ int coroutine_create(coroutine **new_co, proc_coroutine func, void *arg) { // 
 	co->id = sched->spawned_coroutines ++; // 协程的id，同时也是调度器中已创建的协程数量
 	co->func = func; // 执行的函数
 
-	co->fd_wait = -1;
-
 	co->arg = arg; // 函数参数
 	co->birth = coroutine_usec_now(); // 协程创建的时间戳
+
+	// 放入就绪队列之前设置好，N:M 运行时中协程入队后可能立即被其他线程窃取运行
+	atomic_init(&co->join_state, joinable ? COROUTINE_JOIN_RUNNING : COROUTINE_JOIN_DETACHED);
+	co->co_join = NULL;
+	co->co_exit_ptr = NULL;
+	co->group = group != NULL ? group->done : NULL;
+	co->group_index = group != NULL ? group->nspawned : 0;
     
 	*new_co = co; // 将新创建的协程指针赋给传入的参数
 
-	TAILQ_INSERT_TAIL(&co->sched->ready, co, ready_next); // 将协程插入到调度器的就绪队列的尾部，以便后续调度器可以从就绪队列中选择协程执行
+	schedule_ready(co); // 将协程插入到调度器的就绪队列的尾部（N:M 运行时中放进可被窃取的双端队列），以便后续调度器可以选择协程执行
 
 	return 0;
 }
+
+
+// 创建一个新的协程，并将其添加到调度器的就绪队列；结束时自动释放
+int coroutine_create(coroutine **new_co, proc_coroutine func, void *arg) {
+	return coroutine_new(new_co, func, arg, 0, NULL);
+}
+
+
+// 创建可以 join 的协程：结束后保留到 coroutine_join 取走返回值，每个这样的协程都必须被 join 一次
+int coroutine_create_joinable(coroutine **new_co, proc_coroutine func, void *arg) {
+	return coroutine_new(new_co, func, arg, 1, NULL);
+}
+
+
+// 取走已经结束的协程的返回值并释放它。协程属于其他调度器时交回该调度器释放（调度器的缓存只能在其线程上访问）
+static void coroutine_reap(coroutine *co, void **retval) {
+
+	if (retval != NULL) *retval = co->co_exit_ptr;
+
+	if (co->sched == coroutine_get_sched()) {
+		coroutine_free(co);
+	} else {
+		schedule_defer_push(co->sched, &co->defer_node, COROUTINE_DEFER_FREE);
+	}
+}
+
+
+/* 等待可以 join 的协程 co 结束，返回值（coroutine_exit 的参数，正常返回为 NULL）写入 *retval，然后释放 co。
+   必须在协程中调用，每个协程只能被 join 一次；co 可以运行在其他调度器上（例如 N:M 运行时中被窃取）。
+   返回 0 成功，-1 失败：co 不可 join（EINVAL）或 co 就是当前协程（EDEADLK）；
+   等待时被取消或超过截止时间返回 -1（ECANCELED / ETIMEDOUT），co 恢复为未被 join，之后可以再次 join */
+int coroutine_join(coroutine *co, void **retval) {
+
+	schedule *sched = coroutine_get_sched();
+	coroutine *self = sched != NULL ? sched->curr_thread : NULL;
+
+	if (self == NULL) {
+		errno = EPERM;
+		return -1;
+	}
+	if (co == self) {
+		errno = EDEADLK;
+		return -1;
+	}
+	if (co->group != NULL) { // 组内的协程由组等待
+		errno = EINVAL;
+		return -1;
+	}
+
+	co->co_join = self; // 在状态改为 WAITING 之前写好，结束的协程看到 WAITING 时一定能读到
+	int expected = COROUTINE_JOIN_RUNNING;
+	if (!atomic_compare_exchange_strong(&co->join_state, &expected, COROUTINE_JOIN_WAITING) &&
+		expected != COROUTINE_JOIN_EXITED) {
+		errno = EINVAL; // 不可 join 或者已经有协程在 join
+		return -1;
+	}
+
+	while (atomic_load(&co->join_state) != COROUTINE_JOIN_EXITED) {
+		if (schedule_interrupted(self) < 0) { // 被取消或超过截止时间：撤回等待；co 恰好已经结束时照常 join
+			expected = COROUTINE_JOIN_WAITING;
+			if (atomic_compare_exchange_strong(&co->join_state, &expected, COROUTINE_JOIN_RUNNING)) return -1;
+			break;
+		}
+		coroutine_park_timeout(schedule_deadline_msecs(self, -1)); // 由结束的协程 coroutine_wake 唤醒，截止时间到达或被取消时提前醒来
+	}
+
+	coroutine_reap(co, retval);
+	return 0;
+}
+
+
+
+/* 协程组：分发一组子协程（scatter），等待任意一个或者全部结束（gather），不需要轮询。
+   子协程结束时把自己放进组的通道，组的等待者从通道中取出、取走返回值并释放。组只能由一个协程使用 */
+
+int coroutine_group_init(coroutine_group *g) {
+
+	g->done = coroutine_channel_create(0, CO_CHANNEL_UNBOUNDED);
+	if (g->done == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	g->pending = 0;
+	g->nspawned = 0;
+
+	return 0;
+}
+
+
+// 等待所有子协程结束后释放组。子协程结束时还要访问组的通道，所以被取消或超过截止时间也要等完
+void coroutine_group_destroy(coroutine_group *g) {
+
+	while (g->pending > 0) {
+		coroutine *co = NULL;
+		if (schedule_channel_recv(g->done, &co) != 0) break; // 不在协程中
+		g->pending --;
+		coroutine_reap(co, NULL);
+	}
+	coroutine_channel_free(g->done);
+	g->done = NULL;
+}
+
+
+// 在当前调度器上创建子协程，返回它在组中的序号（从 0 开始），失败返回 -1
+int coroutine_group_spawn(coroutine_group *g, proc_coroutine func, void *arg) {
+
+	coroutine *co = NULL;
+	if (coroutine_new(&co, func, arg, 1, g) != 0) return -1;
+
+	g->pending ++;
+	return g->nspawned ++;
+}
+
+
+// 等待任意一个子协程结束，返回其序号并把返回值写入 *retval；没有未等待的子协程时返回 -1（ECHILD）
+int coroutine_group_wait_any(coroutine_group *g, void **retval) {
+
+	if (g->pending == 0) {
+		errno = ECHILD;
+		return -1;
+	}
+
+	coroutine *co = coroutine_channel_recv_ptr(g->done);
+	if (co == NULL) return -1;
+
+	g->pending --;
+	int index = co->group_index;
+	coroutine_reap(co, retval);
+
+	return index;
+}
+
+
+// 等待所有子协程结束，返回值被丢弃
+int coroutine_group_wait_all(coroutine_group *g) {
+
+	while (g->pending > 0) {
+		if (coroutine_group_wait_any(g, NULL) < 0) return -1;
+	}
+	return 0;
+}
+
@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 #include <limits.h>
@@ -13,30 +15,113 @@
 #include <fcntl.h>
 #include <sys/time.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/select.h>
+#include <sys/socket.h>
 #include <netinet/tcp.h>
-
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#include <netdb.h>
+
+// 默认使用手写汇编切换上下文，只保存被调用者保存寄存器和栈指针；
+// 其他架构或编译时定义 _USE_UCONTEXT 则退回 ucontext（swapcontext 每次切换都有一次 rt_sigprocmask 系统调用）
+#if !defined(__x86_64__) && !defined(__aarch64__)
+#define _USE_UCONTEXT
+#endif
+
+#ifdef _USE_UCONTEXT
 #include <ucontext.h>
+#endif
 
 #include <sys/epoll.h>
 #include <sys/poll.h>
 
 #include <errno.h>
+#include <stdatomic.h>
 
 #include "queue.h"
 #include "tree.h"
 
 // Author : WangBoJing , email : 1989wangbojing@gmail.com
-#define CO_MAX_EVENTS		(1024*1024)
+#define CO_MAX_EVENTS		(1024*1024) // 单次 epoll_wait 返回的事件数量上限
+#define CO_DEFAULT_EVENTS	1024 // 默认单次 epoll_wait 的事件批量，可通过 schedule_set_event_batch 调整
 #define CO_MAX_STACKSIZE	(128*1024) // {http: 16*1024, tcp: 4*1024}
 
+// 每个调度器缓存的空闲协程结构体数量与空闲栈字节数上限，可通过 schedule_pool_set_limits 调整
+#define CO_POOL_MAX_COROUTINES	1024
+#define CO_POOL_MAX_STACK_BYTES	(16*1024*1024)
+#define CO_POOL_STACK_MIN		512 // 共享栈模式下保存栈的缓冲区按 2 的幂分级，最小 512B
+#define CO_POOL_STACK_CLASSES	9 // 512B ~ 128KB(CO_MAX_STACKSIZE)
+
+#define CO_WORKER_DEQUE_SIZE	4096 // 工作线程无锁双端队列的容量，必须是 2 的幂
+
+#define CO_URING_ENTRIES		1024 // io_uring 提交队列的大小
+
+#define CO_BLOCKING_THREADS		4 // 阻塞调用线程池的默认线程数，可在第一次使用前通过 schedule_blocking_start 指定
+#define CO_COMPUTE_THREADS		0 // 计算线程池的默认线程数，0 为在线 CPU 数，可通过 schedule_compute_start 指定
+
+#define CO_CHANNEL_UNBOUNDED	0 // coroutine_channel_create 的容量参数：不限容量，缓冲区按需扩容
+
+#define CO_POLL_RETRY_MSECS		10 // poll 只关心 POLLPRI 等调度器不登记的事件时，每隔这么久检查一次
+
+// 分层时间轮：每层 64 个槽，6 层，第 0 层一个槽 1ms，最远可表示约 2 年
+#define CO_TIMER_TICK_USECS		1000
+#define CO_TIMER_SLOTS			64
+#define CO_TIMER_LEVELS			6
+
 #define BIT(x)	 				(1 << (x))
 #define CLEARBIT(x) 			~(1 << (x))
 
+// schedule_create 的 flags
+#define SCHEDULE_SHARED_STACK	0 // 默认：所有协程共享调度器的栈，让出时拷贝保存，内存占用最小
+#define SCHEDULE_PRIVATE_STACK	BIT(0) // 每个协程独立 mmap 一块带保护页的栈，切换时不拷贝栈
+#define SCHEDULE_TIMER_RBTREE	BIT(1) // 定时器使用睡眠红黑树（微秒精度，插入/删除 O(log n)），默认为分层时间轮（1ms 精度，O(1)）
+#define SCHEDULE_IO_URING		BIT(2) // 使用 io_uring 完成通知代替 epoll 就绪通知（见 uring.c），内核不支持时退回 epoll
+
 
 
 
 
 typedef void (*proc_coroutine)(void *);
+typedef intptr_t (*proc_compute)(void *arg); // 交给线程池执行的函数
+typedef void (*proc_connection)(int fd, void *arg); // 反应堆为每个新连接创建的协程执行的函数
+
+
+#ifdef _USE_UCONTEXT
+
+typedef ucontext_t cpu_ctx;
+
+#elif defined(__x86_64__)
+
+typedef struct _cpu_ctx { // 偏移量与 coroutine.c 中 _switch 的汇编一一对应，不要随意调整顺序
+	void *rsp; // 0
+	void *rip; // 8
+	void *rbx; // 16
+	void *rbp; // 24
+	void *r12; // 32
+	void *r13; // 40
+	void *r14; // 48
+	void *r15; // 56
+	uint32_t mxcsr; // 64  SSE 控制/状态寄存器
+	uint16_t fpucw; // 68  x87 控制字
+	uint16_t pad;
+	void *rdi; // 72  首次切入时传给 _exec 的参数
+} cpu_ctx;
+
+#elif defined(__aarch64__)
+
+typedef struct _cpu_ctx { // 偏移量与 coroutine.c 中 _switch 的汇编一一对应，不要随意调整顺序
+	void *x19_x28[10]; // 0
+	void *fp; // 80  x29
+	void *lr; // 88  x30
+	void *sp; // 96
+	double d8_d15[8]; // 104
+	void *x0; // 168  首次切入时传给 _exec 的参数
+} cpu_ctx;
+
+#endif
 
 
 typedef enum {
@@ -55,7 +140,9 @@ typedef enum {
 	COROUTINE_STATUS_RUNCOMPUTE,
 	COROUTINE_STATUS_WAIT_IO_READ,
 	COROUTINE_STATUS_WAIT_IO_WRITE,
-	COROUTINE_STATUS_WAIT_MULTI
+	COROUTINE_STATUS_WAIT_MULTI,
+	COROUTINE_STATUS_PARKED,
+	COROUTINE_STATUS_FDCLOSED // 等待的 fd 被其他协程关闭，醒来后返回 EBADF
 } coroutine_status;
 
 typedef enum {
@@ -99,16 +186,233 @@ TAILQ_HEAD(_coroutine_queue, _coroutine);
 	}
 */
 RB_HEAD(_coroutine_rbtree_sleep, _coroutine);
-RB_HEAD(_coroutine_rbtree_wait, _coroutine);
+LIST_HEAD(_coroutine_timer_list, _coroutine);
 
 
 typedef struct _coroutine_link coroutine_link;
 typedef struct _coroutine_queue coroutine_queue;
 
 typedef struct _coroutine_rbtree_sleep coroutine_rbtree_sleep;
-typedef struct _coroutine_rbtree_wait coroutine_rbtree_wait;
+typedef struct _coroutine_timer_list coroutine_timer_list;
+
+
+
+
+
+
+#define COROUTINE_DEFER_NEW		0 // 其他线程创建的新协程（coroutine_spawn）
+#define COROUTINE_DEFER_RETURN	1 // 线程池执行完任务交回的协程
+#define COROUTINE_DEFER_WAKE	2 // coroutine_wake 唤醒挂起的协程
+#define COROUTINE_DEFER_SUBMIT	3 // schedule_submit 投递的函数
+#define COROUTINE_DEFER_FREE	4 // 其他线程 join 之后交回所属调度器释放的协程
+#define COROUTINE_DEFER_CANCEL	5 // 其他线程 coroutine_cancel
+
+#define COROUTINE_JOIN_DETACHED	0 // 结束时自动释放（coroutine_create 的默认行为）
+#define COROUTINE_JOIN_RUNNING	1 // 可以 join，尚未结束
+#define COROUTINE_JOIN_WAITING	2 // 可以 join，已经有协程在等待
+#define COROUTINE_JOIN_EXITED	3 // 已经结束，等待 join 取走返回值后释放
+
+#define COROUTINE_CANCEL_NONE		0 // cancel_node 未使用
+#define COROUTINE_CANCEL_QUEUED		1 // cancel_node 在延迟队列中
+#define COROUTINE_CANCEL_FREEING	2 // 节点处理之前协程已经要释放，由延迟队列处理时释放
+#define COROUTINE_CANCEL_DONE		3 // 节点已处理
+
+typedef struct coroutine_defer_node { // 跨线程投递给调度器的节点，见 schedule_defer_push
+	struct coroutine_defer_node *next;
+	int kind; // COROUTINE_DEFER_*
+} coroutine_defer_node;
+
+
+typedef struct coroutine_timer_wheel { // 分层时间轮，见 timer.c
+	uint64_t now; // 已经推进到的 tick
+	uint64_t pending[CO_TIMER_LEVELS]; // 每层非空槽的位图
+	coroutine_timer_list slots[CO_TIMER_LEVELS][CO_TIMER_SLOTS];
+	coroutine_timer_list expired; // 已经到期、等待调度器取出的协程
+	int count; // 时间轮中的协程数量
+} coroutine_timer_wheel;
+
+
+typedef struct coroutine_pool_stats {
+	uint64_t co_hits; // 协程结构体从缓存中分配的次数
+	uint64_t co_misses; // 协程结构体缓存为空、调用 calloc 的次数
+	uint64_t stack_hits; // 栈缓冲区从缓存中分配的次数
+	uint64_t stack_misses; // 栈缓冲区缓存为空、调用 malloc/mmap 的次数
+	size_t free_coroutines; // 当前缓存的协程结构体数量
+	size_t free_stack_bytes; // 当前缓存的栈字节数
+} coroutine_pool_stats;
+
+
+typedef struct coroutine_pool { // 调度器私有的对象缓存，只在调度器所在线程访问
+	struct coroutine_pool_chunk *free_coroutines; // 空闲协程结构体链表
+	struct coroutine_pool_chunk *free_stacks[CO_POOL_STACK_CLASSES]; // 按尺寸分级的空闲栈缓冲区链表
+	void *free_private_stacks; // 空闲的独立栈（含保护页）链表
+	size_t nfree_coroutines;
+	size_t free_stack_bytes;
+	size_t max_coroutines; // 高水位：缓存的协程结构体数量上限
+	size_t max_stack_bytes; // 高水位：缓存的栈字节数上限
+	coroutine_pool_stats stats;
+} coroutine_pool;
+
+
+
+
+#define COROUTINE_FD_CHECKED	BIT(0) // 已经查询过 fd 是否非阻塞
+#define COROUTINE_FD_NONBLOCK	BIT(1) // fd 处于非阻塞模式，hook 可以先直接尝试系统调用
+#define COROUTINE_FD_REGULAR	BIT(2) // 普通文件或块设备，epoll 不支持，读写交给阻塞调用线程池
+#define COROUTINE_FD_USER_NONBLOCK	BIT(3) // 用户要求非阻塞（SOCK_NONBLOCK、fcntl F_SETFL），hook 不等待，照常返回 EAGAIN
+#define COROUTINE_FD_HOOK_NONBLOCK	BIT(4) // O_NONBLOCK 是 hook 设置的，fcntl F_GETFL 时对用户隐藏
+
+typedef struct coroutine_cork_buf { // fd 的写合并缓冲区（coroutine_cork），调度器每轮 epoll_wait 之前发出，见 hook.c
+	char *buf;
+	size_t off; // 已经发出的字节
+	size_t len; // 缓冲区中的字节（含已发出的部分）
+	size_t cap;
+	size_t max_bytes; // 缓冲超过时连同本次写入立即发出
+	uint32_t max_usecs; // 最早的数据等待超过时立即发出，0 只在每轮结束时发出
+	uint64_t since; // 最早的数据放入的时间
+	int fd;
+	int err; // 调度器发送失败的 errno，下一次写入时返回
+	uint8_t dirty; // 在调度器的待发送链表中
+	uint8_t blocked; // 调度器发送时 EAGAIN，等待可写
+	uint8_t not_sock; // 不是套接字，用 write 发送
+	LIST_ENTRY(coroutine_cork_buf) dirty_next;
+} coroutine_cork_buf;
+
+LIST_HEAD(_coroutine_cork_list, coroutine_cork_buf);
+
+#define CO_ZEROCOPY_MIN			(16*1024) // coroutine_send_zerocopy 小于这个大小时直接复制发送，零拷贝的页面固定和完成通知开销超过复制
+#define CO_ZEROCOPY_INFLIGHT	64 // 一个 fd 上最多同时未完成的 MSG_ZEROCOPY 发送次数，超过时等待最早的完成
+
+typedef struct coroutine_zerocopy { // fd 上 MSG_ZEROCOPY 发送的完成情况（coroutine_send_zerocopy），见 hook.c
+	uint32_t next; // 下一次发送的编号，内核按每次成功的 MSG_ZEROCOPY 发送从 0 开始编号
+	uint32_t done; // 编号小于它的发送都已完成，缓冲区不再被内核引用
+	uint64_t completed; // done 之后已经完成的发送（通知乱序到达时），第 i 位对应编号 done + i
+	uint32_t wait_ticket; // waiter 等待 done 到达的编号
+	uint8_t copied; // 内核退回了复制（回环、网卡不支持等），之后直接复制发送
+	uint8_t unsupported; // 内核不支持 SO_ZEROCOPY
+	struct _coroutine *waiter; // 等待完成通知的协程，同时占用 fd 的写槽位
+} coroutine_zerocopy;
+
+// ticket 之前的发送是否都已完成（编号回绕时按差值比较）
+static inline int coroutine_zerocopy_reached(const coroutine_zerocopy *zc, uint32_t ticket) {
+	return (int32_t)(zc->done - ticket) >= 0;
+}
 
 
+typedef struct coroutine_fd { // 调度器按 fd 下标记录的状态
+	uint32_t events; // 最近一次登记到 epoll 的事件
+	uint8_t registered; // 是否已经加入 epoll（EPOLL_CTL_ADD），之后只需 EPOLL_CTL_MOD 重新激活
+	uint8_t armed; // 登记当前有效，EPOLLONESHOT 触发后失效
+	uint8_t flags; // COROUTINE_FD_*
+	uint16_t uring_ops; // 在 io_uring 中未完成的操作数量，close 时据此取消
+	uint32_t rcvtimeo; // SO_RCVTIMEO（毫秒），0 不超时；hook 的 setsockopt 记录，其他线程设置的在第一次用到时查询
+	uint32_t sndtimeo; // SO_SNDTIMEO（毫秒），0 不超时
+	struct _coroutine *reader; // 等待可读的协程
+	struct _coroutine *writer; // 等待可写的协程
+	struct coroutine_cork_buf *cork; // 写合并缓冲区，没有打开时为 NULL
+	struct coroutine_zerocopy *zc; // 零拷贝发送的完成情况，没有用过 coroutine_send_zerocopy 时为 NULL
+} coroutine_fd;
+
+
+#define CO_CHANNEL_SEND		0
+#define CO_CHANNEL_RECV		1
+
+typedef struct coroutine_channel_selector { // coroutine_channel_select 在每个通道上登记的等待者
+	LIST_ENTRY(coroutine_channel_selector) next;
+	struct _coroutine *co;
+	int dir; // CO_CHANNEL_SEND / CO_CHANNEL_RECV
+} coroutine_channel_selector;
+
+LIST_HEAD(_coroutine_channel_selectors, coroutine_channel_selector);
+
+typedef struct coroutine_channel { // 协程间传递消息的通道，多生产者多消费者，可以跨调度器（线程）使用，见 channel.c
+	pthread_mutex_t mutex;
+	size_t elem_size; // 每个元素的字节数，指针模式为 sizeof(void *)
+	size_t capacity; // 容量，CO_CHANNEL_UNBOUNDED 不限
+	char *buf; // 环形缓冲区
+	size_t size; // 缓冲区能容纳的元素数量
+	size_t head; // 最早的元素
+	size_t count; // 元素数量
+	int closed;
+	coroutine_queue senders; // 缓冲区满时等待发送的协程，通过 cond_next 链接
+	coroutine_queue receivers; // 缓冲区空时等待接收的协程
+	struct _coroutine_channel_selectors selectors; // 在 select 中等待的协程
+} coroutine_channel;
+
+typedef struct coroutine_channel_op { // coroutine_channel_select 的一个分支
+	coroutine_channel *ch;
+	int dir; // CO_CHANNEL_SEND / CO_CHANNEL_RECV
+	void *elem; // 发送的元素 / 接收的缓冲区
+	int ret; // 该分支被选中时：0 成功，-1 通道已关闭
+} coroutine_channel_op;
+
+
+#define CO_SYNC_SHARED		BIT(0) // 同步原语被多个调度器（线程）上的协程使用，内部加锁，唤醒经过目标调度器的 defer 队列
+
+typedef struct coroutine_sync { // 同步原语共用的部分，见 sync.c
+	pthread_mutex_t lock; // 只在 CO_SYNC_SHARED 时使用
+	int flags;
+	coroutine_queue waiters; // 等待的协程，先来先得，通过 cond_next 链接
+} coroutine_sync;
+
+typedef struct coroutine_mutex {
+	coroutine_sync sync;
+	struct _coroutine *owner;
+} coroutine_mutex;
+
+typedef struct coroutine_cond {
+	coroutine_sync sync;
+} coroutine_cond;
+
+typedef struct coroutine_sem {
+	coroutine_sync sync;
+	long count;
+} coroutine_sem;
+
+typedef struct coroutine_rwlock {
+	coroutine_sync sync;
+	int readers; // 持有读锁的协程数量
+	struct _coroutine *writer; // 持有写锁的协程
+} coroutine_rwlock;
+
+
+typedef struct coroutine_group { // 协程组：分发 N 个子协程，等待全部或任意一个结束，见 coroutine.c
+	coroutine_channel *done; // 结束的子协程（指针模式）
+	int pending; // 尚未被等待取走的子协程数量
+	int nspawned;
+} coroutine_group;
+
+
+typedef struct reactor_config { // schedule_reactors_start 的参数
+	unsigned short port; // 所有反应堆通过 SO_REUSEPORT 监听同一个端口
+	int backlog; // listen 的 backlog，0 表示 SOMAXCONN
+	int nreactors; // 反应堆（线程）数量，0 表示在线 CPU 数量
+	int pin_cpu; // 非 0 时第 i 个反应堆绑定到第 i 个 CPU
+	int stack_size; // 传给 schedule_create
+	int flags; // 传给 schedule_create
+	proc_connection handler; // 每个新连接在接受它的反应堆上创建一个协程执行 handler(fd, arg)
+	void *arg;
+} reactor_config;
+
+
+typedef struct coroutine_deque { // Chase-Lev 工作窃取双端队列，所属线程在底部压入/弹出，其他线程从顶部窃取
+	_Atomic int64_t top;
+	_Atomic int64_t bottom;
+	_Atomic(struct _coroutine *) buffer[CO_WORKER_DEQUE_SIZE];
+} coroutine_deque;
+
+
+typedef struct schedule_worker { // N:M 运行时中的一个工作线程
+	pthread_t tid;
+	int index;
+	struct schedule *sched; // 工作线程自己的调度器
+	atomic_int sleeping; // 是否阻塞在 epoll_wait 中
+	uint64_t steals; // 从其他线程窃取到的协程数量
+	pthread_mutex_t start_mutex;
+	pthread_cond_t start_cond;
+	int failed; // 调度器创建失败，线程只等到 exit_barrier 后退出
+	coroutine_deque deque;
+} schedule_worker;
 
 
 
@@ -117,10 +421,11 @@ typedef struct schedule { // 调度器
 
 	uint64_t birth;  // 创建时间戳
 
-	ucontext_t ctx; // 调度器上下文
+	cpu_ctx ctx; // 调度器上下文
 
-	void *stack; // 栈空间
-	size_t stack_size; // 栈大小
+	void *stack; // 栈空间，独立栈模式下不分配
+	size_t stack_size; // 栈大小，独立栈模式下为每个协程的栈大小
+	int flags; // SCHEDULE_SHARED_STACK / SCHEDULE_PRIVATE_STACK / SCHEDULE_TIMER_RBTREE / SCHEDULE_IO_URING
 	int spawned_coroutines; // 已创建的协程数量
 	uint64_t default_timeout; // 默认超时时间
 	struct _coroutine *curr_thread; // 当前正在执行的协程，只在 coroutine_resume 函数中设置
@@ -128,19 +433,37 @@ typedef struct schedule { // 调度器
 
 	int poller_fd; // 由epoll_craete创建的epoll实例
 	int eventfd; // 用于事件通知的文件描述符,用于定时器，在这个协程里没有实现定时器，所以这个成员没有用
-	struct epoll_event eventlist[CO_MAX_EVENTS]; // 存储 epoll_wait 函数返回的就绪事件
-	int nevents; 
+	struct epoll_event *eventlist; // 存储 epoll_wait 函数返回的就绪事件，按批量大小分配
+	int eventlist_size; // eventlist 的容量
+	int event_batch; // 下一次 epoll_wait 的批量，上一批返回满时翻倍，直到 event_batch_max
+	int event_batch_max;
+	int nevents; // 上一次 epoll_wait 返回的事件数量
 
 	int num_new_events; // poller_fd中就绪的事件数量
-	pthread_mutex_t defer_mutex; // 延迟队列的互斥锁
+
+	coroutine_fd *fds; // 按 fd 下标的状态表，按需扩容
+	int fds_size;
+	struct _coroutine_cork_list cork_dirty; // 有数据待发送的写合并缓冲区
+	int nfds_pinned; // 带写合并缓冲区或零拷贝状态的 fd 数量，不为 0 时运行过的协程不迁移到其他工作线程（状态在本调度器的 fds 中）
 
 	coroutine_queue ready; // 就绪队列
-	coroutine_queue defer; // 延迟队列
+	_Atomic(coroutine_defer_node *) defer; // 延迟队列：其他线程投递的节点，无锁的多生产者单消费者栈，取出时整体摘下
+	atomic_int polling; // 调度器将要或正在阻塞在 epoll_wait/io_uring_enter 中，投递后需要通过 eventfd 唤醒
+	atomic_int notified; // 已经写过 eventfd、调度器还没读，避免重复写
 
 	coroutine_link busy; // 忙碌链表
 	
-	coroutine_rbtree_sleep sleeping; // 睡眠红黑树
-	coroutine_rbtree_wait waiting; // 等待红黑树
+	coroutine_rbtree_sleep sleeping; // 睡眠红黑树，SCHEDULE_TIMER_RBTREE 时使用
+	coroutine_timer_wheel timers; // 分层时间轮，默认使用
+	int nwaiting; // fd 状态表中等待读写的协程数量
+	int noffload; // 交给线程池执行、尚未返回的协程数量
+	int nparked; // coroutine_park 挂起、等待 coroutine_wake 的协程数量
+
+	coroutine_pool pool; // 协程结构体与栈缓冲区的缓存
+
+	schedule_worker *worker; // 所属的工作线程，不在 N:M 运行时中时为 NULL
+
+	struct coroutine_uring *uring; // io_uring 后端，SCHEDULE_IO_URING 且内核支持时创建
 
 
 } schedule;
@@ -150,12 +473,13 @@ typedef struct schedule { // 调度器
 
 typedef struct _coroutine {
 
-	ucontext_t ctx; // 协程的上下文信息
+	cpu_ctx ctx; // 协程的上下文信息
 
 	proc_coroutine func; // 协程执行的函数
 	void *arg; // 传递给协程执行函数的参数
 	void *data; // 协程私有数据
 	size_t stack_size; // 栈大小
+	size_t stack_cap; // 栈缓冲区的实际容量（共享栈模式下为所属分级的大小）
 	size_t last_stack_size; // 上次栈大小
 	
 	coroutine_status status; // 协程的状态
@@ -164,28 +488,38 @@ typedef struct _coroutine {
 	uint64_t birth; // 协程创建的事件戳
 	uint64_t id; // 协程的唯一标识符
 
-	int fd; // 与协程关联的文件描述符
+	int fd; // 与协程关联的文件描述符；同时等待多个 fd 时为唤醒它的 fd
 	unsigned short events;  //POLL_EVENT
-
-	int64_t fd_wait;
+	uint32_t revents; // 唤醒时 fd 上的 epoll 事件，由调度器在就绪时填写
 
 	char funcname[64]; //协程执行的函数名称
-	struct _coroutine *co_join; 
+	struct _coroutine *co_join; // 等待本协程结束的协程（coroutine_join）
+	void *co_exit_ptr; // 返回值，coroutine_exit 设置，coroutine_join 取走
+	atomic_int join_state; // COROUTINE_JOIN_*，结束与 join 可能在不同线程
+	struct coroutine_channel *group; // 所属协程组的完成通道，结束时把自己放进去（组本身可能在共享栈上，不能直接引用）
+	int group_index; // 在组中的序号
 
-	void **co_exit_ptr; 
-	void *stack; // 栈空间
+	void *stack; // 栈空间：共享栈模式下为保存的栈内容，独立栈模式下为 mmap 的整块栈（含保护页）
 	void *ebp; //栈指针
 	uint32_t ops; // 当前协程的操作码
-	uint64_t sleep_usecs; //休眠时间
+	uint64_t sleep_usecs; //休眠到期时间（相对调度器创建时间的微秒数）
 
 	RB_ENTRY(_coroutine) sleep_node; // 睡眠队列中的红黑树节点
-	RB_ENTRY(_coroutine) wait_node; // 等待队列中的红黑树节点
+	LIST_ENTRY(_coroutine) timer_next; // 时间轮槽链表中的指针
+	coroutine_timer_list *timer_list; // 所在的时间轮槽，撤销时据此清除位图
 
 	LIST_ENTRY(_coroutine) busy_next; // 忙碌协程链表中的下一个指针
 
 	TAILQ_ENTRY(_coroutine) ready_next; // 就绪队列中的下一个指针
-	TAILQ_ENTRY(_coroutine) defer_next; // 延迟队列中的下一个指针
-	TAILQ_ENTRY(_coroutine) cond_next; // 条件变量队列中的下一个指针
+	coroutine_defer_node defer_node; // 延迟队列节点（新协程、线程池交回）
+	coroutine_defer_node wake_node; // 延迟队列节点（coroutine_wake），与 defer_node 分开，挂起期间也可能在线程池中
+	atomic_int wake_pending; // wake_node 已在延迟队列中
+	int woken; // 唤醒时协程还没挂起，下一次 coroutine_park 直接返回
+	uint64_t deadline; // 截止时间（coroutine_usec_now 的微秒数），0 表示没有；hook 的 I/O 和 coroutine_sleep 超过后返回 ETIMEDOUT
+	coroutine_defer_node cancel_node; // 延迟队列节点（其他线程 coroutine_cancel）
+	atomic_int cancel_pending; // COROUTINE_CANCEL_*
+	TAILQ_ENTRY(_coroutine) cond_next; // 通道、互斥锁、条件变量等等待队列中的下一个指针
+	int sync_mode; // 在读写锁上等待时：0 读，1 写
 
 	TAILQ_ENTRY(_coroutine) io_next; //  I/O 就绪队列中的下一个指针
 	TAILQ_ENTRY(_coroutine) compute_next; // 计算就绪队列中的下一个指针
@@ -196,11 +530,19 @@ typedef struct _coroutine {
 		int fd;
 		int ret;
 		int err;
+		struct timespec timeout; // IORING_OP_LINK_TIMEOUT 的相对超时，与 struct __kernel_timespec 布局相同，提交时由内核读取
 	} io;
 
-	struct coroutine_compute_sched *compute_sched; // 指向计算调度器的指针
-	int ready_fds; // 就绪的文件描述符数量
-	struct pollfd *pfds; // 指向 pollfd 结构体数组的指针
+	struct { // 交给线程池执行的任务，协程挂起期间由线程池线程读写
+		proc_compute func;
+		void *arg;
+		intptr_t ret;
+		int err; // 执行后的 errno
+		uint64_t submit_nsecs; // 提交时间，统计排队时延
+	} task;
+
+	struct coroutine_compute_sched *compute_sched; // 指向计算调度器的指针（执行该协程任务的线程池线程）
+	struct pollfd *pfds; // 同时等待的 fd（COROUTINE_STATUS_WAIT_MULTI），不在共享栈上
 	nfds_t nfds; // pollfd 数组的大小
 
 } coroutine;
@@ -208,25 +550,58 @@ typedef struct _coroutine {
 
 
 
-typedef struct coroutine_compute_sched {
+typedef struct coroutine_compute_sched { // 线程池中的一个线程，见 compute.c
 
-	ucontext_t ctx; // 上下文信息
+	cpu_ctx ctx; // 上下文信息
 
-	coroutine_queue coroutines; // 协程队列
+	coroutine_queue coroutines; // 协程队列：等待在该线程上执行任务的协程
  
- 	coroutine *curr_coroutine;  // 当前协程指针
+ 	coroutine *curr_coroutine;  // 当前协程指针：正在执行其任务的协程
 
-	pthread_mutex_t run_mutex; 
-	pthread_cond_t run_cond;
+	pthread_mutex_t run_mutex; // 保护 coroutines
+	pthread_cond_t run_cond; // 队列为空时线程在此等待
 
 	pthread_mutex_t co_mutex;
 	LIST_ENTRY(coroutine_compute_sched) compute_next;  //计算调度队列
 	
 	coroutine_compute_status compute_status; // 计算状态
 
+	pthread_t tid;
+	int nqueued; // 队列中的任务数量
+	struct coroutine_compute_pool *pool; // 所属线程池
+
 } coroutine_compute_sched;
 
 
+typedef struct coroutine_compute_pool { // 线程池：协程把任务交给某个线程执行后挂起，完成后回到原调度器
+	coroutine_compute_sched *threads;
+	int nthreads;
+	atomic_uint next; // 没有空闲线程时轮询的起点
+	pthread_mutex_t start_mutex; // 第一次使用时启动线程
+
+	// 统计，由提交的调度器线程和线程池线程并发更新
+	atomic_int depth; // 已提交未完成的任务数（排队 + 执行中）
+	atomic_int max_depth;
+	atomic_uint_fast64_t submitted;
+	atomic_uint_fast64_t completed;
+	atomic_uint_fast64_t wait_nsecs; // 排队时间总和（提交到开始执行）
+	atomic_uint_fast64_t run_nsecs; // 执行时间总和
+	atomic_uint_fast64_t max_wait_nsecs;
+} coroutine_compute_pool;
+
+
+typedef struct coroutine_compute_stats { // 线程池统计的快照
+	int nthreads;
+	int depth;
+	int max_depth;
+	uint64_t submitted;
+	uint64_t completed;
+	uint64_t avg_wait_nsecs;
+	uint64_t max_wait_nsecs;
+	uint64_t avg_run_nsecs;
+} coroutine_compute_stats;
+
+
 
 
 
@@ -251,28 +626,179 @@ static inline uint64_t coroutine_usec_now(void) {
 
 
 
+void coroutine_pool_init(schedule *sched);
+void coroutine_pool_destroy(schedule *sched);
+coroutine *coroutine_pool_alloc(schedule *sched);
+void coroutine_pool_release(schedule *sched, coroutine *co);
+void *coroutine_pool_stack_alloc(schedule *sched, size_t size, size_t *cap);
+void coroutine_pool_stack_release(schedule *sched, void *stack, size_t cap);
+void *coroutine_pool_private_stack_alloc(schedule *sched);
+void coroutine_pool_private_stack_release(schedule *sched, void *stack);
+void schedule_pool_set_limits(schedule *sched, size_t max_coroutines, size_t max_stack_bytes);
+void schedule_pool_stats(schedule *sched, coroutine_pool_stats *stats);
+
+void coroutine_sched_key_init(void);
+int schedule_create(int stack_size, int flags);
+void schedule_free(schedule *sched);
+
 int epoller_create(void);
+coroutine_fd *schedule_fd(schedule *sched, int fd);
+int epoller_arm(schedule *sched, int fd, uint32_t events);
+void epoller_forget(schedule *sched, int fd);
 
 
 void schedule_cancel_event(coroutine *co);
 void schedule_sched_event(coroutine *co, int fd, coroutine_event e, uint64_t timeout);
 
+void schedule_timer_init(schedule *sched);
+void schedule_timer_add(coroutine *co);
+void schedule_timer_del(coroutine *co);
+coroutine *schedule_timer_expired(schedule *sched, uint64_t now_usecs);
+uint64_t schedule_timer_next(schedule *sched, uint64_t now_usecs);
+int schedule_timer_empty(schedule *sched);
+
 void schedule_desched_sleepdown(coroutine *co);
 void schedule_sched_sleepdown(coroutine *co, uint64_t msecs);
 
-coroutine* schedule_desched_wait(int fd);
+void schedule_desched_wait(coroutine *co, int fd);
+void schedule_wake_closed(schedule *sched, int fd);
 void schedule_sched_wait(coroutine *co, int fd, unsigned short events, uint64_t timeout);
+void schedule_sched_wait_multi(coroutine *co, struct pollfd *pfds, nfds_t nfds);
+void schedule_arm_wait(schedule *sched, int fd);
+
+int coroutine_cork(int fd, size_t max_bytes, uint32_t max_usecs);
+struct mmsghdr; // <sys/socket.h> 只在 _GNU_SOURCE 下定义，先于本头文件包含系统头文件的源文件中看不到
+int coroutine_recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags, int64_t timeout_ms);
+int coroutine_sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags, int64_t timeout_ms);
+int coroutine_udp_gso(int fd, int size);
+int coroutine_udp_gro(int fd, int on);
+int coroutine_udp_gro_size(const struct msghdr *msg);
+ssize_t coroutine_send_zerocopy(int fd, const void *buf, size_t len, int flags, uint32_t *ticket);
+int coroutine_zerocopy_wait(int fd, uint32_t ticket, int64_t timeout_ms);
+int coroutine_zerocopy_done(int fd, uint32_t ticket);
+uint32_t schedule_zerocopy_reap(schedule *sched, int fd, uint32_t events);
+void schedule_sched_wait_zerocopy(coroutine *co, int fd);
+void schedule_cork_dirty(schedule *sched, coroutine_cork_buf *cork);
+void schedule_cork_flush(schedule *sched);
+
+int schedule_uring_init(schedule *sched);
+void schedule_uring_free(schedule *sched);
+int schedule_uring_wait(schedule *sched, struct timespec t);
+int schedule_uring_busy(schedule *sched);
+uint64_t schedule_uring_enters(schedule *sched);
+void schedule_uring_cancel_fd(schedule *sched, int fd);
+void schedule_uring_cancel_co(schedule *sched, coroutine *co);
+
+ssize_t coroutine_uring_read(int fd, void *buf, size_t count);
+ssize_t coroutine_uring_recv(int fd, void *buf, size_t len, int flags);
+ssize_t coroutine_uring_write(int fd, const void *buf, size_t count);
+ssize_t coroutine_uring_send(int fd, const void *buf, size_t len, int flags);
+int coroutine_uring_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+int coroutine_uring_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+void schedule_defer_push(schedule *sched, coroutine_defer_node *node, int kind);
+void schedule_defer_drain(schedule *sched);
+int schedule_submit(schedule *sched, proc_coroutine func, void *arg);
+void coroutine_park(void);
+int coroutine_park_timeout(int64_t msecs);
+void schedule_unpark(coroutine *co);
+void coroutine_set_deadline(int64_t msecs);
+int coroutine_cancel(coroutine *co);
+int coroutine_testcancel(void);
+int schedule_interrupted(coroutine *co);
+int64_t schedule_deadline_msecs(coroutine *co, int64_t msecs);
+
+coroutine_channel *coroutine_channel_create(size_t elem_size, size_t capacity);
+void coroutine_channel_close(coroutine_channel *ch);
+void coroutine_channel_free(coroutine_channel *ch);
+int coroutine_channel_send(coroutine_channel *ch, const void *elem);
+int coroutine_channel_recv(coroutine_channel *ch, void *elem);
+int coroutine_channel_trysend(coroutine_channel *ch, const void *elem);
+int coroutine_channel_tryrecv(coroutine_channel *ch, void *elem);
+int coroutine_channel_send_ptr(coroutine_channel *ch, void *ptr);
+void *coroutine_channel_recv_ptr(coroutine_channel *ch);
+int schedule_channel_recv(coroutine_channel *ch, void *elem);
+int coroutine_channel_select(coroutine_channel_op *ops, int nops, int64_t timeout_ms);
+size_t coroutine_channel_len(coroutine_channel *ch);
+
+int coroutine_mutex_init(coroutine_mutex *m, int flags);
+void coroutine_mutex_destroy(coroutine_mutex *m);
+int coroutine_mutex_lock(coroutine_mutex *m);
+int coroutine_mutex_timedlock(coroutine_mutex *m, int64_t timeout_ms);
+int coroutine_mutex_trylock(coroutine_mutex *m);
+int coroutine_mutex_unlock(coroutine_mutex *m);
+
+int coroutine_cond_init(coroutine_cond *c, int flags);
+void coroutine_cond_destroy(coroutine_cond *c);
+int coroutine_cond_wait(coroutine_cond *c, coroutine_mutex *m);
+int coroutine_cond_timedwait(coroutine_cond *c, coroutine_mutex *m, int64_t timeout_ms);
+void coroutine_cond_signal(coroutine_cond *c);
+void coroutine_cond_broadcast(coroutine_cond *c);
+
+int coroutine_sem_init(coroutine_sem *s, int flags, long count);
+void coroutine_sem_destroy(coroutine_sem *s);
+int coroutine_sem_wait(coroutine_sem *s);
+int coroutine_sem_timedwait(coroutine_sem *s, int64_t timeout_ms);
+int coroutine_sem_trywait(coroutine_sem *s);
+void coroutine_sem_post(coroutine_sem *s);
+
+int coroutine_rwlock_init(coroutine_rwlock *rw, int flags);
+void coroutine_rwlock_destroy(coroutine_rwlock *rw);
+int coroutine_rwlock_rdlock(coroutine_rwlock *rw);
+int coroutine_rwlock_timedrdlock(coroutine_rwlock *rw, int64_t timeout_ms);
+int coroutine_rwlock_tryrdlock(coroutine_rwlock *rw);
+int coroutine_rwlock_wrlock(coroutine_rwlock *rw);
+int coroutine_rwlock_timedwrlock(coroutine_rwlock *rw, int64_t timeout_ms);
+int coroutine_rwlock_trywrlock(coroutine_rwlock *rw);
+int coroutine_rwlock_unlock(coroutine_rwlock *rw);
+void coroutine_wake(coroutine *co);
+int schedule_on_shared_stack(schedule *sched, const void *ptr, size_t len);
+
+int coroutine_compute_pool_start(coroutine_compute_pool *pool, int nthreads);
+intptr_t coroutine_compute_pool_call(coroutine_compute_pool *pool, proc_compute func, void *arg, int status);
+int schedule_blocking_start(int nthreads);
+intptr_t coroutine_blocking_call(proc_compute func, void *arg);
+int coroutine_stat(const char *path, struct stat *buf);
+int schedule_compute_start(int nthreads);
+intptr_t coroutine_run_compute(proc_compute func, void *arg);
+void coroutine_compute_pool_stats(coroutine_compute_pool *pool, coroutine_compute_stats *stats);
+void coroutine_compute_stats_get(coroutine_compute_stats *stats);
+void coroutine_blocking_stats_get(coroutine_compute_stats *stats);
 
 void schedule_run(void);
+int schedule_set_event_batch(schedule *sched, int batch, int batch_max);
+void schedule_ready(coroutine *co);
+
+int schedule_workers_start(int nworkers, int stack_size, int flags);
+void schedule_workers_stop(void);
+int coroutine_spawn(coroutine **new_co, proc_coroutine func, void *arg);
+
+int schedule_reactors_start(const reactor_config *config);
+void schedule_reactors_join(void);
+int schedule_worker_push(coroutine *co);
+int schedule_worker_run(schedule *sched);
+int schedule_worker_busy(schedule *sched);
+int schedule_worker_idle(schedule *sched);
+void schedule_worker_wakeup(schedule *sched);
+int schedule_worker_done(schedule *sched);
+void schedule_worker_exit(void);
 
 int epoller_ev_register_trigger(void);
 int epoller_wait(struct timespec t);
 int coroutine_resume(coroutine *co);
 void coroutine_free(coroutine *co);
 int coroutine_create(coroutine **new_co, proc_coroutine func, void *arg);
+int coroutine_create_joinable(coroutine **new_co, proc_coroutine func, void *arg);
+void coroutine_exit(void *retval);
+int coroutine_join(coroutine *co, void **retval);
+int coroutine_group_init(coroutine_group *g);
+void coroutine_group_destroy(coroutine_group *g);
+int coroutine_group_spawn(coroutine_group *g, proc_coroutine func, void *arg);
+int coroutine_group_wait_any(coroutine_group *g, void **retval);
+int coroutine_group_wait_all(coroutine_group *g);
 void coroutine_yield(coroutine *co);
 
-void coroutine_sleep(uint64_t msecs);
+int coroutine_sleep(uint64_t msecs);
 
 
 
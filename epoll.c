@@ -8,13 +8,80 @@ int epoller_create(void) { // 创建一个 epoll 实例，并返回相应的文
 	return epoll_create(1024);
 } 
 
+// 获取 fd 在调度器中的状态，状态表不够大时扩容（新扩出的部分清零）
+coroutine_fd *schedule_fd(schedule *sched, int fd) {
+
+	if (fd >= sched->fds_size) {
+		int size = sched->fds_size ? sched->fds_size : 1024;
+		while (size <= fd) size *= 2;
+
+		coroutine_fd *fds = realloc(sched->fds, size * sizeof(coroutine_fd));
+		assert(fds != NULL);
+		memset(fds + sched->fds_size, 0, (size - sched->fds_size) * sizeof(coroutine_fd));
+
+		sched->fds = fds;
+		sched->fds_size = size;
+	}
+
+	return &sched->fds[fd];
+}
+
+
+/* 
+ * 持久登记：fd 第一次等待时 EPOLL_CTL_ADD，之后一直留在 epoll 中，直到 close 时才 EPOLL_CTL_DEL。
+ * 使用 EPOLLONESHOT，事件触发一次后自动失效，不会在没有协程等待时反复上报；
+ * 下次等待只需一次 EPOLL_CTL_MOD 重新激活（同时更新关注的事件），每次等待由 ADD + DEL 两次系统调用降为一次。
+ */
+int epoller_arm(schedule *sched, int fd, uint32_t events) {
+
+	coroutine_fd *cfd = schedule_fd(sched, fd);
+
+	struct epoll_event ev;
+	ev.events = events | EPOLLONESHOT;
+	ev.data.fd = fd;
+
+	int op = cfd->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	int ret = epoll_ctl(sched->poller_fd, op, fd, &ev);
+	if (ret == -1 && op == EPOLL_CTL_MOD && errno == ENOENT) { // fd 没经过 close hook 就被关闭并复用，内核已经移除了旧的登记
+		ret = epoll_ctl(sched->poller_fd, EPOLL_CTL_ADD, fd, &ev);
+	} else if (ret == -1 && op == EPOLL_CTL_ADD && errno == EEXIST) {
+		ret = epoll_ctl(sched->poller_fd, EPOLL_CTL_MOD, fd, &ev);
+	}
+
+	cfd->registered = (ret == 0);
+	cfd->armed = (ret == 0);
+	cfd->events = events;
+
+	return ret;
+}
+
+
+// fd 关闭前调用，从 epoll 中移除并清空状态（等待表中的协程保留，由其自身超时或唤醒后移除）
+void epoller_forget(schedule *sched, int fd) {
+
+	if (fd < 0 || fd >= sched->fds_size) return ;
+
+	coroutine_fd *cfd = &sched->fds[fd];
+	if (cfd->registered) {
+		epoll_ctl(sched->poller_fd, EPOLL_CTL_DEL, fd, NULL);
+	}
+
+	cfd->events = 0;
+	cfd->registered = 0;
+	cfd->armed = 0;
+	cfd->flags = 0;
+	cfd->rcvtimeo = 0;
+	cfd->sndtimeo = 0;
+}
+
+
 int epoller_wait(struct timespec t) { // 等待事件发生，并返回发生的事件数量  *参数t没有用到
 
 	schedule *sched = coroutine_get_sched(); // 获取当前调度器的指针，并从中获取 epoll 文件描述符 sched->poller_fd
 
     // 调用 epoll_wait 函数等待事件发生，其中 sched->eventlist 存储了事件列表
-    // CO_MAX_EVENTS 是事件列表的最大长度，t.tv_sec*1000.0 + t.tv_nsec/1000000.0 是超时时间
-	return epoll_wait(sched->poller_fd, sched->eventlist, CO_MAX_EVENTS, t.tv_sec*1000.0 + t.tv_nsec/1000000.0);
+    // eventlist_size 是事件列表的长度，t.tv_sec*1000.0 + t.tv_nsec/1000000.0 是超时时间
+	return epoll_wait(sched->poller_fd, sched->eventlist, sched->eventlist_size, t.tv_sec*1000.0 + t.tv_nsec/1000000.0);
 }
 
 int epoller_ev_register_trigger(void) { // 为调度器注册一个通知事件，以便在事件发生时通知 epoll
@@ -1,5 +1,11 @@
 #include "coroutine.h"
 
+#ifndef UDP_SEGMENT // 旧的 glibc 头文件中没有，值与内核一致
+#define UDP_SEGMENT		103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO			104
+#endif
 
 
 /* 获取系统调用签名 */
@@ -20,37 +26,120 @@ typedef ssize_t(*sendto_t)(int sockfd, const void *buf, size_t len, int flags,
 typedef int(*accept_t)(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 typedef int(*close_t)(int fd);
 
-/* 真正的系统调用 */
-socket_t socket_f = (socket_t)dlsym(RTLD_NEXT, "socket");
-connect_t connect_f = (connect_t)dlsym(RTLD_NEXT, "connect");
-
-read_t read_f = (read_t)dlsym(RTLD_NEXT, "read");
-recv_t recv_f = (recv_t)dlsym(RTLD_NEXT, "recv");
-
-recvfrom_t recvfrom_f = (recvfrom_t)dlsym(RTLD_NEXT, "recvfrom");
-write_t write_f = (write_t)dlsym(RTLD_NEXT, "write");
-
-send_t send_f = (send_t)dlsym(RTLD_NEXT, "send");
-sendto_t sendto_f = (sendto_t)dlsym(RTLD_NEXT, "sendto");
-
-accept_t accept_f = (accept_t)dlsym(RTLD_NEXT, "accept");
-close_t close_f = (close_t)dlsym(RTLD_NEXT, "close");
+typedef int(*open_t)(const char *pathname, int flags, ...);
+typedef int(*fsync_t)(int fd);
+typedef int(*getaddrinfo_t)(const char *node, const char *service,
+                            const struct addrinfo *hints, struct addrinfo **res);
+typedef int(*setsockopt_t)(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
+
+typedef ssize_t(*readv_t)(int fd, const struct iovec *iov, int iovcnt);
+typedef ssize_t(*writev_t)(int fd, const struct iovec *iov, int iovcnt);
+typedef ssize_t(*recvmsg_t)(int sockfd, struct msghdr *msg, int flags);
+typedef ssize_t(*sendmsg_t)(int sockfd, const struct msghdr *msg, int flags);
+typedef int(*recvmmsg_t)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
+typedef int(*sendmmsg_t)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+typedef ssize_t(*sendfile_t)(int out_fd, int in_fd, off_t *offset, size_t count);
+typedef ssize_t(*splice_t)(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags);
+typedef int(*accept4_t)(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+
+typedef int(*poll_t)(struct pollfd *fds, nfds_t nfds, int timeout);
+typedef int(*select_t)(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+typedef int(*epoll_wait_t)(int epfd, struct epoll_event *events, int maxevents, int timeout);
+
+typedef int(*nanosleep_t)(const struct timespec *req, struct timespec *rem);
+typedef int(*usleep_t)(useconds_t usec);
+typedef unsigned int(*sleep_t)(unsigned int seconds);
+
+typedef int(*dup_t)(int oldfd);
+typedef int(*dup2_t)(int oldfd, int newfd);
+typedef int(*dup3_t)(int oldfd, int newfd, int flags);
+typedef int(*fcntl_t)(int fd, int cmd, ...);
 
+/* 真正的系统调用 */
+socket_t socket_f;
+connect_t connect_f;
+
+read_t read_f;
+recv_t recv_f;
+
+recvfrom_t recvfrom_f;
+write_t write_f;
+
+send_t send_f;
+sendto_t sendto_f;
+
+accept_t accept_f;
+close_t close_f;
+
+open_t open_f;
+fsync_t fsync_f;
+getaddrinfo_t getaddrinfo_f;
+setsockopt_t setsockopt_f;
+
+readv_t readv_f;
+writev_t writev_f;
+recvmsg_t recvmsg_f;
+sendmsg_t sendmsg_f;
+recvmmsg_t recvmmsg_f;
+sendmmsg_t sendmmsg_f;
+sendfile_t sendfile_f;
+splice_t splice_f;
+accept4_t accept4_f;
+
+poll_t poll_f;
+select_t select_f;
+epoll_wait_t epoll_wait_f;
+
+nanosleep_t nanosleep_f;
+usleep_t usleep_f;
+sleep_t sleep_f;
+
+dup_t dup_f;
+dup2_t dup2_f;
+dup3_t dup3_f;
+fcntl_t fcntl_f;
+
+
+// 文件作用域的变量不能用 dlsym 的返回值初始化，改为在 main 之前由构造函数统一获取
+static void __attribute__((constructor)) init_hook(void) {
+
+	socket_f = (socket_t)dlsym(RTLD_NEXT, "socket");
+	connect_f = (connect_t)dlsym(RTLD_NEXT, "connect");
+	read_f = (read_t)dlsym(RTLD_NEXT, "read");
+	recv_f = (recv_t)dlsym(RTLD_NEXT, "recv");
+	recvfrom_f = (recvfrom_t)dlsym(RTLD_NEXT, "recvfrom");
+	write_f = (write_t)dlsym(RTLD_NEXT, "write");
+	send_f = (send_t)dlsym(RTLD_NEXT, "send");
+	sendto_f = (sendto_t)dlsym(RTLD_NEXT, "sendto");
+	accept_f = (accept_t)dlsym(RTLD_NEXT, "accept");
+	close_f = (close_t)dlsym(RTLD_NEXT, "close");
+	open_f = (open_t)dlsym(RTLD_NEXT, "open");
+	fsync_f = (fsync_t)dlsym(RTLD_NEXT, "fsync");
+	getaddrinfo_f = (getaddrinfo_t)dlsym(RTLD_NEXT, "getaddrinfo");
+	setsockopt_f = (setsockopt_t)dlsym(RTLD_NEXT, "setsockopt");
+	readv_f = (readv_t)dlsym(RTLD_NEXT, "readv");
+	writev_f = (writev_t)dlsym(RTLD_NEXT, "writev");
+	recvmsg_f = (recvmsg_t)dlsym(RTLD_NEXT, "recvmsg");
+	sendmsg_f = (sendmsg_t)dlsym(RTLD_NEXT, "sendmsg");
+	recvmmsg_f = (recvmmsg_t)dlsym(RTLD_NEXT, "recvmmsg");
+	sendmmsg_f = (sendmmsg_t)dlsym(RTLD_NEXT, "sendmmsg");
+	sendfile_f = (sendfile_t)dlsym(RTLD_NEXT, "sendfile");
+	splice_f = (splice_t)dlsym(RTLD_NEXT, "splice");
+	accept4_f = (accept4_t)dlsym(RTLD_NEXT, "accept4");
+	poll_f = (poll_t)dlsym(RTLD_NEXT, "poll");
+	select_f = (select_t)dlsym(RTLD_NEXT, "select");
+	epoll_wait_f = (epoll_wait_t)dlsym(RTLD_NEXT, "epoll_wait");
+	nanosleep_f = (nanosleep_t)dlsym(RTLD_NEXT, "nanosleep");
+	usleep_f = (usleep_t)dlsym(RTLD_NEXT, "usleep");
+	sleep_f = (sleep_t)dlsym(RTLD_NEXT, "sleep");
+	dup_f = (dup_t)dlsym(RTLD_NEXT, "dup");
+	dup2_f = (dup2_t)dlsym(RTLD_NEXT, "dup2");
+	dup3_f = (dup3_t)dlsym(RTLD_NEXT, "dup3");
+	fcntl_f = (fcntl_t)dlsym(RTLD_NEXT, "fcntl");
+}
 
 
 
-// 将poll事件转换成epoll事件
-static uint32_t pollevent_2epoll( short events )
-{
-	uint32_t e = 0;	
-	if( events & POLLIN ) 	e |= EPOLLIN;
-	if( events & POLLOUT )  e |= EPOLLOUT;
-	if( events & POLLHUP ) 	e |= EPOLLHUP;
-	if( events & POLLERR )	e |= EPOLLERR;
-	if( events & POLLRDNORM ) e |= EPOLLRDNORM;
-	if( events & POLLWRNORM ) e |= EPOLLWRNORM;
-	return e;
-}
 
 // 将epoll事件转换成poll事件
 static short epollevent_2poll( uint32_t events )
@@ -66,308 +155,2315 @@ static short epollevent_2poll( uint32_t events )
 }
 
 
-/* 封装poll，对调度器进行耦合 */
+// 所有项都只关心调度器不登记的事件（POLLPRI 等）：不挂起在 fd 上，每隔 CO_POLL_RETRY_MSECS 用 poll_f 检查一次，直到超时
+static int poll_inner_retry(struct pollfd *fds, nfds_t nfds, int timeout) {
+
+	uint64_t expire = timeout >= 0 ? coroutine_usec_now() + (uint64_t)timeout * 1000u : 0;
+
+	while (1) {
+		int ret = poll_f(fds, nfds, 0);
+		if (ret != 0) return ret;
+
+		uint64_t msecs = CO_POLL_RETRY_MSECS;
+		if (expire != 0) {
+			uint64_t now = coroutine_usec_now();
+			if (now >= expire) return 0;
+			if ((expire - now + 999) / 1000 < msecs) msecs = (expire - now + 999) / 1000;
+		}
+		if (coroutine_sleep(msecs) < 0) return -1; // 被取消或超过截止时间
+	}
+}
+
+
+/* 封装poll，对调度器进行耦合。timeout < 0 不超时，并按协程的截止时间缩短。
+   协程同时等待所有 fd，第一个就绪的 fd 唤醒它（只唤醒一次），醒来后用 poll_f 不阻塞地填写所有项的 revents，返回 revents 不为 0 的项数；
+   超时返回 0；fd 被关闭、被取消或超过截止时间返回 -1，errno 为 EBADF / ECANCELED / ETIMEDOUT。
+   负数的 fd 与 poll 一致被忽略；既不关心可读也不关心可写的项（只有 POLLPRI 等）调度器不登记，只在醒来后由 poll_f 报告 */
 
 static int poll_inner(struct pollfd *fds, nfds_t nfds, int timeout) {
 
 	if (timeout == 0)
 	{
-		return poll(fds, nfds, timeout); // 立即返回
-	}
-	if (timeout < 0)
-	{
-		timeout = INT_MAX;
+		return poll_f(fds, nfds, timeout); // 立即返回
 	}
 
 	schedule *sched = coroutine_get_sched(); // 获取当前线程的调度器
-	if (sched == NULL) {
-		printf("scheduler not exit!\n");
-		return -1;
+	coroutine *co = sched != NULL ? sched->curr_thread : NULL; // 获取当前正在执行的协程，也就是调用poll_inner所在函数（例如read）所在的协程
+	if (co == NULL) { // 没有调度器或不在协程中（如 schedule_run 之前在主线程里 connect），直接阻塞等待
+		return poll_f(fds, nfds, timeout);
 	}
-	
-	coroutine *co = sched->curr_thread; // 获取当前正在执行的协程，也就是调用poll_inner所在函数（例如read）所在的协程
-	
-	int i = 0;
-	for (i = 0;i < nfds;i ++) { // 将poll监视的文件描述符和相应的事件转换为 epoll 事件
-	
-		struct epoll_event ev;
-		ev.events = pollevent_2epoll(fds[i].events);
-		ev.data.fd = fds[i].fd;
-		epoll_ctl(sched->poller_fd, EPOLL_CTL_ADD, fds[i].fd, &ev);
 
-		co->events = fds[i].events;
-		schedule_sched_wait(co, fds[i].fd, fds[i].events, timeout); // 将当前协程加入调度器的等待红黑树中
+	if (schedule_interrupted(co) < 0) return -1; // 已经取消或超过截止时间，不再等待
+
+	nfds_t i = 0, waitable = 0, others = 0;
+	for (i = 0;i < nfds;i ++) {
+		if (fds[i].fd < 0) continue;
+		if (fds[i].events & (POLLIN | POLLOUT)) waitable ++;
+		else others ++;
+	}
+	if (waitable == 0 && others > 0) { // 调度器只有读写槽位，登记不了，挂起会一直等下去
+		return poll_inner_retry(fds, nfds, timeout);
+	}
+
+	int64_t wait_ms = schedule_deadline_msecs(co, timeout);
+
+	// 多个 fd 时调度器在协程挂起期间遍历等待集合，数组在共享栈上时先复制一份
+	struct pollfd *wait = fds;
+	size_t cap = 0;
+	if (nfds > 1 && schedule_on_shared_stack(sched, fds, nfds * sizeof(struct pollfd))) {
+		wait = coroutine_pool_stack_alloc(sched, nfds * sizeof(struct pollfd), &cap);
+		if (wait == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		memcpy(wait, fds, nfds * sizeof(struct pollfd));
+	}
+
+	for (i = 0;i < nfds;i ++) {
+		fds[i].revents = 0;
+	}
+	co->revents = 0;
+
+	if (nfds > 1) { // 按 fd 放进调度器的等待表，并激活 epoll 登记（首次 ADD，之后 MOD）
+		schedule_sched_wait_multi(co, wait, nfds);
+	} else if (nfds == 1 && fds[0].fd >= 0 && (fds[0].events & (POLLIN | POLLOUT))) {
+		schedule_sched_wait(co, fds[0].fd, fds[0].events, 1);
+	}
+	if (wait_ms >= 0) {
+		schedule_sched_sleepdown(co, wait_ms); // 超时由定时器恢复
 	}
 	coroutine_yield(co); // 让当前协程放弃 CPU 控制权，等待事件发生
 
-	for (i = 0;i < nfds;i ++) { // 处理事件完成后从 epoll 实例中删除已经监视的文件描述符，并清除相应的等待状态
-	
-		struct epoll_event ev;
-		ev.events = pollevent_2epoll(fds[i].events);
-		ev.data.fd = fds[i].fd;
-		epoll_ctl(sched->poller_fd, EPOLL_CTL_DEL, fds[i].fd, &ev);
+	// 由 fd 唤醒时调度器已经把协程从所有 fd 上移出；超时醒来时还在等待表中，在这里一次移出（同时撤销定时器）
+	int expired = co->status & BIT(COROUTINE_STATUS_EXPIRED);
+	schedule_desched_wait(co, co->fd); // fd 留在 epoll 中（EPOLLONESHOT 已使其失效），close 时才移除
+	co->status &= CLEARBIT(COROUTINE_STATUS_EXPIRED);
+	co->status &= CLEARBIT(COROUTINE_STATUS_FDEOF); // 对端关闭已经在 revents 中（POLLHUP）
+
+	if (wait != fds) {
+		coroutine_pool_stack_release(sched, wait, cap);
+	}
+
+	if (co->status & BIT(COROUTINE_STATUS_FDCLOSED)) { // 等待期间 fd 被关闭
+		co->status &= CLEARBIT(COROUTINE_STATUS_FDCLOSED);
+		errno = EBADF;
+		return -1;
+	}
+	if (co->status & BIT(COROUTINE_STATUS_CANCELLED)) {
+		errno = ECANCELED;
+		return -1;
+	}
+	if (expired) {
+		if (wait_ms != timeout) { // 由截止时间缩短的等待
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		return 0;
+	}
+
+	int nready = poll_f(fds, nfds, 0); // 唤醒只来自一个 fd，其他 fd 此时也可能就绪
+	if (nready > 0) return nready;
 
-		schedule_desched_wait(fds[i].fd); // 处理完成后将该协程从调度器的等待红黑树中删除
+	nready = 0; // 事件已经被别的协程消耗掉了，仍按唤醒时的事件报告这个 fd，调用者重试时会再等待
+	short revents = epollevent_2poll(co->revents);
+	for (i = 0;i < nfds;i ++) { // 同一个 fd 可能出现多次
+		fds[i].revents = 0;
+		if (fds[i].fd != co->fd) continue;
+
+		fds[i].revents = revents & (fds[i].events | POLLERR | POLLHUP);
+		if (fds[i].revents) nready ++;
 	}
 
-	return nfds; // 返回监视文件描述符数量
+	return nready;
 }
 
 
 
 
 
+// SO_RCVTIMEO / SO_SNDTIMEO 的 timeval 换算成毫秒，不足 1 毫秒按 1 毫秒
+static uint32_t hook_timeval_msecs(const struct timeval *tv) {
 
-/* 覆盖原系统调用 */
+	uint64_t msecs = (uint64_t)tv->tv_sec * 1000u + (tv->tv_usec + 999) / 1000;
 
+	return msecs > UINT32_MAX ? UINT32_MAX : (uint32_t)msecs;
+}
 
-int socket(int domain, int type, int protocol) {
 
-	int fd = socket_f(domain, type, protocol);
-	if (fd == -1) {
-		printf("Failed to create a new socket\n");
-		return -1;
+// 查询套接字上已有的超时：可能在调度器创建之前或在其他线程中设置
+static void hook_probe_timeouts(int fd, coroutine_fd *cfd) {
+
+	struct timeval tv;
+	socklen_t len = sizeof(tv);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, &len) == 0) {
+		cfd->rcvtimeo = hook_timeval_msecs(&tv);
 	}
-	int ret = fcntl(fd, F_SETFL, O_NONBLOCK); // 默认将所有套接字文件描述符设置为非阻塞模式
-	if (ret == -1) {
-		close(ret);
-		return -1;
+	len = sizeof(tv);
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, &len) == 0) {
+		cfd->sndtimeo = hook_timeval_msecs(&tv);
 	}
-	int reuse = 1;
-	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse, sizeof(reuse)); // 设置套接字选项 SO_REUSEADDR，允许在套接字关闭后立即重用之前使用的地址
-	
-	return fd;
 }
 
 
-ssize_t read(int fd, void *buf, size_t count) { // 上下文切换实现非阻塞read
+// fd 的状态（是否非阻塞、是否为普通文件）。第一次用到时查询一次并记在调度器的 fd 状态表中，close 时清空
+static int hook_fd_flags(int fd) {
 
-	struct pollfd fds;
-	fds.fd = fd;
-	fds.events = POLLIN | POLLERR | POLLHUP;
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL) return 0;
 
-	poll_inner(&fds, 1, 1); // 将当前fd交由epoll管理并让出cpu，避免read_f阻塞，等待fd就绪后由调度器返回到这里继续执行read_f
+	coroutine_fd *cfd = schedule_fd(sched, fd);
+	if ((cfd->flags & COROUTINE_FD_CHECKED) == 0) {
+		int fl = fcntl_f(fd, F_GETFL);
+		cfd->flags |= COROUTINE_FD_CHECKED;
+		if (fl != -1 && (fl & O_NONBLOCK)) {
+			cfd->flags |= COROUTINE_FD_NONBLOCK;
+		}
 
-	int ret = read_f(fd, buf, count);
-	if (ret < 0) {
-		
-		if (errno == ECONNRESET) return -1;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))) {
+			cfd->flags |= COROUTINE_FD_REGULAR;
+		} else if (S_ISSOCK(st.st_mode)) {
+			hook_probe_timeouts(fd, cfd);
+		}
 	}
 
-	return ret;
+	return cfd->flags;
 }
 
 
+// fd 上的 SO_RCVTIMEO（is_write 为 0）或 SO_SNDTIMEO，毫秒，没有设置时返回 -1
+static int hook_fd_timeout(int fd, int is_write) {
 
-ssize_t recv(int fd, void *buf, size_t len, int flags) { // 上下文切换实现非阻塞recv
+	if (hook_fd_flags(fd) == 0) return -1; // 没有调度器
 
-	struct pollfd fds;
-	fds.fd = fd;
-	fds.events = POLLIN | POLLERR | POLLHUP;
+	coroutine_fd *cfd = &coroutine_get_sched()->fds[fd];
+	uint32_t msecs = is_write ? cfd->sndtimeo : cfd->rcvtimeo;
 
-	poll_inner(&fds, 1, 1);  // 将当前fd交由epoll管理并让出cpu，避免阻塞，等待fd就绪后由调度器返回到这里继续执行
+	return msecs != 0 ? (int)(msecs > INT_MAX ? INT_MAX : msecs) : -1;
+}
 
-	int ret = recv_f(fd, buf, len, flags);
-	if (ret < 0) {
 
-		if (errno == ECONNRESET) return -1;
-		
-	}
+// fd 的超时按整个调用累计：调用开始时算出到期时间，0 表示不超时
+static uint64_t hook_expire(int timeout) {
+	return timeout >= 0 ? coroutine_usec_now() + (uint64_t)timeout * 1000u : 0;
+}
+
 
+/* 在 fd 上等待一次，expire 为 hook_expire 算出的到期时间。
+   超时返回 -1，errno 为 EAGAIN（与内核的 SO_RCVTIMEO / SO_SNDTIMEO 一致）；被取消或超过截止时间返回 -1 */
+static int hook_poll(struct pollfd *fds, uint64_t expire) {
+
+	if (expire == 0) return poll_inner(fds, 1, -1);
+
+	uint64_t now = coroutine_usec_now();
+	int ret = now < expire ? poll_inner(fds, 1, (int)((expire - now + 999) / 1000)) : 0;
+	if (ret == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
 	return ret;
 }
 
 
+// fd 是否处于非阻塞模式，非阻塞时可以先直接尝试系统调用，EAGAIN 后再让出cpu
+static int hook_nonblock(int fd) {
+	return hook_fd_flags(fd) & COROUTINE_FD_NONBLOCK;
+}
 
-ssize_t recvfrom(int fd, void *buf, size_t len, int flags,
-                struct sockaddr *src_addr, socklen_t *addrlen) {
 
-	struct pollfd fds;
-	fds.fd = fd;
-	fds.events = POLLIN | POLLERR | POLLHUP;
+// 在协程中访问普通文件/块设备：这类 fd 总是"就绪"，不能交给 epoll，读写会阻塞在磁盘上，交给阻塞调用线程池
+static int hook_regular(int fd) {
 
-	poll_inner(&fds, 1, 1); // 将当前fd交由epoll管理并让出cpu，避免阻塞，等待fd就绪后由调度器返回到这里继续执行
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || sched->curr_thread == NULL) return 0;
 
-	int ret = recvfrom_f(fd, buf, len, flags, src_addr, addrlen);
-	if (ret < 0) {
-		if (errno == EAGAIN) return ret;
-		if (errno == ECONNRESET) return 0;
-		
-		printf("recv error : %d, ret : %d\n", errno, ret);
-		assert(0);
-	}
+	return hook_fd_flags(fd) & COROUTINE_FD_REGULAR;
+}
 
-	return ret;
+
+// 调度器使用 io_uring 后端且在协程中调用时，读写直接提交给 io_uring，完成后才恢复协程
+static int hook_uring(void) {
+
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+
+	return sched != NULL && sched->uring != NULL && sched->curr_thread != NULL;
 }
 
 
+// hook 创建的套接字都是非阻塞的，直接记录下来；user 为用户自己要求的非阻塞（SOCK_NONBLOCK），否则是 hook 设置的
+static void hook_mark_nonblock(int fd, int user) {
 
-ssize_t write(int fd, const void *buf, size_t count) {
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL) return ;
 
-	int sent = 0; // 已写入字节数
+	schedule_fd(sched, fd)->flags |= COROUTINE_FD_CHECKED | COROUTINE_FD_NONBLOCK |
+		(user ? COROUTINE_FD_USER_NONBLOCK : COROUTINE_FD_HOOK_NONBLOCK);
+}
 
-	int ret = write_f(fd, ((char*)buf)+sent, count-sent); // 先进行一次写入，不判断fd是否可写，未阻塞
-	if (ret == 0) return ret;
-	if (ret > 0) sent += ret;
 
-	while (sent < count) { // 如果第一次没有写完，等到fd可写再写入，避免阻塞
-		struct pollfd fds;
-		fds.fd = fd;
-		fds.events = POLLOUT | POLLERR | POLLHUP;
+// 用户要求非阻塞的 fd：hook 只执行一次系统调用，不等待
+static int hook_user_nonblock(int fd) {
+	return hook_fd_flags(fd) & COROUTINE_FD_USER_NONBLOCK;
+}
 
-		poll_inner(&fds, 1, 1); // 将当前fd交由epoll管理并让出cpu，避免阻塞，等待fd就绪后由调度器返回到这里继续执行
-		ret = write_f(fd, ((char*)buf)+sent, count-sent);
-		if (ret <= 0) {			
-			break;
-		}
-		sent += ret;
-	}
 
-	if (ret <= 0 && sent == 0) return ret; // 写入失败
-	
-	return sent;
+// 在协程中调用时返回当前调度器，否则返回 NULL（直接执行原系统调用）
+static schedule *hook_coroutine_sched(void) {
+
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+
+	return sched != NULL && sched->curr_thread != NULL ? sched : NULL;
 }
 
 
+// 不在协程中调用、且 fd 的非阻塞不是 hook 设置的：直接执行原系统调用，按 fd 本来的模式阻塞或返回 EAGAIN。
+// hook 设置了非阻塞的 fd（有调度器时 hook 创建的套接字）仍走 hook，由 poll_inner 阻塞等待
+static int hook_passthrough(int fd) {
+	return hook_coroutine_sched() == NULL && (hook_fd_flags(fd) & COROUTINE_FD_HOOK_NONBLOCK) == 0;
+}
 
-ssize_t send(int fd, const void *buf, size_t len, int flags) {
 
-	int sent = 0; // 已发送字节数
+// dup 出的 fd 与原 fd 共享打开的文件（非阻塞标志、套接字超时），复制 fd 状态
+static void hook_copy_fd(int oldfd, int newfd) {
 
-	int ret = send_f(fd, ((char*)buf)+sent, len-sent, flags); // 先进行一次发送，不判断fd是否可写，未阻塞
-	if (ret == 0) return ret;
-	if (ret > 0) sent += ret;
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || oldfd < 0 || newfd < 0) return ;
 
-	while (sent < len) { // 如果第一次没有发送完，等到fd可写再发送，避免阻塞
-		struct pollfd fds;
-		fds.fd = fd;
-		fds.events = POLLOUT | POLLERR | POLLHUP;
+	hook_fd_flags(oldfd);
+	coroutine_fd *dst = schedule_fd(sched, newfd); // 可能扩容，之后再取原 fd 的状态
+	coroutine_fd *src = &sched->fds[oldfd];
 
-		poll_inner(&fds, 1, 1); // 将当前fd交由epoll管理并让出cpu，避免阻塞，等待fd就绪后由调度器返回到这里继续执行
-		ret = send_f(fd, ((char*)buf)+sent, len-sent, flags);
-		
-		if (ret <= 0) {			
-			break;
-		}
-		sent += ret;
-	}
+	dst->flags = src->flags;
+	dst->rcvtimeo = src->rcvtimeo;
+	dst->sndtimeo = src->sndtimeo;
+}
 
-	if (ret <= 0 && sent == 0) return ret; // send失败
-	
-	return sent;
+
+// accept 得到的套接字继承监听套接字的 SO_RCVTIMEO / SO_SNDTIMEO（与内核一致）
+static void hook_inherit_timeouts(int listen_fd, int fd) {
+
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || listen_fd < 0 || listen_fd >= sched->fds_size) return ;
+
+	coroutine_fd *cfd = schedule_fd(sched, fd); // 可能扩容，之后再取监听套接字的状态
+	cfd->rcvtimeo = sched->fds[listen_fd].rcvtimeo;
+	cfd->sndtimeo = sched->fds[listen_fd].sndtimeo;
 }
 
 
 
-ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
-            const struct sockaddr *dest_addr, socklen_t addrlen) {
 
-	struct pollfd fds;
-	fds.fd = sockfd;
-	fds.events = POLLOUT | POLLERR | POLLHUP;
+/* 交给阻塞调用线程池执行的任务。参数结构体在共享栈上时先复制到堆上，执行完再拷回（结果也通过它带回） */
 
-	poll_inner(&fds, 1, 1); // 将当前fd交由epoll管理并让出cpu，避免阻塞，等待fd就绪后由调度器返回到这里继续执行
+static intptr_t hook_blocking_call(proc_compute func, void *args, size_t size) {
 
-	int ret = sendto_f(sockfd, buf, len, flags, dest_addr, addrlen);
-	if (ret < 0) {
-		if (errno == EAGAIN) return ret;
-		if (errno == ECONNRESET) return 0;
-		
-		printf("recv error : %d, ret : %d\n", errno, ret);
-		assert(0);
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || !schedule_on_shared_stack(sched, args, size)) {
+		return coroutine_blocking_call(func, args);
+	}
+
+	void *copy = malloc(size);
+	if (copy == NULL) {
+		errno = ENOMEM;
+		return -1;
 	}
+	memcpy(copy, args, size);
+
+	intptr_t ret = coroutine_blocking_call(func, copy);
+	int err = errno;
+
+	memcpy(args, copy, size);
+	free(copy);
 
+	errno = err;
 	return ret;
 }
 
 
+struct hook_rw_args {
+	int fd;
+	void *buf;
+	size_t count;
+};
 
-int accept(int fd, struct sockaddr *addr, socklen_t *len) {
+static intptr_t hook_read_task(void *arg) {
+	struct hook_rw_args *a = arg;
+	return read_f(a->fd, a->buf, a->count);
+}
 
-	int sockfd = -1; // 初始化
-	int timeout = 1; // 超时时间
-	coroutine *co = coroutine_get_sched()->curr_thread; // 获取当前协程
-	
-	while (1) { // 轮询接受连接
-		struct pollfd fds;
-		fds.fd = fd;
-		fds.events = POLLIN | POLLERR | POLLHUP;
-		poll_inner(&fds, 1, timeout); // 将当前fd交由epoll管理并让出cpu，避免阻塞，等待fd就绪后由调度器返回到这里继续执行
+static intptr_t hook_write_task(void *arg) { // 普通文件的 write 一般一次写完，这里保证全部写完或出错
+	struct hook_rw_args *a = arg;
+	size_t sent = 0;
 
-		sockfd = accept_f(fd, addr, len);
-		if (sockfd < 0) {
-			if (errno == EAGAIN) {
-				continue;
-			} else if (errno == ECONNABORTED) {
-				printf("accept : ECONNABORTED\n");
-				
-			} else if (errno == EMFILE || errno == ENFILE) {
-				printf("accept : EMFILE || ENFILE\n");
-			}
+	while (sent < a->count) {
+		ssize_t ret = write_f(a->fd, (char *)a->buf + sent, a->count - sent);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret <= 0) return sent > 0 ? (intptr_t)sent : ret;
+		sent += ret;
+	}
+	return sent;
+}
+
+
+// 普通文件读写：用户缓冲区在共享栈上时经过中转缓冲区
+static ssize_t hook_regular_rw(int fd, void *buf, size_t count, int is_write) {
+
+	schedule *sched = coroutine_get_sched();
+	struct hook_rw_args args = {fd, buf, count};
+	void *bounce = NULL;
+	size_t cap = 0;
+
+	if (schedule_on_shared_stack(sched, buf, count)) {
+		bounce = coroutine_pool_stack_alloc(sched, count, &cap);
+		if (bounce == NULL) {
+			errno = ENOMEM;
 			return -1;
-		} else {
-			break;
 		}
+		if (is_write) memcpy(bounce, buf, count);
+		args.buf = bounce;
 	}
 
-	int ret = fcntl(sockfd, F_SETFL, O_NONBLOCK); // 默认设置套接字描述符为非阻塞模式
-	if (ret == -1) {
-		close(sockfd);
-		return -1;
+	ssize_t ret = hook_blocking_call(is_write ? hook_write_task : hook_read_task, &args, sizeof(args));
+
+	if (bounce) {
+		int err = errno;
+		if (!is_write && ret > 0) memcpy(buf, bounce, ret);
+		coroutine_pool_stack_release(sched, bounce, cap);
+		errno = err;
 	}
-	int reuse = 1;
-	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse, sizeof(reuse)); // 设置套接字选项 SO_REUSEADDR，允许在套接字关闭后立即重用之前使用的地址
-	
-	return sockfd;
+
+	return ret;
 }
 
 
 
-int connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+// iovec 的总长度
+static size_t hook_iov_len(const struct iovec *iov, int iovcnt) {
 
-	int ret = 0;
+	size_t total = 0;
+	int i = 0;
 
-	while (1) {
+	for (i = 0;i < iovcnt;i ++) {
+		total += iov[i].iov_len;
+	}
+	return total;
+}
 
-		struct pollfd fds;
-		fds.fd = fd;
-		fds.events = POLLOUT | POLLERR | POLLHUP;
-		poll_inner(&fds, 1, 1);  // 加入epoll管理，让出cpu
 
-		ret = connect_f(fd, addr, addrlen);
-		if (ret == 0) break;
+// 普通文件的 readv / writev：逐段交给线程池，短读或出错时停止
+static ssize_t hook_regular_rwv(int fd, const struct iovec *iov, int iovcnt, int is_write) {
 
-		if (ret == -1 && (errno == EAGAIN ||
-			errno == EWOULDBLOCK || 
-			errno == EINPROGRESS)) {
-			continue;
-		} else {
-			break;
-		}
+	ssize_t done = 0;
+	int i = 0;
+
+	for (i = 0;i < iovcnt;i ++) {
+		if (iov[i].iov_len == 0) continue;
+
+		ssize_t ret = hook_regular_rw(fd, iov[i].iov_base, iov[i].iov_len, is_write);
+		if (ret < 0) return done > 0 ? done : -1;
+
+		done += ret;
+		if ((size_t)ret < iov[i].iov_len) break;
 	}
+	return done;
+}
 
-	return ret;
+
+// readv / recvmsg 共用：msg 为 NULL 时 readv，否则 recvmsg
+static ssize_t hook_recvv(int fd, const struct iovec *iov, int iovcnt, struct msghdr *msg, int flags) {
+
+	struct pollfd fds;
+	fds.fd = fd;
+	fds.events = POLLIN | POLLERR | POLLHUP;
+	int timeout = hook_fd_timeout(fd, 0); // SO_RCVTIMEO，-1 不超时
+	uint64_t expire = hook_expire(timeout);
+
+	if (!hook_nonblock(fd)) {
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+
+	while (1) { // 先直接读，EAGAIN 时才让出cpu等待fd可读
+		ssize_t ret = msg != NULL ? recvmsg_f(fd, msg, flags) : readv_f(fd, iov, iovcnt);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return ret;
+
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
 }
 
 
+/* writev / sendmsg 共用：msg 为 NULL 时 writev，否则 sendmsg。
+   部分写入后跳过已写的部分继续写，直到写完、出错或超时，返回已写字节数；一个字节都没写成时返回 -1。
+   跳过时修改的是 iovec 的副本，不改动用户的数组；辅助数据（如 SCM_RIGHTS）只随第一次写入发出 */
+static ssize_t hook_sendv(int fd, const struct iovec *iov, int iovcnt, const struct msghdr *msg, int flags) {
 
-int close(int fd) {
+	struct pollfd fds;
+	fds.fd = fd;
+	fds.events = POLLOUT | POLLERR | POLLHUP;
+	int timeout = hook_fd_timeout(fd, 1); // SO_SNDTIMEO，-1 不超时
+	uint64_t expire = hook_expire(timeout);
 
-	/* 暂时未作修改 */
+	size_t total = hook_iov_len(iov, iovcnt), sent = 0;
+	struct iovec *rest = NULL, *cur = NULL; // 剩余部分的副本
+	int count = iovcnt;
+	struct msghdr m;
+	ssize_t ret = 0;
 
-	return close_f(fd);
+	if (msg != NULL) m = *msg;
+
+	if (!hook_nonblock(fd)) {
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+
+	while (1) {
+		const struct iovec *v = cur != NULL ? cur : iov;
+		if (msg != NULL) {
+			m.msg_iov = (struct iovec *)v;
+			m.msg_iovlen = count;
+			ret = sendmsg_f(fd, &m, flags);
+		} else {
+			ret = writev_f(fd, v, count);
+		}
+
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (hook_poll(&fds, expire) < 0) break; // 超时、被取消或超过截止时间
+			continue;
+		}
+		if (ret <= 0) break;
+
+		sent += ret;
+		if (sent >= total) break;
+
+		if (rest == NULL) {
+			rest = malloc(count * sizeof(struct iovec));
+			if (rest == NULL) break; // 返回已写的部分
+			memcpy(rest, iov, count * sizeof(struct iovec));
+			cur = rest;
+		}
+		size_t n = ret;
+		while (count > 0 && n >= cur->iov_len) { // 跳过已经写完的段
+			n -= cur->iov_len;
+			cur ++;
+			count --;
+		}
+		cur->iov_base = (char *)cur->iov_base + n;
+		cur->iov_len -= n;
+		m.msg_control = NULL;
+		m.msg_controllen = 0;
+	}
+
+	int err = errno;
+	free(rest);
+	errno = err;
+
+	if (sent > 0) return sent;
+	return ret < 0 ? -1 : ret;
 }
 
 
+/*
+ * 写合并（cork）：coroutine_cork 打开后，协程对该 fd 的 write / send（flags 为 0 或 MSG_NOSIGNAL）先放进缓冲区直接返回，
+ * 调度器每轮在 epoll_wait 之前（schedule_cork_flush）把缓冲的数据一次发出，流水线请求下一轮的多个小响应只需一次系统调用。
+ * 缓冲超过 max_bytes、或最早的数据已等待 max_usecs 时，本次写入在协程中连同缓冲的数据一起发出（等待可写）。
+ * 调度器发送时不等待：EAGAIN 时登记可写事件，可写后再发；出错时丢弃缓冲的数据，错误在下一次写入时返回（与套接字的异步错误一样）。
+ * 其他写入方式（writev、sendmsg、sendto、带其他 flags 的 send）先在协程中发出缓冲的数据，保证顺序。
+ * 同一个 fd 只能有一个协程在写；dup 出的 fd 不共享缓冲区
+ */
 
+static coroutine_cork_buf *hook_cork(int fd) {
 
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || fd < 0 || fd >= sched->fds_size) return NULL;
+
+	return sched->fds[fd].cork;
+}
 
 
+void schedule_cork_dirty(schedule *sched, coroutine_cork_buf *cork) {
 
+	if (cork->dirty) return ;
 
+	cork->dirty = 1;
+	LIST_INSERT_HEAD(&sched->cork_dirty, cork, dirty_next);
+}
 
 
+static void hook_cork_undirty(coroutine_cork_buf *cork) {
 
+	if (!cork->dirty) return ;
 
+	cork->dirty = 0;
+	LIST_REMOVE(cork, dirty_next);
+}
 
 
+// 在调度器中发送缓冲的数据，不等待。套接字用 MSG_NOSIGNAL，对端关闭时不在调度器中触发 SIGPIPE，EPIPE 在下一次写入时返回
+static void hook_cork_push(schedule *sched, coroutine_cork_buf *cork) {
+
+	while (cork->off < cork->len) {
+		ssize_t ret = -1;
+		if (!cork->not_sock) {
+			ret = send_f(cork->fd, cork->buf + cork->off, cork->len - cork->off, MSG_NOSIGNAL);
+			if (ret < 0 && errno == ENOTSOCK) {
+				cork->not_sock = 1;
+				continue;
+			}
+		} else {
+			ret = write_f(cork->fd, cork->buf + cork->off, cork->len - cork->off);
+		}
+
+		if (ret > 0) {
+			cork->off += ret;
+			continue;
+		}
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { // 可写后由 schedule_dispatch_wait 放回待发送链表
+			cork->blocked = 1;
+			schedule_arm_wait(sched, cork->fd);
+			return ;
+		}
+
+		cork->err = ret < 0 ? errno : EIO;
+		break;
+	}
+
+	cork->off = cork->len = 0;
+}
+
+
+// 每轮 epoll_wait 之前由调度器调用
+void schedule_cork_flush(schedule *sched) {
+
+	coroutine_cork_buf *cork = NULL;
+
+	while ((cork = LIST_FIRST(&sched->cork_dirty)) != NULL) {
+		hook_cork_undirty(cork);
+		hook_cork_push(sched, cork);
+	}
+}
+
+
+// 缓冲区至少还能放下 count 字节：先把已发出的部分移走，不够时扩容（不超过 max_bytes）
+static int hook_cork_reserve(coroutine_cork_buf *cork, size_t count) {
+
+	if (cork->off > 0) {
+		memmove(cork->buf, cork->buf + cork->off, cork->len - cork->off);
+		cork->len -= cork->off;
+		cork->off = 0;
+	}
+	if (cork->len + count <= cork->cap) return 0;
+
+	size_t cap = cork->cap ? cork->cap : 4096;
+	while (cap < cork->len + count) cap *= 2;
+	if (cap > cork->max_bytes) cap = cork->max_bytes;
+
+	char *buf = realloc(cork->buf, cap);
+	if (buf == NULL) return -1;
+
+	cork->buf = buf;
+	cork->cap = cap;
+	return 0;
+}
+
+
+/* 在协程中把缓冲的数据和 buf 一起发出（等待可写），返回 buf 中发出的字节数。
+   缓冲的数据先从缓冲区中摘下，发送期间调度器看不到它；没发完的部分放回缓冲区的开头，返回 -1 */
+static ssize_t hook_cork_send(schedule *sched, coroutine_cork_buf *cork, int fd, const void *buf, size_t count) {
+
+	char *pending = cork->buf;
+	size_t off = cork->off, npending = cork->len - cork->off, cap = cork->cap;
+
+	hook_cork_undirty(cork);
+	cork->blocked = 0;
+	cork->buf = NULL;
+	cork->off = cork->len = cork->cap = 0;
+
+	struct iovec iov[2] = {{pending + off, npending}, {(void *)buf, count}};
+	ssize_t ret = hook_sendv(fd, iov, count > 0 ? 2 : 1, NULL, 0);
+	int err = errno;
+
+	size_t sent = ret > 0 ? ret : 0;
+	if (sent < npending) { // 缓冲的数据没有发完，剩余部分放回去，本次写入没有被接受
+		size_t left = npending - sent;
+		if (cork->buf == NULL) {
+			memmove(pending, pending + off + sent, left);
+			cork->buf = pending;
+			cork->cap = cap;
+			cork->len = left;
+		} else { // 等待期间又有写入（同一个 fd 上有多个协程在写）
+			if (hook_cork_reserve(cork, left) == 0) {
+				memmove(cork->buf + left, cork->buf, cork->len);
+				memcpy(cork->buf, pending + off + sent, left);
+				cork->len += left;
+			}
+			free(pending);
+		}
+		cork->since = coroutine_usec_now();
+		schedule_cork_dirty(sched, cork);
+
+		errno = ret < 0 ? err : EAGAIN;
+		return -1;
+	}
+
+	if (cork->buf == NULL) { // 留着原来的缓冲区继续用
+		cork->buf = pending;
+		cork->cap = cap;
+	} else {
+		free(pending);
+	}
+
+	if (sent - npending == 0 && count > 0) {
+		errno = ret < 0 ? err : EAGAIN;
+		return -1;
+	}
+	return sent - npending;
+}
+
+
+// 打开 cork 的 fd 上的 write / send：放进缓冲区，或超过阈值时连同缓冲的数据一起发出
+static ssize_t hook_cork_write(coroutine_cork_buf *cork, int fd, const void *buf, size_t count) {
+
+	schedule *sched = coroutine_get_sched();
+
+	if (cork->err) { // 调度器发送时的错误
+		errno = cork->err;
+		cork->err = 0;
+		return -1;
+	}
+
+	int pending = cork->len > cork->off;
+	uint64_t now = cork->max_usecs || !pending ? coroutine_usec_now() : 0;
+	int aged = pending && cork->max_usecs && now - cork->since >= cork->max_usecs;
+
+	if (!aged && (cork->len - cork->off) + count <= cork->max_bytes && hook_cork_reserve(cork, count) == 0) {
+		memcpy(cork->buf + cork->len, buf, count);
+		cork->len += count;
+		if (!pending) cork->since = now;
+		if (!cork->blocked) schedule_cork_dirty(sched, cork);
+		return count;
+	}
+
+	return hook_cork_send(sched, cork, fd, buf, count);
+}
+
+
+// 其他写入方式之前在协程中发出缓冲的数据
+static int hook_cork_drain(int fd) {
+
+	coroutine_cork_buf *cork = hook_cork(fd);
+	if (cork == NULL) return 0;
+
+	if (cork->err) {
+		errno = cork->err;
+		cork->err = 0;
+		return -1;
+	}
+	if (cork->len == cork->off || coroutine_get_sched()->curr_thread == NULL) return 0;
+
+	return hook_cork_send(coroutine_get_sched(), cork, fd, NULL, 0) < 0 ? -1 : 0;
+}
+
+
+/* 关闭写合并：发出缓冲的数据后释放缓冲区。在协程中等待发完，否则尽量发送。
+   总是释放缓冲区；没有发完（出错、超时或被取消）时丢弃剩余的数据，返回 -1 */
+static int hook_cork_release(schedule *sched, int fd) {
+
+	if (fd < 0 || fd >= sched->fds_size || sched->fds[fd].cork == NULL) return 0;
+
+	int ret = 0;
+	if (sched->curr_thread != NULL) {
+		ret = hook_cork_drain(fd);
+	} else {
+		hook_cork_push(sched, sched->fds[fd].cork);
+	}
+
+	coroutine_cork_buf *cork = sched->fds[fd].cork; // 等待期间状态表可能扩容
+	int err = errno;
+	hook_cork_undirty(cork);
+	sched->fds[fd].cork = NULL;
+	sched->nfds_pinned --;
+	free(cork->buf);
+	free(cork);
+
+	errno = err;
+	return ret;
+}
+
+
+/* 打开或调整 fd 的写合并（见上）。max_bytes 为缓冲的上限，max_usecs 为最早的数据最多等待的微秒数（0 只在每轮结束时发出）。
+   max_bytes 为 0 时关闭，先发出缓冲的数据。只能在协程中调用，不支持普通文件 */
+int coroutine_cork(int fd, size_t max_bytes, uint32_t max_usecs) {
+
+	schedule *sched = hook_coroutine_sched();
+	if (sched == NULL) {
+		errno = EPERM;
+		return -1;
+	}
+	if (fd < 0 || fcntl_f(fd, F_GETFD) == -1) {
+		errno = EBADF;
+		return -1;
+	}
+	if (hook_fd_flags(fd) & COROUTINE_FD_REGULAR) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (max_bytes == 0) return hook_cork_release(sched, fd);
+
+	coroutine_fd *cfd = schedule_fd(sched, fd);
+	if (cfd->cork == NULL) {
+		cfd->cork = calloc(1, sizeof(coroutine_cork_buf));
+		if (cfd->cork == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		cfd->cork->fd = fd;
+		sched->nfds_pinned ++;
+	}
+	cfd->cork->max_bytes = max_bytes;
+	cfd->cork->max_usecs = max_usecs;
+
+	return 0;
+}
+
+
+// fd 将要被关闭（close，或 dup2 覆盖）：等待者以 EBADF 醒来，取消 io_uring 中的操作，移除 epoll 登记，清空 fd 状态
+static void hook_forget_fd(int fd) {
+
+	coroutine_sched_key_init(); // close 可能在任何协程相关代码之前被调用，先保证键已创建
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL) return ;
+
+	hook_cork_release(sched, fd); // 发出写合并缓冲区中的数据
+	schedule_wake_closed(sched, fd);
+	if (fd >= 0 && fd < sched->fds_size && sched->fds[fd].zc != NULL) { // 关闭后收不到零拷贝完成通知，等待者已经以 EBADF 醒来
+		free(sched->fds[fd].zc);
+		sched->fds[fd].zc = NULL;
+		sched->nfds_pinned --;
+	}
+	schedule_uring_cancel_fd(sched, fd); // 取消 io_uring 中该 fd 上未完成的操作
+	epoller_forget(sched, fd); // 移除持久登记，避免 fd 复用后沿用旧的状态
+}
+
+
+
+
+/* 覆盖原系统调用 */
+
+
+int socket(int domain, int type, int protocol) {
+
+	int fd = socket_f(domain, type, protocol);
+	if (fd == -1) {
+		printf("Failed to create a new socket\n");
+		return -1;
+	}
+	int ret = fcntl_f(fd, F_SETFL, O_NONBLOCK); // 默认将所有套接字文件描述符设置为非阻塞模式
+	if (ret == -1) {
+		close(ret);
+		return -1;
+	}
+	hook_mark_nonblock(fd, type & SOCK_NONBLOCK);
+
+	int reuse = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse, sizeof(reuse)); // 设置套接字选项 SO_REUSEADDR，允许在套接字关闭后立即重用之前使用的地址
+	
+	return fd;
+}
+
+
+// 记录 SO_RCVTIMEO / SO_SNDTIMEO：hook 的套接字是非阻塞的，内核的超时不起作用，由 hook 在等待时换算成调度器的定时器
+int setsockopt(int fd, int level, int optname, const void *optval, socklen_t optlen) {
+
+	int ret = setsockopt_f(fd, level, optname, optval, optlen); // 内核照常保存，getsockopt 直接读到
+	if (ret != 0 || level != SOL_SOCKET || (optname != SO_RCVTIMEO && optname != SO_SNDTIMEO) ||
+		optlen < sizeof(struct timeval)) {
+		return ret;
+	}
+
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL) return ret; // 还没有调度器，第一次用到时查询
+
+	coroutine_fd *cfd = schedule_fd(sched, fd);
+	uint32_t msecs = hook_timeval_msecs((const struct timeval *)optval);
+	if (optname == SO_RCVTIMEO) {
+		cfd->rcvtimeo = msecs;
+	} else {
+		cfd->sndtimeo = msecs;
+	}
+
+	return ret;
+}
+
+
+
+ssize_t read(int fd, void *buf, size_t count) { // 上下文切换实现非阻塞read
+
+	if (hook_passthrough(fd)) return read_f(fd, buf, count);
+
+	struct pollfd fds;
+	fds.fd = fd;
+	fds.events = POLLIN | POLLERR | POLLHUP;
+	int timeout = hook_fd_timeout(fd, 0); // SO_RCVTIMEO，-1 不超时
+	uint64_t expire = hook_expire(timeout);
+
+	if (hook_user_nonblock(fd)) return read_f(fd, buf, count); // 用户要求非阻塞，不等待
+
+	int ret = 0;
+	if (hook_uring()) { // 提交读操作，数据读好后才恢复；少数情况下内核返回 EAGAIN，等到可读再提交
+		while ((ret = coroutine_uring_read(fd, buf, count)) < 0 && errno == EAGAIN) {
+			if (hook_poll(&fds, expire) < 0) return -1;
+		}
+		return ret;
+	}
+
+	if (hook_regular(fd)) { // 普通文件在线程池中读
+		return hook_regular_rw(fd, buf, count, 0);
+	}
+
+	if (!hook_nonblock(fd)) { // fd 是阻塞的，必须等到可读再读，否则 read_f 会阻塞整个线程
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+
+	while (1) { // 先直接读，缓冲区里没有数据（EAGAIN）时才将当前fd交由epoll管理并让出cpu，等待fd就绪后由调度器返回到这里再读
+		ret = read_f(fd, buf, count);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) break;
+
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+
+	if (ret < 0) {
+		
+		if (errno == ECONNRESET) return -1;
+	}
+
+	return ret;
+}
+
+
+
+ssize_t recv(int fd, void *buf, size_t len, int flags) { // 上下文切换实现非阻塞recv
+
+	if (hook_passthrough(fd)) return recv_f(fd, buf, len, flags);
+
+	struct pollfd fds;
+	fds.fd = fd;
+	fds.events = POLLIN | POLLERR | POLLHUP;
+	int timeout = hook_fd_timeout(fd, 0); // SO_RCVTIMEO，-1 不超时
+	uint64_t expire = hook_expire(timeout);
+
+	if (hook_user_nonblock(fd)) return recv_f(fd, buf, len, flags); // 用户要求非阻塞，不等待
+
+	int ret = 0;
+	if (hook_uring() && (flags & MSG_DONTWAIT) == 0) {
+		while ((ret = coroutine_uring_recv(fd, buf, len, flags)) < 0 && errno == EAGAIN) {
+			if (hook_poll(&fds, expire) < 0) return -1;
+		}
+		return ret;
+	}
+
+	if (!hook_nonblock(fd)) {
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+
+	while (1) { // 先直接接收，EAGAIN 时才让出cpu等待fd可读
+		ret = recv_f(fd, buf, len, flags);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) break;
+
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+
+	if (ret < 0) {
+
+		if (errno == ECONNRESET) return -1;
+		
+	}
+
+	return ret;
+}
+
+
+
+ssize_t recvfrom(int fd, void *buf, size_t len, int flags,
+                struct sockaddr *src_addr, socklen_t *addrlen) {
+
+	if (hook_passthrough(fd)) return recvfrom_f(fd, buf, len, flags, src_addr, addrlen);
+
+	struct pollfd fds;
+	fds.fd = fd;
+	fds.events = POLLIN | POLLERR | POLLHUP;
+	int timeout = hook_fd_timeout(fd, 0); // SO_RCVTIMEO，-1 不超时
+	uint64_t expire = hook_expire(timeout);
+
+	if (hook_user_nonblock(fd)) return recvfrom_f(fd, buf, len, flags, src_addr, addrlen); // 用户要求非阻塞，不等待
+
+	if (!hook_nonblock(fd) && (flags & MSG_DONTWAIT) == 0) {
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+
+	int ret = 0;
+	while (1) { // 先直接接收，EAGAIN 时才让出cpu等待fd可读
+		ret = recvfrom_f(fd, buf, len, flags, src_addr, addrlen);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || (flags & MSG_DONTWAIT)) break;
+
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+
+	return ret; // 出错时照常返回 -1 和 errno（如 UDP 收到 ICMP 端口不可达后的 ECONNREFUSED）
+}
+
+
+
+ssize_t write(int fd, const void *buf, size_t count) {
+
+	size_t sent = 0; // 已写入字节数
+	ssize_t ret = 0;
+	int timeout = hook_fd_timeout(fd, 1); // SO_SNDTIMEO，-1 不超时
+	uint64_t expire = hook_expire(timeout);
+
+	coroutine_cork_buf *cork = hook_cork(fd);
+	if (cork != NULL && coroutine_get_sched()->curr_thread != NULL) { // 写合并
+		return hook_cork_write(cork, fd, buf, count);
+	}
+
+	if (hook_passthrough(fd)) return write_f(fd, buf, count);
+
+	if (hook_user_nonblock(fd)) return write_f(fd, buf, count); // 用户要求非阻塞，不等待
+
+	if (hook_uring()) { // 提交写操作，没写完继续提交剩余部分
+		struct pollfd fds;
+		fds.fd = fd;
+		fds.events = POLLOUT | POLLERR | POLLHUP;
+
+		while (sent < count) {
+			ret = coroutine_uring_write(fd, ((char*)buf)+sent, count-sent);
+			if (ret < 0 && errno == EAGAIN) {
+				if (hook_poll(&fds, expire) < 0) {
+					ret = -1; // 超时、被取消或超过截止时间
+					break;
+				}
+				continue;
+			}
+			if (ret <= 0) break;
+			sent += ret;
+		}
+		if (ret <= 0 && sent == 0) return ret;
+		return sent;
+	}
+
+	if (hook_regular(fd)) { // 普通文件在线程池中写
+		return hook_regular_rw(fd, (void *)buf, count, 1);
+	}
+
+	ret = write_f(fd, ((char*)buf)+sent, count-sent); // 先进行一次写入，不判断fd是否可写，未阻塞
+	if (ret == 0) return ret;
+	if (ret > 0) sent += ret;
+
+	while (sent < count) { // 如果第一次没有写完，等到fd可写再写入，避免阻塞
+		struct pollfd fds;
+		fds.fd = fd;
+		fds.events = POLLOUT | POLLERR | POLLHUP;
+
+		if (hook_poll(&fds, expire) < 0) { // 将当前fd交由epoll管理并让出cpu，避免阻塞，等待fd就绪后由调度器返回到这里继续执行
+			ret = -1; // 超时、被取消或超过截止时间
+			break;
+		}
+		ret = write_f(fd, ((char*)buf)+sent, count-sent);
+		if (ret <= 0) {			
+			break;
+		}
+		sent += ret;
+	}
+
+	if (ret <= 0 && sent == 0) return ret; // 写入失败
+	
+	return sent;
+}
+
+
+
+ssize_t send(int fd, const void *buf, size_t len, int flags) {
+
+	size_t sent = 0; // 已发送字节数
+	ssize_t ret = 0;
+	int timeout = hook_fd_timeout(fd, 1); // SO_SNDTIMEO，-1 不超时
+	uint64_t expire = hook_expire(timeout);
+
+	coroutine_cork_buf *cork = hook_cork(fd);
+	if (cork != NULL && coroutine_get_sched()->curr_thread != NULL) { // 写合并；带其他 flags 时先发出缓冲的数据
+		if ((flags & ~MSG_NOSIGNAL) == 0) return hook_cork_write(cork, fd, buf, len);
+		if (hook_cork_drain(fd) < 0) return -1;
+	}
+
+	if (hook_passthrough(fd)) return send_f(fd, buf, len, flags);
+
+	if (hook_user_nonblock(fd)) return send_f(fd, buf, len, flags); // 用户要求非阻塞，不等待
+
+	if (hook_uring() && (flags & MSG_DONTWAIT) == 0) { // 提交发送操作，没发完继续提交剩余部分
+		struct pollfd fds;
+		fds.fd = fd;
+		fds.events = POLLOUT | POLLERR | POLLHUP;
+
+		while (sent < len) {
+			ret = coroutine_uring_send(fd, ((char*)buf)+sent, len-sent, flags);
+			if (ret < 0 && errno == EAGAIN) {
+				if (hook_poll(&fds, expire) < 0) {
+					ret = -1; // 超时、被取消或超过截止时间
+					break;
+				}
+				continue;
+			}
+			if (ret <= 0) break;
+			sent += ret;
+		}
+		if (ret <= 0 && sent == 0) return ret;
+		return sent;
+	}
+
+	ret = send_f(fd, ((char*)buf)+sent, len-sent, flags); // 先进行一次发送，不判断fd是否可写，未阻塞
+	if (ret == 0) return ret;
+	if (ret > 0) sent += ret;
+
+	while (sent < len) { // 如果第一次没有发送完，等到fd可写再发送，避免阻塞
+		struct pollfd fds;
+		fds.fd = fd;
+		fds.events = POLLOUT | POLLERR | POLLHUP;
+
+		if (hook_poll(&fds, expire) < 0) { // 将当前fd交由epoll管理并让出cpu，避免阻塞，等待fd就绪后由调度器返回到这里继续执行
+			ret = -1; // 超时、被取消或超过截止时间
+			break;
+		}
+		ret = send_f(fd, ((char*)buf)+sent, len-sent, flags);
+		
+		if (ret <= 0) {			
+			break;
+		}
+		sent += ret;
+	}
+
+	if (ret <= 0 && sent == 0) return ret; // send失败
+	
+	return sent;
+}
+
+
+
+ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
+            const struct sockaddr *dest_addr, socklen_t addrlen) {
+
+	struct pollfd fds;
+	fds.fd = sockfd;
+	fds.events = POLLOUT | POLLERR | POLLHUP;
+	int timeout = hook_fd_timeout(sockfd, 1); // SO_SNDTIMEO，-1 不超时
+	uint64_t expire = hook_expire(timeout);
+
+	if (hook_cork_drain(sockfd) < 0) return -1; // 先发出写合并缓冲区中的数据
+
+	if (hook_passthrough(sockfd)) return sendto_f(sockfd, buf, len, flags, dest_addr, addrlen);
+
+	if (hook_user_nonblock(sockfd)) return sendto_f(sockfd, buf, len, flags, dest_addr, addrlen); // 用户要求非阻塞，不等待
+
+	if (!hook_nonblock(sockfd) && (flags & MSG_DONTWAIT) == 0) {
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+
+	int ret = 0;
+	while (1) { // 先直接发送，发送缓冲区满（EAGAIN）时才让出cpu等待fd可写
+		ret = sendto_f(sockfd, buf, len, flags, dest_addr, addrlen);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || (flags & MSG_DONTWAIT)) break;
+
+		if (hook_poll(&fds, expire) < 0) return -1; // 将当前fd交由epoll管理并让出cpu，避免阻塞，等待fd就绪后由调度器返回到这里继续执行
+	}
+
+	return ret; // 出错时照常返回 -1 和 errno
+}
+
+
+
+/* accept 与 accept4 共用。flags 为 accept4 的 SOCK_NONBLOCK / SOCK_CLOEXEC：新套接字总是被设置为非阻塞，
+   SOCK_NONBLOCK 只决定之后的读写是否由 hook 等待 */
+static int hook_accept(int fd, struct sockaddr *addr, socklen_t *len, int flags) {
+
+	if (hook_passthrough(fd)) return accept4_f(fd, addr, len, flags);
+
+	int sockfd = -1; // 初始化
+	int timeout = hook_fd_timeout(fd, 0); // SO_RCVTIMEO，-1 不超时（协程的截止时间仍然有效）
+	uint64_t expire = hook_expire(timeout);
+
+	if (hook_user_nonblock(fd)) { // 监听套接字是用户设置的非阻塞，不等待
+		sockfd = accept4_f(fd, addr, len, flags & SOCK_CLOEXEC);
+		if (sockfd < 0) return -1;
+	}
+
+	while (sockfd < 0 && hook_uring()) { // 提交 accept 操作，有连接到来后才恢复
+		sockfd = coroutine_uring_accept(fd, addr, len);
+		if (sockfd >= 0) {
+			if (flags & SOCK_CLOEXEC) fcntl_f(sockfd, F_SETFD, FD_CLOEXEC);
+			break;
+		}
+		if (errno != EAGAIN) return -1;
+
+		struct pollfd fds;
+		fds.fd = fd;
+		fds.events = POLLIN | POLLERR | POLLHUP;
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+
+	while (sockfd < 0) { // 轮询接受连接
+		struct pollfd fds;
+		fds.fd = fd;
+		fds.events = POLLIN | POLLERR | POLLHUP;
+		if (hook_poll(&fds, expire) < 0) return -1; // 将当前fd交由epoll管理并让出cpu，避免阻塞，等待fd就绪后由调度器返回到这里继续执行
+
+		sockfd = accept4_f(fd, addr, len, flags & SOCK_CLOEXEC);
+		if (sockfd < 0) {
+			if (errno == EAGAIN) {
+				continue;
+			} else if (errno == ECONNABORTED) {
+				printf("accept : ECONNABORTED\n");
+				
+			} else if (errno == EMFILE || errno == ENFILE) {
+				printf("accept : EMFILE || ENFILE\n");
+			}
+			return -1;
+		} else {
+			break;
+		}
+	}
+
+	int ret = fcntl_f(sockfd, F_SETFL, O_NONBLOCK); // 默认设置套接字描述符为非阻塞模式
+	if (ret == -1) {
+		close(sockfd);
+		return -1;
+	}
+	hook_mark_nonblock(sockfd, flags & SOCK_NONBLOCK);
+	hook_inherit_timeouts(fd, sockfd);
+	int reuse = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse, sizeof(reuse)); // 设置套接字选项 SO_REUSEADDR，允许在套接字关闭后立即重用之前使用的地址
+	
+	return sockfd;
+}
+
+
+int accept(int fd, struct sockaddr *addr, socklen_t *len) {
+	return hook_accept(fd, addr, len, 0);
+}
+
+
+int accept4(int fd, struct sockaddr *addr, socklen_t *len, int flags) {
+	return hook_accept(fd, addr, len, flags);
+}
+
+
+
+int connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+
+	int ret = 0;
+	int timeout = hook_fd_timeout(fd, 1); // SO_SNDTIMEO，超时返回 EINPROGRESS（与内核一致）
+	uint64_t expire = hook_expire(timeout);
+
+	if (hook_passthrough(fd)) return connect_f(fd, addr, addrlen);
+
+	if (hook_user_nonblock(fd)) return connect_f(fd, addr, addrlen); // 用户要求非阻塞，返回 EINPROGRESS 由用户自己等待
+
+	if (hook_uring()) { // 提交 connect 操作，连接建立（或失败）后才恢复
+		ret = coroutine_uring_connect(fd, addr, addrlen);
+		if (ret < 0 && errno == EAGAIN) errno = EINPROGRESS;
+		return ret;
+	}
+
+	while (1) {
+
+		struct pollfd fds;
+		fds.fd = fd;
+		fds.events = POLLOUT | POLLERR | POLLHUP;
+		if (hook_poll(&fds, expire) < 0) { // 加入epoll管理，让出cpu
+			if (errno == EAGAIN) errno = EINPROGRESS;
+			return -1;
+		}
+
+		ret = connect_f(fd, addr, addrlen);
+		if (ret == 0) break;
+
+		if (ret == -1 && (errno == EAGAIN ||
+			errno == EWOULDBLOCK || 
+			errno == EINPROGRESS)) {
+			continue;
+		} else {
+			break;
+		}
+	}
+
+	return ret;
+}
+
+
+
+
+
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+
+	if (hook_coroutine_sched() == NULL || hook_user_nonblock(fd)) {
+		return readv_f(fd, iov, iovcnt);
+	}
+	if (hook_regular(fd)) { // 普通文件在线程池中逐段读
+		return hook_regular_rwv(fd, iov, iovcnt, 0);
+	}
+
+	return hook_recvv(fd, iov, iovcnt, NULL, 0);
+}
+
+
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+
+	if (hook_coroutine_sched() == NULL) {
+		return writev_f(fd, iov, iovcnt);
+	}
+	if (hook_cork_drain(fd) < 0) return -1; // 先发出写合并缓冲区中的数据
+	if (hook_user_nonblock(fd)) {
+		return writev_f(fd, iov, iovcnt);
+	}
+	if (hook_regular(fd)) { // 普通文件在线程池中逐段写
+		return hook_regular_rwv(fd, iov, iovcnt, 1);
+	}
+
+	return hook_sendv(fd, iov, iovcnt, NULL, 0);
+}
+
+
+
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags) {
+
+	if (hook_coroutine_sched() == NULL || hook_user_nonblock(fd) || (flags & MSG_DONTWAIT)) {
+		return recvmsg_f(fd, msg, flags);
+	}
+
+	return hook_recvv(fd, NULL, 0, msg, flags);
+}
+
+
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+
+	if (hook_coroutine_sched() == NULL) {
+		return sendmsg_f(fd, msg, flags);
+	}
+	if (hook_cork_drain(fd) < 0) return -1; // 先发出写合并缓冲区中的数据
+	if (hook_user_nonblock(fd) || (flags & MSG_DONTWAIT)) {
+		return sendmsg_f(fd, msg, flags);
+	}
+
+	return hook_sendv(fd, msg->msg_iov, msg->msg_iovlen, msg, flags);
+}
+
+
+
+/*
+ * 批量收发数据报：一次 recvmmsg / sendmmsg 系统调用处理多个数据报，只在接收队列取空（或发送缓冲区满）时才让出cpu，
+ * 高包率的 UDP 服务每个数据报分摊的系统调用和协程切换接近于 0。
+ * timeout_ms 为负时使用 fd 上的 SO_RCVTIMEO / SO_SNDTIMEO（没有设置则不超时），超时返回 -1，errno 为 EAGAIN；
+ * 被取消或超过截止时间返回 -1（ECANCELED / ETIMEDOUT）。flags 带 MSG_DONTWAIT 时不等待
+ */
+
+static uint64_t hook_batch_expire(int fd, int64_t timeout_ms, int is_write) {
+
+	int timeout = timeout_ms >= 0 ? (int)(timeout_ms > INT_MAX ? INT_MAX : timeout_ms) : hook_fd_timeout(fd, is_write);
+
+	return hook_expire(timeout);
+}
+
+
+/* 接收队列中有数据报时立即取走（最多 vlen 个）并返回个数，队列为空时等待第一个数据报到来，
+   相当于带 MSG_WAITFORONE 的 recvmmsg。每个数据报的长度在 msgs[i].msg_len 中 */
+int coroutine_recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags, int64_t timeout_ms) {
+
+	if (hook_coroutine_sched() == NULL) {
+		return recvmmsg_f(fd, msgs, vlen, flags | MSG_WAITFORONE, NULL);
+	}
+
+	struct pollfd fds;
+	fds.fd = fd;
+	fds.events = POLLIN | POLLERR | POLLHUP;
+	uint64_t expire = hook_batch_expire(fd, timeout_ms, 0);
+
+	while (1) { // 先直接接收，队列为空（EAGAIN）才让出cpu；MSG_DONTWAIT 下内核取到队列为空为止，不会等满 vlen 个
+		int ret = recvmmsg_f(fd, msgs, vlen, flags | MSG_DONTWAIT, NULL);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || (flags & MSG_DONTWAIT)) return ret;
+
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+}
+
+
+/* 发送 vlen 个数据报，发送缓冲区满时等待可写后继续发送剩余的，返回已发送的个数；
+   一个都没发出时返回 -1。中途出错（超时、被取消等）时返回已发送的个数，错误留给下一次调用 */
+int coroutine_sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags, int64_t timeout_ms) {
+
+	if (hook_coroutine_sched() == NULL) {
+		return sendmmsg_f(fd, msgs, vlen, flags);
+	}
+	if (hook_cork_drain(fd) < 0) return -1; // 先发出写合并缓冲区中的数据
+
+	struct pollfd fds;
+	fds.fd = fd;
+	fds.events = POLLOUT | POLLERR | POLLHUP;
+	uint64_t expire = hook_batch_expire(fd, timeout_ms, 1);
+
+	unsigned int sent = 0;
+	int ret = 0;
+	while (sent < vlen) {
+		ret = sendmmsg_f(fd, msgs + sent, vlen - sent, flags | MSG_DONTWAIT);
+		if (ret > 0) {
+			sent += ret;
+			continue;
+		}
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && (flags & MSG_DONTWAIT) == 0) {
+			if (hook_poll(&fds, expire) < 0) { // 超时、被取消或超过截止时间
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+		break;
+	}
+
+	if (sent > 0) return sent;
+	return ret;
+}
+
+
+
+/* 阻塞语义与内核一致：带 MSG_WAITFORONE 时收到一个数据报就返回，否则等到收满 vlen 个或 timeout 到期。
+   与内核不同的是 timeout 也限制等待第一个数据报的时间（内核只在收到数据报后检查），返回前写回剩余时间 */
+int recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags, struct timespec *timeout) {
+
+	if (hook_coroutine_sched() == NULL || hook_user_nonblock(fd) || (flags & MSG_DONTWAIT)) {
+		return recvmmsg_f(fd, msgs, vlen, flags, timeout);
+	}
+
+	uint64_t expire = 0;
+	if (timeout != NULL) {
+		expire = coroutine_usec_now() + (uint64_t)timeout->tv_sec * 1000000u + timeout->tv_nsec / 1000;
+	}
+
+	unsigned int got = 0;
+	while (got < vlen) {
+		int64_t left_ms = -1; // 没有 timeout 时使用 SO_RCVTIMEO
+		if (expire != 0) {
+			uint64_t now = coroutine_usec_now();
+			left_ms = now < expire ? (int64_t)((expire - now + 999) / 1000) : 0;
+		}
+
+		int ret = coroutine_recvmmsg(fd, msgs + got, vlen - got, flags & ~MSG_WAITFORONE, left_ms);
+		if (ret <= 0) {
+			if (got > 0) break; // 已经收到的先返回，错误留给下一次调用
+			return ret;
+		}
+		got += ret;
+
+		if (flags & MSG_WAITFORONE) break;
+		if (expire != 0 && coroutine_usec_now() >= expire) break;
+	}
+
+	if (timeout != NULL) {
+		uint64_t now = coroutine_usec_now();
+		uint64_t left = now < expire ? expire - now : 0;
+		timeout->tv_sec = left / 1000000;
+		timeout->tv_nsec = (left % 1000000) * 1000;
+	}
+
+	return got;
+}
+
+
+
+int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags) {
+
+	if (hook_coroutine_sched() == NULL) {
+		return sendmmsg_f(fd, msgs, vlen, flags);
+	}
+	if (hook_user_nonblock(fd) || (flags & MSG_DONTWAIT)) {
+		if (hook_cork_drain(fd) < 0) return -1;
+		return sendmmsg_f(fd, msgs, vlen, flags);
+	}
+
+	return coroutine_sendmmsg(fd, msgs, vlen, flags, -1);
+}
+
+
+
+/* UDP GSO（Linux 4.18+）：之后每次发送的一大块数据由内核（或网卡）按 size 字节切成多个数据报，
+   一次 send 最多发出 64 个数据报，接收方看到的是普通的数据报。size 为 0 关闭。内核不支持时返回 -1，调用者退回 sendmmsg */
+int coroutine_udp_gso(int fd, int size) {
+	return setsockopt_f(fd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size));
+}
+
+
+/* UDP GRO（Linux 5.0+）：同一个流的连续数据报在接收时合并成一个大数据报，一次 recvmsg 取回多个。
+   合并后每段的长度通过 UDP_GRO 控制消息给出，用 coroutine_udp_gro_size 取得；内核不支持时返回 -1 */
+int coroutine_udp_gro(int fd, int on) {
+	return setsockopt_f(fd, SOL_UDP, UDP_GRO, &on, sizeof(on));
+}
+
+
+// 从 recvmsg 的控制消息中取出 GRO 合并时每段的长度（最后一段可以更短），没有合并时返回 0，整个数据报就是一个
+int coroutine_udp_gro_size(const struct msghdr *msg) {
+
+	struct cmsghdr *cmsg = NULL;
+	for (cmsg = CMSG_FIRSTHDR(msg);cmsg != NULL;cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+			int size = 0;
+			memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+			return size;
+		}
+	}
+	return 0;
+}
+
+
+
+
+/*
+ * 零拷贝发送（MSG_ZEROCOPY，Linux 4.14+）：内核直接引用用户缓冲区的页面，不再把数据复制进套接字缓冲区，
+ * 数据不再需要（TCP 为对端确认）时在套接字的错误队列中放一条完成通知，之前缓冲区不能修改或释放。
+ * 内核按每次成功的零拷贝发送从 0 编号，通知给出一段已完成的编号；调度器在 fd 报告 EPOLLERR 时取走通知（schedule_zerocopy_reap），
+ * 记录到 fd 的 coroutine_zerocopy 中，等待的协程在它的 ticket 之前的发送都完成时被唤醒。
+ * 错误队列中的其他消息（IP_RECVERR、时间戳）会被一起取走丢弃，使用零拷贝的套接字不要同时依赖它们；dup 出的 fd 不共享状态
+ */
+
+static coroutine_zerocopy *hook_zerocopy(schedule *sched, int fd) {
+
+	coroutine_fd *cfd = schedule_fd(sched, fd);
+	if (cfd->zc == NULL) {
+		cfd->zc = calloc(1, sizeof(coroutine_zerocopy));
+		if (cfd->zc == NULL) return NULL;
+		sched->nfds_pinned ++;
+
+		int on = 1;
+		if (setsockopt_f(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) != 0) { // 内核太旧，或不是 TCP / UDP 套接字
+			cfd->zc->unsupported = 1;
+		}
+	}
+	return cfd->zc;
+}
+
+
+// 把编号 [lo, hi] 记为已完成，done 推进到第一个未完成的编号。未完成的发送不超过 CO_ZEROCOPY_INFLIGHT 次，编号都在位图的范围内
+static void hook_zerocopy_complete(coroutine_zerocopy *zc, uint32_t lo, uint32_t hi) {
+
+	int32_t first = (int32_t)(lo - zc->done), last = (int32_t)(hi - zc->done);
+	if (last < 0) return ; // 已经记过的
+	if (first < 0) first = 0;
+	if (last > 63) last = 63;
+
+	int32_t i = 0;
+	for (i = first;i <= last;i ++) {
+		zc->completed |= 1ull << i;
+	}
+	while (zc->completed & 1) {
+		zc->completed >>= 1;
+		zc->done ++;
+	}
+}
+
+
+// 取出错误队列中的全部消息，返回其中零拷贝完成通知的条数
+static int hook_zerocopy_drain(coroutine_zerocopy *zc, int fd) {
+
+	int n = 0;
+	while (1) {
+		char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg_f(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break; // EAGAIN：取完了
+
+		struct cmsghdr *cmsg = NULL;
+		for (cmsg = CMSG_FIRSTHDR(&msg);cmsg != NULL;cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+				!(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) continue;
+
+			struct sock_extended_err ee;
+			memcpy(&ee, CMSG_DATA(cmsg), sizeof(ee));
+			if (ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee.ee_errno != 0) continue;
+
+			if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) zc->copied = 1; // 内核还是复制了，零拷贝在这条路径上没有收益
+			hook_zerocopy_complete(zc, ee.ee_info, ee.ee_data);
+			n ++;
+		}
+	}
+	return n;
+}
+
+
+// 通知在协程中被取走时，等待者等不到 EPOLLERR，已经完成的直接放入就绪队列
+static void hook_zerocopy_wake(schedule *sched, coroutine_zerocopy *zc) {
+
+	coroutine *waiter = zc->waiter;
+	if (waiter == NULL || !coroutine_zerocopy_reached(zc, zc->wait_ticket)) return ;
+
+	schedule_desched_wait(waiter, waiter->fd);
+	TAILQ_INSERT_TAIL(&sched->ready, waiter, ready_next);
+}
+
+
+// 调度器在有零拷贝状态的 fd 上收到 EPOLLERR 时调用：取走完成通知。套接字本身没有错误时去掉 EPOLLERR，不唤醒等待读写的协程
+uint32_t schedule_zerocopy_reap(schedule *sched, int fd, uint32_t events) {
+
+	if (hook_zerocopy_drain(sched->fds[fd].zc, fd) == 0) return events;
+
+	struct pollfd fds;
+	fds.fd = fd;
+	fds.events = 0;
+	fds.revents = 0;
+	if (poll_f(&fds, 1, 0) >= 0 && !(fds.revents & POLLERR)) {
+		events &= ~EPOLLERR;
+	}
+	return events;
+}
+
+
+/* 在协程中等待 fd 上 ticket 之前的零拷贝发送全部完成，成功返回 0。timeout_ms 为负时使用 SO_SNDTIMEO（没有设置则不超时），
+   超时返回 -1（EAGAIN）；被取消、超过截止时间、fd 被关闭返回 -1（ECANCELED / ETIMEDOUT / EBADF）；连接出错时返回 -1 和套接字的错误。
+   失败时缓冲区可能仍被内核引用 */
+int coroutine_zerocopy_wait(int fd, uint32_t ticket, int64_t timeout_ms) {
+
+	schedule *sched = hook_coroutine_sched();
+	if (sched == NULL) {
+		errno = EPERM;
+		return -1;
+	}
+	if (fd < 0 || fd >= sched->fds_size || sched->fds[fd].zc == NULL) return 0; // 没有零拷贝发送过
+
+	coroutine *co = sched->curr_thread;
+	coroutine_zerocopy *zc = sched->fds[fd].zc; // fd 被关闭时释放，等待者以 EBADF 醒来后不再访问
+	uint64_t expire = hook_batch_expire(fd, timeout_ms, 1);
+
+	hook_zerocopy_drain(zc, fd); // 通知可能已经在错误队列中，调度器只在有协程等待时才收取
+	hook_zerocopy_wake(sched, zc);
+
+	while (!coroutine_zerocopy_reached(zc, ticket)) {
+		if (schedule_interrupted(co) < 0) return -1;
+
+		int64_t limit = -1;
+		if (expire != 0) {
+			uint64_t now = coroutine_usec_now();
+			if (now >= expire) {
+				errno = EAGAIN;
+				return -1;
+			}
+			limit = (int64_t)(expire - now + 999) / 1000;
+		}
+		int64_t wait_ms = schedule_deadline_msecs(co, limit);
+
+		co->revents = 0;
+		zc->wait_ticket = ticket;
+		schedule_sched_wait_zerocopy(co, fd);
+		if (wait_ms >= 0) {
+			schedule_sched_sleepdown(co, wait_ms); // 超时由定时器恢复
+		}
+		coroutine_yield(co);
+
+		int expired = co->status & BIT(COROUTINE_STATUS_EXPIRED);
+		schedule_desched_wait(co, fd);
+		co->status &= CLEARBIT(COROUTINE_STATUS_EXPIRED);
+		co->status &= CLEARBIT(COROUTINE_STATUS_FDEOF);
+
+		if (co->status & BIT(COROUTINE_STATUS_FDCLOSED)) {
+			co->status &= CLEARBIT(COROUTINE_STATUS_FDCLOSED);
+			errno = EBADF;
+			return -1;
+		}
+		if (co->status & BIT(COROUTINE_STATUS_CANCELLED)) {
+			errno = ECANCELED;
+			return -1;
+		}
+		if (expired) {
+			errno = wait_ms != limit ? ETIMEDOUT : EAGAIN; // 由截止时间缩短的等待
+			return -1;
+		}
+		if (!coroutine_zerocopy_reached(zc, ticket) && (co->revents & (EPOLLERR | EPOLLHUP))) { // 连接出错，通知可能不会再来
+			int err = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+			errno = err != 0 ? err : EPIPE;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+// 不等待：取走已经到达的通知，ticket 之前的发送都已完成时返回 1，否则返回 0
+int coroutine_zerocopy_done(int fd, uint32_t ticket) {
+
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || fd < 0 || fd >= sched->fds_size || sched->fds[fd].zc == NULL) return 1;
+
+	coroutine_zerocopy *zc = sched->fds[fd].zc;
+	if (!coroutine_zerocopy_reached(zc, ticket)) {
+		hook_zerocopy_drain(zc, fd);
+		if (sched->curr_thread != NULL) hook_zerocopy_wake(sched, zc);
+	}
+	return coroutine_zerocopy_reached(zc, ticket);
+}
+
+
+/* 零拷贝发送 buf 的全部数据，发送缓冲区满时等待可写（与 hook 的 send 一样按 SO_SNDTIMEO 超时）。
+   ticket 为 NULL 时还要等到完成通知，返回后缓冲区可以立即重用；否则在 *ticket 中返回编号，直接返回，
+   coroutine_zerocopy_done / coroutine_zerocopy_wait 确认之前不能修改或释放缓冲区，期间可以继续发送其他缓冲区。
+   小于 CO_ZEROCOPY_MIN、内核不支持、已经退回复制，或 buf 在共享栈上（挂起后会被其他协程覆盖，内核还在读取）时普通发送，ticket 立即完成。
+   返回已发送的字节数，一个字节都没发出时返回 -1；只能在协程中调用 */
+ssize_t coroutine_send_zerocopy(int fd, const void *buf, size_t len, int flags, uint32_t *ticket) {
+
+	schedule *sched = hook_coroutine_sched();
+	if (sched == NULL) {
+		errno = EPERM;
+		return -1;
+	}
+	if (fd < 0 || fcntl_f(fd, F_GETFD) == -1) {
+		errno = EBADF;
+		return -1;
+	}
+
+	coroutine_zerocopy *zc = hook_zerocopy(sched, fd);
+	if (zc == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (len < CO_ZEROCOPY_MIN || zc->copied || zc->unsupported || schedule_on_shared_stack(sched, buf, len)) {
+		if (ticket != NULL) *ticket = zc->done;
+		return send(fd, buf, len, flags);
+	}
+
+	if (hook_cork_drain(fd) < 0) return -1; // 先发出写合并缓冲区中的数据
+
+	struct pollfd fds;
+	fds.fd = fd;
+	fds.events = POLLOUT | POLLERR | POLLHUP;
+	uint64_t expire = hook_expire(hook_fd_timeout(fd, 1)); // SO_SNDTIMEO，-1 不超时
+
+	size_t sent = 0;
+	ssize_t ret = 0;
+	uint32_t last = zc->done;
+	while (sent < len) {
+		zc = sched->fds[fd].zc; // 等待期间 fd 可能被关闭
+		if (zc == NULL) {
+			errno = EBADF;
+			ret = -1;
+			break;
+		}
+		if (zc->next - zc->done >= CO_ZEROCOPY_INFLIGHT) { // 未完成的发送太多，等最早的一次完成
+			if (coroutine_zerocopy_wait(fd, zc->done + 1, -1) < 0) {
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+
+		ret = send_f(fd, (const char *)buf + sent, len - sent, flags | MSG_ZEROCOPY | MSG_DONTWAIT);
+		if (ret > 0) {
+			zc->next ++;
+			last = zc->next;
+			sent += ret;
+			continue;
+		}
+		if (ret < 0 && errno == ENOBUFS && zc->next != zc->done) { // 通知占用的内存（optmem）用完，等已有的发送完成
+			if (coroutine_zerocopy_wait(fd, zc->done + 1, -1) < 0) {
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (hook_poll(&fds, expire) < 0) { // 超时、被取消或超过截止时间
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+		break;
+	}
+
+	if (sent == 0) return ret < 0 ? -1 : ret;
+
+	if (ticket != NULL) {
+		*ticket = last;
+	} else if (coroutine_zerocopy_wait(fd, last, -1) < 0) { // 缓冲区还被内核引用，不能当作已经发送完成
+		return -1;
+	}
+	return sent;
+}
+
+
+
+/* sendfile：文件内容由内核直接发送到套接字（或管道），不经过用户空间。out_fd 的发送缓冲区满时让出cpu等待可写，
+   与阻塞的 sendfile 一样发送完 count 字节（或到文件末尾）才返回。读文件仍在调度器线程中进行，页缓存不命中时会阻塞在磁盘上 */
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+
+	if (hook_coroutine_sched() == NULL) {
+		return sendfile_f(out_fd, in_fd, offset, count);
+	}
+	if (hook_cork_drain(out_fd) < 0) return -1; // 先发出写合并缓冲区中的数据
+	if (hook_user_nonblock(out_fd)) {
+		return sendfile_f(out_fd, in_fd, offset, count);
+	}
+
+	struct pollfd fds;
+	fds.fd = out_fd;
+	fds.events = POLLOUT | POLLERR | POLLHUP;
+	uint64_t expire = hook_expire(hook_fd_timeout(out_fd, 1)); // SO_SNDTIMEO，-1 不超时
+
+	if (!hook_nonblock(out_fd)) {
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+
+	size_t sent = 0;
+	ssize_t ret = 0;
+	while (sent < count) {
+		ret = sendfile_f(out_fd, in_fd, offset, count - sent);
+		if (ret > 0) {
+			sent += ret;
+			continue;
+		}
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (hook_poll(&fds, expire) < 0) { // 超时、被取消或超过截止时间
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+		break; // 文件末尾或出错
+	}
+
+	if (sent > 0) return sent;
+	return ret;
+}
+
+
+
+/* splice：在管道与套接字（或文件）之间由内核搬运数据。总是带 SPLICE_F_NONBLOCK 调用，EAGAIN 时用 poll(0) 判断是哪一端没有就绪，
+   等待输入端可读或输出端可写；与阻塞的 splice 一样搬运了数据就返回。调用者自己带 SPLICE_F_NONBLOCK、或任一端是用户设置的非阻塞时不等待 */
+ssize_t splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags) {
+
+	if (hook_coroutine_sched() == NULL || (flags & SPLICE_F_NONBLOCK) ||
+		hook_user_nonblock(fd_in) || hook_user_nonblock(fd_out)) {
+		return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+	}
+	if (hook_cork_drain(fd_out) < 0) return -1;
+
+	uint64_t expire = hook_expire(hook_fd_timeout(fd_in, 0)); // 按输入端的 SO_RCVTIMEO，-1 不超时
+
+	while (1) {
+		ssize_t ret = splice_f(fd_in, off_in, fd_out, off_out, len, flags | SPLICE_F_NONBLOCK);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return ret;
+
+		struct pollfd fds;
+		fds.fd = fd_in;
+		fds.events = POLLIN;
+		fds.revents = 0;
+		if (poll_f(&fds, 1, 0) > 0) { // 输入端有数据，是输出端满了
+			fds.fd = fd_out;
+			fds.events = POLLOUT;
+		}
+		fds.events |= POLLERR | POLLHUP;
+		if (hook_poll(&fds, expire) < 0) return -1;
+	}
+}
+
+
+
+/* 在协程中 poll：已有就绪的 fd 时直接返回，否则协程同时等待所有 fd，由第一个就绪的 fd 唤醒一次，再用 poll(0) 取得所有 fd 准确的 revents
+   （唤醒它的可能是同一批 epoll 事件中已经过时的一个，这时继续等待）。nfds 为 0 时相当于睡眠。被取消或超过截止时间返回 -1（ECANCELED / ETIMEDOUT）；等待期间 fd 被关闭时由 poll 报告 POLLNVAL */
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+
+	if (timeout == 0 || hook_coroutine_sched() == NULL) {
+		return poll_f(fds, nfds, timeout);
+	}
+
+	uint64_t expire = hook_expire(timeout);
+	while (1) {
+		int ret = poll_f(fds, nfds, 0);
+		if (ret != 0) return ret;
+
+		int wait_ms = -1;
+		if (expire != 0) {
+			uint64_t now = coroutine_usec_now();
+			if (now >= expire) return 0;
+			wait_ms = (int)((expire - now + 999) / 1000);
+		}
+
+		ret = poll_inner(fds, nfds, wait_ms);
+		if (ret < 0) {
+			if (errno == EBADF) continue; // fd 被关闭，下一轮 poll(0) 报告 POLLNVAL
+			return -1;
+		}
+		if (ret == 0) return poll_f(fds, nfds, 0); // 超时，最后检查一次
+	}
+}
+
+
+
+// select 转换成 poll：fd_set 只在协程中读写，poll 数组分配在堆上
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+
+	if (hook_coroutine_sched() == NULL || nfds < 0 || nfds > FD_SETSIZE ||
+		(timeout != NULL && timeout->tv_sec == 0 && timeout->tv_usec == 0)) {
+		return select_f(nfds, readfds, writefds, exceptfds, timeout);
+	}
+
+	int msecs = -1;
+	if (timeout != NULL) {
+		uint32_t t = hook_timeval_msecs(timeout);
+		msecs = t > INT_MAX ? INT_MAX : (int)t;
+	}
+
+	struct pollfd *pfds = malloc((nfds > 0 ? nfds : 1) * sizeof(struct pollfd));
+	if (pfds == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	int fd = 0, n = 0;
+	for (fd = 0;fd < nfds;fd ++) {
+		short events = 0;
+		if (readfds != NULL && FD_ISSET(fd, readfds)) events |= POLLIN;
+		if (writefds != NULL && FD_ISSET(fd, writefds)) events |= POLLOUT;
+		if (exceptfds != NULL && FD_ISSET(fd, exceptfds)) events |= POLLPRI;
+		if (events == 0) continue;
+
+		pfds[n].fd = fd;
+		pfds[n].events = events;
+		pfds[n].revents = 0;
+		n ++;
+	}
+
+	uint64_t begin = coroutine_usec_now();
+	int ret = poll(pfds, n, msecs);
+	if (ret < 0) {
+		int err = errno;
+		free(pfds);
+		errno = err;
+		return -1;
+	}
+
+	if (readfds != NULL) FD_ZERO(readfds);
+	if (writefds != NULL) FD_ZERO(writefds);
+	if (exceptfds != NULL) FD_ZERO(exceptfds);
+
+	int i = 0;
+	ret = 0;
+	for (i = 0;i < n;i ++) {
+		short revents = pfds[i].revents;
+		if (revents & POLLNVAL) { // 与 select 一致，集合中有无效的 fd 时返回 EBADF
+			free(pfds);
+			errno = EBADF;
+			return -1;
+		}
+		if ((pfds[i].events & POLLIN) && (revents & (POLLIN | POLLHUP | POLLERR))) {
+			FD_SET(pfds[i].fd, readfds);
+			ret ++;
+		}
+		if ((pfds[i].events & POLLOUT) && (revents & (POLLOUT | POLLERR))) {
+			FD_SET(pfds[i].fd, writefds);
+			ret ++;
+		}
+		if ((pfds[i].events & POLLPRI) && (revents & POLLPRI)) {
+			FD_SET(pfds[i].fd, exceptfds);
+			ret ++;
+		}
+	}
+	free(pfds);
+
+	if (timeout != NULL) { // 与 Linux 一致，写回剩余时间
+		uint64_t elapsed = coroutine_usec_now() - begin;
+		uint64_t total = (uint64_t)timeout->tv_sec * 1000000u + timeout->tv_usec;
+		uint64_t left = elapsed < total ? total - elapsed : 0;
+		timeout->tv_sec = left / 1000000u;
+		timeout->tv_usec = left % 1000000u;
+	}
+
+	return ret;
+}
+
+
+
+/* 在协程中等待用户自己的 epoll 实例：epoll fd 本身可读表示有就绪事件，交给调度器等待它可读，再用 epoll_wait(0) 取出。
+   调度器自己的 epoll_wait 不在协程中调用，不受影响 */
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+
+	if (timeout == 0 || hook_coroutine_sched() == NULL) {
+		return epoll_wait_f(epfd, events, maxevents, timeout);
+	}
+
+	struct pollfd fds;
+	fds.fd = epfd;
+	fds.events = POLLIN;
+	uint64_t expire = hook_expire(timeout);
+
+	while (1) {
+		int ret = epoll_wait_f(epfd, events, maxevents, 0);
+		if (ret != 0) return ret;
+
+		if (hook_poll(&fds, expire) < 0) {
+			return errno == EAGAIN ? 0 : -1; // 超时返回 0
+		}
+	}
+}
+
+
+
+/* 睡眠交给调度器的定时器，不足 1 毫秒按 1 毫秒。被取消或超过截止时间时提前返回：
+   nanosleep / usleep 返回 -1，errno 为 ECANCELED / ETIMEDOUT（不用 EINTR，按 EINTR 重试的循环会一直重试下去），
+   nanosleep 在 rem 中写入剩余的时间；sleep 返回没有睡完的秒数（向上取整），errno 同上 */
+
+// 睡 usecs 微秒，返回 0，或 -1 并在 *left 中写入剩余的微秒数
+static int hook_sleep(uint64_t usecs, uint64_t *left) {
+
+	uint64_t begin = coroutine_usec_now();
+
+	*left = 0;
+	if (coroutine_sleep((usecs + 999) / 1000) == 0) return 0;
+
+	uint64_t elapsed = coroutine_usec_now() - begin;
+	*left = elapsed < usecs ? usecs - elapsed : 0;
+	return -1;
+}
+
+
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+
+	if (hook_coroutine_sched() == NULL || req == NULL || req->tv_sec < 0 ||
+		req->tv_nsec < 0 || req->tv_nsec >= 1000000000) {
+		return nanosleep_f(req, rem);
+	}
+
+	uint64_t left = 0;
+	int ret = hook_sleep((uint64_t)req->tv_sec * 1000000u + (req->tv_nsec + 999) / 1000, &left);
+	if (rem != NULL) {
+		rem->tv_sec = left / 1000000u;
+		rem->tv_nsec = (left % 1000000u) * 1000;
+	}
+	return ret;
+}
+
+
+int usleep(useconds_t usec) {
+
+	if (hook_coroutine_sched() == NULL) {
+		return usleep_f(usec);
+	}
+
+	uint64_t left = 0;
+	return hook_sleep(usec, &left);
+}
+
+
+unsigned int sleep(unsigned int seconds) {
+
+	if (hook_coroutine_sched() == NULL) {
+		return sleep_f(seconds);
+	}
+
+	uint64_t left = 0;
+	hook_sleep((uint64_t)seconds * 1000000u, &left);
+	return (unsigned int)((left + 999999) / 1000000u);
+}
+
+
+
+/* dup 出的 fd 与原 fd 共享打开的文件，复制调度器中记录的状态（非阻塞、超时）。
+   dup2 / dup3 覆盖一个打开的 fd 时，先按 close 清理被覆盖的 fd */
+int dup(int oldfd) {
+
+	int fd = dup_f(oldfd);
+	if (fd >= 0) hook_copy_fd(oldfd, fd);
+
+	return fd;
+}
+
+
+int dup2(int oldfd, int newfd) {
+
+	if (oldfd != newfd && fcntl_f(oldfd, F_GETFD) != -1) { // oldfd 无效时 dup2 失败，不会关闭 newfd
+		hook_forget_fd(newfd);
+	}
+
+	int fd = dup2_f(oldfd, newfd);
+	if (fd >= 0 && oldfd != newfd) hook_copy_fd(oldfd, fd);
+
+	return fd;
+}
+
+
+int dup3(int oldfd, int newfd, int flags) {
+
+	if (oldfd != newfd && fcntl_f(oldfd, F_GETFD) != -1) {
+		hook_forget_fd(newfd);
+	}
+
+	int fd = dup3_f(oldfd, newfd, flags);
+	if (fd >= 0) hook_copy_fd(oldfd, fd);
+
+	return fd;
+}
+
+
+
+/* 跟踪用户对 O_NONBLOCK 的设置：hook 管理的套接字在内核中始终保持非阻塞，用户设置 O_NONBLOCK 后 hook 不再等待（返回 EAGAIN），
+   清除后恢复由 hook 等待；F_GETFL 不显示 hook 自己设置的 O_NONBLOCK。F_DUPFD 与 dup 一样复制 fd 状态 */
+int fcntl(int fd, int cmd, ...) {
+
+	va_list ap;
+	va_start(ap, cmd);
+	void *arg = va_arg(ap, void *); // 与 glibc 一样按指针取出第三个参数，没有时取到的值不会被使用
+	va_end(ap);
+
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || fd < 0) {
+		return fcntl_f(fd, cmd, arg);
+	}
+
+	switch (cmd) {
+	case F_GETFL: {
+		int fl = fcntl_f(fd, cmd);
+		if (fl != -1 && (fl & O_NONBLOCK)) {
+			int flags = hook_fd_flags(fd);
+			if ((flags & COROUTINE_FD_HOOK_NONBLOCK) && !(flags & COROUTINE_FD_USER_NONBLOCK)) {
+				fl &= ~O_NONBLOCK;
+			}
+		}
+		return fl;
+	}
+
+	case F_SETFL: {
+		int fl = (int)(intptr_t)arg;
+		if (fcntl_f(fd, F_GETFD) == -1) return -1; // 无效的 fd，不在状态表中留下记录
+
+		int flags = hook_fd_flags(fd);
+		int ret = fcntl_f(fd, cmd, (flags & COROUTINE_FD_HOOK_NONBLOCK) ? fl | O_NONBLOCK : fl);
+		if (ret == -1) return ret;
+
+		coroutine_fd *cfd = &sched->fds[fd];
+		if (fl & O_NONBLOCK) {
+			cfd->flags |= COROUTINE_FD_NONBLOCK;
+			if (!(flags & COROUTINE_FD_REGULAR)) cfd->flags |= COROUTINE_FD_USER_NONBLOCK; // 普通文件的 O_NONBLOCK 不起作用，仍交给线程池
+		} else {
+			cfd->flags &= ~COROUTINE_FD_USER_NONBLOCK;
+			if (!(flags & COROUTINE_FD_HOOK_NONBLOCK)) cfd->flags &= ~COROUTINE_FD_NONBLOCK;
+		}
+		return ret;
+	}
+
+	case F_DUPFD:
+	case F_DUPFD_CLOEXEC: {
+		int newfd = fcntl_f(fd, cmd, (int)(intptr_t)arg);
+		if (newfd >= 0) hook_copy_fd(fd, newfd);
+		return newfd;
+	}
+
+	default:
+		return fcntl_f(fd, cmd, arg);
+	}
+}
+
+
+
+/* 关闭之前清理调度器中与 fd 有关的一切：等待它的协程以 EBADF 醒来，io_uring 中的操作被取消（同样返回 EBADF），
+   移除 epoll 中的持久登记，清空 fd 状态表（非阻塞、超时等）。只处理当前线程的调度器 */
+int close(int fd) {
+
+	hook_forget_fd(fd);
+
+	return close_f(fd);
+}
+
+
+
+struct hook_open_args {
+	const char *path;
+	int flags;
+	mode_t mode;
+};
+
+static intptr_t hook_open_task(void *arg) {
+	struct hook_open_args *a = arg;
+	return open_f(a->path, a->flags, a->mode);
+}
+
+
+int open(const char *pathname, int flags, ...) {
+
+	mode_t mode = 0;
+	if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE) { // 只有这两种情况带第三个参数
+		va_list ap;
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || sched->curr_thread == NULL) {
+		return open_f(pathname, flags, mode);
+	}
+
+	struct hook_open_args args = {pathname, flags, mode};
+	char *path = NULL;
+	if (schedule_on_shared_stack(sched, pathname, strlen(pathname) + 1)) {
+		path = strdup(pathname);
+		if (path == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		args.path = path;
+	}
+
+	int fd = hook_blocking_call(hook_open_task, &args, sizeof(args));
+
+	if (path) {
+		int err = errno;
+		free(path);
+		errno = err;
+	}
+	return fd;
+}
+
+
+
+static intptr_t hook_fsync_task(void *arg) {
+	return fsync_f((int)(intptr_t)arg);
+}
+
+
+int fsync(int fd) {
+
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || sched->curr_thread == NULL) {
+		return fsync_f(fd);
+	}
+
+	return coroutine_blocking_call(hook_fsync_task, (void *)(intptr_t)fd);
+}
+
+
+
+struct hook_getaddrinfo_args {
+	const char *node;
+	const char *service;
+	struct addrinfo hints;
+	int has_hints;
+	struct addrinfo *res;
+};
+
+static intptr_t hook_getaddrinfo_task(void *arg) {
+	struct hook_getaddrinfo_args *a = arg;
+	return getaddrinfo_f(a->node, a->service, a->has_hints ? &a->hints : NULL, &a->res);
+}
+
+
+// 字符串在共享栈上时复制一份，复制失败返回 -1
+static int hook_strdup_shared(schedule *sched, const char **str, char **copy) {
+
+	*copy = NULL;
+	if (*str == NULL || !schedule_on_shared_stack(sched, *str, strlen(*str) + 1)) return 0;
+
+	*copy = strdup(*str);
+	if (*copy == NULL) return -1;
+
+	*str = *copy;
+	return 0;
+}
+
+
+// 域名解析会阻塞（查询 DNS），交给线程池；返回的结果链表在堆上，可以直接交给调用者
+int getaddrinfo(const char *node, const char *service,
+                const struct addrinfo *hints, struct addrinfo **res) {
+
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || sched->curr_thread == NULL) {
+		return getaddrinfo_f(node, service, hints, res);
+	}
+
+	struct hook_getaddrinfo_args args;
+	memset(&args, 0, sizeof(args));
+	args.node = node;
+	args.service = service;
+	if (hints != NULL) {
+		args.hints = *hints;
+		args.has_hints = 1;
+	}
+
+	char *node_copy = NULL, *service_copy = NULL;
+	int ret = EAI_MEMORY;
+	if (hook_strdup_shared(sched, &args.node, &node_copy) == 0 &&
+		hook_strdup_shared(sched, &args.service, &service_copy) == 0) {
+		ret = hook_blocking_call(hook_getaddrinfo_task, &args, sizeof(args));
+		if (ret == 0) *res = args.res;
+	}
+
+	free(node_copy);
+	free(service_copy);
+
+	return ret;
+}
+
+
+
+struct hook_stat_args {
+	const char *path;
+	struct stat st;
+};
+
+static intptr_t hook_stat_task(void *arg) {
+	struct hook_stat_args *a = arg;
+	return stat(a->path, &a->st);
+}
+
+
+/* stat 在 glibc 中有多个版本的符号，不做 hook，提供这个包装：在协程中调用时交给线程池执行，
+   避免元数据不在缓存中（网络文件系统等）时阻塞整个调度器 */
+int coroutine_stat(const char *path, struct stat *buf) {
+
+	coroutine_sched_key_init();
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || sched->curr_thread == NULL) {
+		return stat(path, buf);
+	}
+
+	struct hook_stat_args args;
+	char *path_copy = NULL;
+
+	args.path = path;
+	if (hook_strdup_shared(sched, &args.path, &path_copy) != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	int ret = hook_blocking_call(hook_stat_task, &args, sizeof(args));
+	int err = errno;
+
+	if (ret == 0) *buf = args.st;
+	free(path_copy);
+
+	errno = err;
+	return ret;
+}
+
@@ -0,0 +1,256 @@
+#include "coroutine.h"
+
+
+
+/*
+每个调度器各自缓存已释放的协程结构体和栈缓冲区，只在本线程内使用，不需要加锁。
+共享栈模式下保存栈用的缓冲区按 2 的幂分级（512B ~ CO_MAX_STACKSIZE），独立栈模式下缓存整块 mmap 的栈。
+空闲对象本身的内存用来存放链表指针，缓存数量/字节数超过上限时直接归还给系统。
+*/
+
+typedef struct coroutine_pool_chunk {
+	struct coroutine_pool_chunk *next;
+} coroutine_pool_chunk;
+
+
+
+// 计算 size 所属的分级，超过最大分级返回 -1
+static int coroutine_pool_stack_class(size_t size) {
+	int idx = 0;
+	size_t class_size = CO_POOL_STACK_MIN;
+
+	while (class_size < size) {
+		class_size <<= 1;
+		idx ++;
+	}
+
+	return idx < CO_POOL_STACK_CLASSES ? idx : -1;
+}
+
+
+static inline size_t coroutine_pool_private_size(schedule *sched) {
+	return sched->stack_size + sched->page_size; // 栈 + 保护页
+}
+
+// 独立栈的保护页不可读写，空闲链表指针存放在保护页之后
+static inline void **coroutine_pool_private_next(schedule *sched, void *stack) {
+	return (void **)((char *)stack + sched->page_size);
+}
+
+static void *coroutine_pool_private_pop(schedule *sched) {
+	coroutine_pool *pool = &sched->pool;
+	void *stack = pool->free_private_stacks;
+
+	if (stack != NULL) {
+		pool->free_private_stacks = *coroutine_pool_private_next(sched, stack);
+		pool->free_stack_bytes -= coroutine_pool_private_size(sched);
+	}
+
+	return stack;
+}
+
+
+void coroutine_pool_init(schedule *sched) {
+
+	memset(&sched->pool, 0, sizeof(coroutine_pool));
+
+	sched->pool.max_coroutines = CO_POOL_MAX_COROUTINES;
+	sched->pool.max_stack_bytes = CO_POOL_MAX_STACK_BYTES;
+}
+
+
+// 释放缓存中的所有对象，调度器销毁时调用
+void coroutine_pool_destroy(schedule *sched) {
+
+	coroutine_pool *pool = &sched->pool;
+	coroutine_pool_chunk *chunk = NULL;
+	int i = 0;
+
+	while ((chunk = pool->free_coroutines) != NULL) {
+		pool->free_coroutines = chunk->next;
+		free(chunk);
+	}
+
+	for (i = 0;i < CO_POOL_STACK_CLASSES;i ++) {
+		while ((chunk = pool->free_stacks[i]) != NULL) {
+			pool->free_stacks[i] = chunk->next;
+			free(chunk);
+		}
+	}
+
+	void *stack = NULL;
+	while ((stack = coroutine_pool_private_pop(sched)) != NULL) {
+		munmap(stack, coroutine_pool_private_size(sched));
+	}
+
+	pool->nfree_coroutines = 0;
+	pool->free_stack_bytes = 0;
+}
+
+
+// 分配一个清零的协程结构体
+coroutine *coroutine_pool_alloc(schedule *sched) {
+
+	coroutine_pool *pool = &sched->pool;
+	coroutine_pool_chunk *chunk = pool->free_coroutines;
+
+	if (chunk == NULL) {
+		pool->stats.co_misses ++;
+		return calloc(1, sizeof(coroutine));
+	}
+
+	pool->free_coroutines = chunk->next;
+	pool->nfree_coroutines --;
+	pool->stats.co_hits ++;
+
+	memset(chunk, 0, sizeof(coroutine));
+	return (coroutine *)chunk;
+}
+
+
+void coroutine_pool_release(schedule *sched, coroutine *co) {
+
+	coroutine_pool *pool = &sched->pool;
+
+	if (pool->nfree_coroutines >= pool->max_coroutines) {
+		free(co);
+		return ;
+	}
+
+	coroutine_pool_chunk *chunk = (coroutine_pool_chunk *)co;
+	chunk->next = pool->free_coroutines;
+	pool->free_coroutines = chunk;
+	pool->nfree_coroutines ++;
+}
+
+
+// 分配至少 size 字节的栈缓冲区，*cap 返回实际容量（即所属分级的大小）
+void *coroutine_pool_stack_alloc(schedule *sched, size_t size, size_t *cap) {
+
+	coroutine_pool *pool = &sched->pool;
+	int idx = coroutine_pool_stack_class(size);
+
+	if (idx < 0) { // 超过最大分级，不经过缓存
+		pool->stats.stack_misses ++;
+		*cap = size;
+		return malloc(size);
+	}
+
+	*cap = (size_t)CO_POOL_STACK_MIN << idx;
+
+	coroutine_pool_chunk *chunk = pool->free_stacks[idx];
+	if (chunk == NULL) {
+		pool->stats.stack_misses ++;
+		return malloc(*cap);
+	}
+
+	pool->free_stacks[idx] = chunk->next;
+	pool->free_stack_bytes -= *cap;
+	pool->stats.stack_hits ++;
+
+	return chunk;
+}
+
+
+void coroutine_pool_stack_release(schedule *sched, void *stack, size_t cap) {
+
+	coroutine_pool *pool = &sched->pool;
+	int idx = coroutine_pool_stack_class(cap);
+
+	if (idx < 0 || ((size_t)CO_POOL_STACK_MIN << idx) != cap ||
+		pool->free_stack_bytes + cap > pool->max_stack_bytes) {
+		free(stack);
+		return ;
+	}
+
+	coroutine_pool_chunk *chunk = (coroutine_pool_chunk *)stack;
+	chunk->next = pool->free_stacks[idx];
+	pool->free_stacks[idx] = chunk;
+	pool->free_stack_bytes += cap;
+}
+
+
+// 独立栈模式：分配一块栈 + 保护页，最低地址的一页为 PROT_NONE，栈溢出时直接触发 SIGSEGV 而不是踩坏其他内存
+void *coroutine_pool_private_stack_alloc(schedule *sched) {
+
+	coroutine_pool *pool = &sched->pool;
+	size_t size = coroutine_pool_private_size(sched);
+
+	void *stack = coroutine_pool_private_pop(sched);
+	if (stack != NULL) {
+		pool->stats.stack_hits ++;
+		return stack;
+	}
+
+	pool->stats.stack_misses ++;
+
+	stack = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (stack == MAP_FAILED) {
+		return NULL;
+	}
+	if (mprotect(stack, sched->page_size, PROT_NONE) == -1) {
+		munmap(stack, size);
+		return NULL;
+	}
+
+	return stack;
+}
+
+
+void coroutine_pool_private_stack_release(schedule *sched, void *stack) {
+
+	coroutine_pool *pool = &sched->pool;
+	size_t size = coroutine_pool_private_size(sched);
+
+	if (pool->free_stack_bytes + size > pool->max_stack_bytes) {
+		munmap(stack, size);
+		return ;
+	}
+
+	*coroutine_pool_private_next(sched, stack) = pool->free_private_stacks;
+	pool->free_private_stacks = stack;
+	pool->free_stack_bytes += size;
+}
+
+
+
+// 调整缓存上限：最多缓存 max_coroutines 个协程结构体、max_stack_bytes 字节的栈，超出部分立即释放
+void schedule_pool_set_limits(schedule *sched, size_t max_coroutines, size_t max_stack_bytes) {
+
+	coroutine_pool *pool = &sched->pool;
+	coroutine_pool_chunk *chunk = NULL;
+	int i = 0;
+
+	pool->max_coroutines = max_coroutines;
+	pool->max_stack_bytes = max_stack_bytes;
+
+	while (pool->nfree_coroutines > max_coroutines) {
+		chunk = pool->free_coroutines;
+		pool->free_coroutines = chunk->next;
+		pool->nfree_coroutines --;
+		free(chunk);
+	}
+
+	void *stack = NULL;
+	while (pool->free_stack_bytes > max_stack_bytes && (stack = coroutine_pool_private_pop(sched)) != NULL) {
+		munmap(stack, coroutine_pool_private_size(sched));
+	}
+
+	for (i = CO_POOL_STACK_CLASSES - 1;i >= 0;i --) { // 优先释放大块
+		size_t cap = (size_t)CO_POOL_STACK_MIN << i;
+		while (pool->free_stack_bytes > max_stack_bytes && (chunk = pool->free_stacks[i]) != NULL) {
+			pool->free_stacks[i] = chunk->next;
+			pool->free_stack_bytes -= cap;
+			free(chunk);
+		}
+	}
+}
+
+
+void schedule_pool_stats(schedule *sched, coroutine_pool_stats *stats) {
+
+	*stats = sched->pool.stats;
+	stats->free_coroutines = sched->pool.nfree_coroutines;
+	stats->free_stack_bytes = sched->pool.free_stack_bytes;
+}
@@ -0,0 +1,180 @@
+#include "coroutine.h"
+
+#include <arpa/inet.h>
+
+
+
+/*
+SO_REUSEPORT 多反应堆：启动 K 个线程，每个线程拥有自己的调度器和监听同一端口的监听套接字，
+由内核把新连接分散到各个监听套接字上。连接的接受和处理都在同一个线程内完成，线程之间没有交接。
+*/
+
+
+typedef struct reactor {
+	pthread_t tid;
+	int index;
+	int listen_fd;
+	int status; // 0: 启动中，1: 监听成功，-1: 失败
+} reactor;
+
+
+static struct {
+	reactor_config config;
+	reactor *reactors;
+	int nreactors;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} reactors = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+
+
+// 每个连接一个协程，arg 中存放连接的套接字
+static void reactor_connection(void *arg) {
+	int fd = (int)(intptr_t)arg;
+	reactors.config.handler(fd, reactors.config.arg);
+}
+
+
+static void reactor_acceptor(void *arg) {
+
+	reactor *r = arg;
+	struct sockaddr_in remote;
+
+	while (1) {
+		socklen_t len = sizeof(struct sockaddr_in);
+		int cli_fd = accept(r->listen_fd, (struct sockaddr*)&remote, &len);
+		if (cli_fd < 0) {
+			continue;
+		}
+
+		coroutine *co = NULL;
+		if (coroutine_create(&co, reactor_connection, (void *)(intptr_t)cli_fd) != 0) {
+			close(cli_fd);
+		}
+	}
+}
+
+
+static int reactor_listen(reactor *r) {
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0); // socket 已被 hook，返回的套接字为非阻塞且设置了 SO_REUSEADDR
+	if (fd < 0) return -1;
+
+	int reuse = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char *)&reuse, sizeof(reuse)) == -1) {
+		printf("reactor %d : SO_REUSEPORT, errno %d\n", r->index, errno);
+		close(fd);
+		return -1;
+	}
+
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(struct sockaddr_in));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(reactors.config.port);
+	local.sin_addr.s_addr = INADDR_ANY;
+	if (bind(fd, (struct sockaddr*)&local, sizeof(struct sockaddr_in)) == -1 ||
+		listen(fd, reactors.config.backlog ? reactors.config.backlog : SOMAXCONN) == -1) {
+		printf("reactor %d : bind/listen port %d, errno %d\n", r->index, reactors.config.port, errno);
+		close(fd);
+		return -1;
+	}
+
+	r->listen_fd = fd;
+	return 0;
+}
+
+
+static void *reactor_main(void *arg) {
+
+	reactor *r = arg;
+
+	if (reactors.config.pin_cpu) { // 第 i 个反应堆绑定到第 i 个 CPU
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(r->index % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus) != 0) {
+			printf("reactor %d : failed to set cpu affinity\n", r->index);
+		}
+	}
+
+	int status = 1;
+	if (reactor_listen(r) != 0 ||
+		schedule_create(reactors.config.stack_size, reactors.config.flags) != 0) {
+		status = -1;
+	}
+
+	pthread_mutex_lock(&reactors.mutex);
+	r->status = status;
+	pthread_cond_broadcast(&reactors.cond);
+	pthread_mutex_unlock(&reactors.mutex);
+
+	if (status < 0) return NULL;
+
+	coroutine *co = NULL;
+	coroutine_create(&co, reactor_acceptor, r);
+
+	schedule_run();
+
+	return NULL;
+}
+
+
+
+// 按 config 启动反应堆线程，等所有线程都完成监听后返回；任意一个线程监听失败返回 -1
+int schedule_reactors_start(const reactor_config *config) {
+
+	int i = 0, ret = 0;
+
+	if (reactors.reactors != NULL || config->handler == NULL) return -1;
+
+	reactors.config = *config;
+	reactors.nreactors = config->nreactors > 0 ? config->nreactors : sysconf(_SC_NPROCESSORS_ONLN);
+
+	reactors.reactors = calloc(reactors.nreactors, sizeof(reactor));
+	if (reactors.reactors == NULL) {
+		printf("Failed to allocate reactors\n");
+		return -1;
+	}
+
+	for (i = 0;i < reactors.nreactors;i ++) {
+		reactor *r = &reactors.reactors[i];
+		r->index = i;
+		r->listen_fd = -1;
+
+		if (pthread_create(&r->tid, NULL, reactor_main, r) != 0) {
+			printf("Failed to create reactor thread\n");
+			assert(0);
+		}
+	}
+
+	pthread_mutex_lock(&reactors.mutex);
+	for (i = 0;i < reactors.nreactors;i ++) {
+		while (reactors.reactors[i].status == 0) {
+			pthread_cond_wait(&reactors.cond, &reactors.mutex);
+		}
+		if (reactors.reactors[i].status < 0) ret = -1;
+	}
+	pthread_mutex_unlock(&reactors.mutex);
+
+	return ret;
+}
+
+
+// 等待所有反应堆线程退出（监听协程不会主动结束，通常用于服务进程的主线程挂起）
+void schedule_reactors_join(void) {
+
+	int i = 0;
+
+	if (reactors.reactors == NULL) return ;
+
+	for (i = 0;i < reactors.nreactors;i ++) {
+		pthread_join(reactors.reactors[i].tid, NULL);
+	}
+
+	free(reactors.reactors);
+	reactors.reactors = NULL;
+	reactors.nreactors = 0;
+}
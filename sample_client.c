@@ -47,7 +47,7 @@ void client(void *arg) { // 循环向服务器发送消息
 		int length = send(clientfd, buffer, strlen(buffer), 0);
 		printf("echo length : %d\n", length);
 
-		sleep(1);
+		sleep(1); // hook 后只让出当前协程，不阻塞线程
 	}
 
 }
@@ -22,6 +22,8 @@ void server_reader(void *arg) { // 参数是服务端与客户端通信的套接
 	fds.fd = fd;
 	fds.events = POLLIN;
 
+	coroutine_cork(fd, 64 * 1024, 0); // 同一轮调度里的多次 send 合并成一次系统调用，在本轮调度结束时发出
+
 	while (1) { // 循环接收来自客户端的消息并回复
 		
 		char buf[1024] = {0};
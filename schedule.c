@@ -1,3 +1,5 @@
+#include <sys/eventfd.h>
+
 #include "coroutine.h"
 
 
@@ -10,78 +12,31 @@
 
 
 
-/*
-这两个比较函数的目的是在红黑树中对协程按照睡眠时间或者等待事件描述符进行排序，以便在调度器中根据不同的条件进行高效的协程调度
-*/
-// 如果 co1 的睡眠时间小于 co2 的睡眠时间，则返回 -1；如果二者相等，则返回 0；否则返回 1。
-static inline int coroutine_sleep_cmp(coroutine *co1, coroutine *co2) {
-	if (co1->sleep_usecs < co2->sleep_usecs) {
-		return -1;
-	}
-	if (co1->sleep_usecs == co2->sleep_usecs) {
-		return 0;
-	}
-	return 1;
-}
-
-
-//如果 co1 的 fd_wait 小于 co2 的 fd_wait，则返回 -1；如果二者相等，则返回 0；否则返回 1。
-static inline int coroutine_wait_cmp(coroutine *co1, coroutine *co2) {
-
-	if (co1->fd_wait < co2->fd_wait) {
-		return -1;
-	}
-	if (co1->fd_wait == co2->fd_wait) {
-		return 0;
-	}
-
-	return 1;
-}
-
-
-
-/* #define	RB_GENERATE(name, type, field, cmp)									\
-        RB_GENERATE_INTERNAL(name, type, field, cmp,)
-*/
-RB_GENERATE(_coroutine_rbtree_sleep, _coroutine, sleep_node, coroutine_sleep_cmp);
-RB_GENERATE(_coroutine_rbtree_wait, _coroutine, wait_node, coroutine_wait_cmp);
-
-
-
-// 使协程进入睡眠，并设置红黑树节点
+// 使协程进入睡眠，加入调度器的定时器（默认为时间轮，见 timer.c）
 void schedule_sched_sleepdown(coroutine *co, uint64_t msecs) { // 参数 co 是需要进入睡眠状态的协程指针，msecs 是协程需要睡眠的时间
 
 	uint64_t usecs = msecs * 1000u; // 将 msecs 转换为微秒
 
-    // 在睡眠红黑树中查找是否已经存在该协程。如果已经存在，则先移除该协程
-	coroutine *co_tmp = RB_FIND(_coroutine_rbtree_sleep, &co->sched->sleeping, co);
-	if (co_tmp != NULL) {
-		RB_REMOVE(_coroutine_rbtree_sleep, &co->sched->sleeping, co_tmp);
+    // 如果协程已经在定时器中，先移除
+	if (co->status & BIT(COROUTINE_STATUS_SLEEPING)) {
+		schedule_timer_del(co);
 	}
     
-	co->sleep_usecs = coroutine_diff_usecs(co->sched->birth, coroutine_usec_now()) + usecs; // 计算出协程需要睡眠的总时长
+	co->sleep_usecs = coroutine_diff_usecs(co->sched->birth, coroutine_usec_now()) + usecs; // 计算出协程的到期时间
 
-	while (msecs) {
+	schedule_timer_add(co);
 
-		co_tmp = RB_INSERT(_coroutine_rbtree_sleep, &co->sched->sleeping, co);
-
-		if (co_tmp) { // 如果添加失败，说明在睡眠红黑树中已经存在相同睡眠时长的协程，此时会对睡眠时长进行自增，直到找到一个合适的睡眠时长为止
-			printf("1111 sleep_usecs %"PRIu64"\n", co->sleep_usecs);
-			co->sleep_usecs ++;
-			continue;
-		}
-		co->status |= BIT(COROUTINE_STATUS_SLEEPING); // 将协程的状态设置为睡眠状态
-		break;
-	}
+	co->status |= BIT(COROUTINE_STATUS_SLEEPING); // 将协程的状态设置为睡眠状态
+	co->status &= CLEARBIT(COROUTINE_STATUS_EXPIRED);
 
 	//yield
 }
 
 
-// 将协程移出睡眠红黑树
+// 将协程移出定时器
 void schedule_desched_sleepdown(coroutine *co) {
-	if (co->status & BIT(COROUTINE_STATUS_SLEEPING)) { // 如果处于睡眠状态，则从睡眠红黑树中移除该协程
-		RB_REMOVE(_coroutine_rbtree_sleep, &co->sched->sleeping, co);
+	if (co->status & BIT(COROUTINE_STATUS_SLEEPING)) { // 如果处于睡眠状态，则从定时器中移除该协程
+		schedule_timer_del(co);
 
 		co->status &= CLEARBIT(COROUTINE_STATUS_SLEEPING); // 清除睡眠状态
 		co->status |= BIT(COROUTINE_STATUS_READY); // 设置为就绪状态
@@ -90,69 +45,141 @@ void schedule_desched_sleepdown(coroutine *co) {
 }
 
 
-// 在等待红黑树中查找指定协程
-coroutine *schedule_search_wait(int fd) {
-	coroutine find_it = {0};
-	find_it.fd = fd;
+/* 按 fd 上现有的等待者重新激活 epoll 登记（EPOLLONESHOT 触发后登记即失效）；写合并缓冲区发送时 EAGAIN 也等待可写。
+   等待零拷贝完成通知的协程虽然占用写槽位，只关心错误队列（EPOLLERR），不登记可写 */
+void schedule_arm_wait(schedule *sched, int fd) {
 
-	schedule *sched = coroutine_get_sched();
+	coroutine_fd *cfd = &sched->fds[fd];
+	uint32_t events = 0;
+	int zc_wait = cfd->zc != NULL && cfd->zc->waiter != NULL;
 
-	// 在等待红黑树中查找具有指定文件描述符的协程对象。如果找到了匹配的协程，则将其状态清零并返回该协程指针, 未找到返回NULL 
-	coroutine *co = RB_FIND(_coroutine_rbtree_wait, &sched->waiting, &find_it);
-	co->status = 0;
+	if (cfd->reader != NULL) events |= EPOLLIN;
+	if ((cfd->writer != NULL && !zc_wait) || (cfd->cork != NULL && cfd->cork->blocked)) events |= EPOLLOUT;
+	if (zc_wait) events |= EPOLLERR;
 
-	return co;
+	if (events) {
+		epoller_arm(sched, fd, events);
+	}
 }
 
 
-// 在等待红黑树中移除一个协程
-coroutine* schedule_desched_wait(int fd) {
-	
-	coroutine find_it = {0};
-	find_it.fd = fd;
+// 将协程从一个 fd 的读/写槽位中移出
+static void schedule_unslot_wait(schedule *sched, coroutine *co, int fd) {
 
-	schedule *sched = coroutine_get_sched();
-	
-	coroutine *co = RB_FIND(_coroutine_rbtree_wait, &sched->waiting, &find_it);
-	if (co != NULL) { // 如果找到了匹配的协程，则从等待红黑树中移除该协程
-		RB_REMOVE(_coroutine_rbtree_wait, &co->sched->waiting, co);
+	if (fd < 0 || fd >= sched->fds_size) return ;
+
+	coroutine_fd *cfd = &sched->fds[fd];
+	if (cfd->reader == co) {
+		cfd->reader = NULL;
+		sched->nwaiting --;
+	}
+	if (cfd->writer == co) {
+		cfd->writer = NULL;
+		sched->nwaiting --;
+	}
+	if (cfd->zc != NULL && cfd->zc->waiter == co) {
+		cfd->zc->waiter = NULL;
+	}
+}
+
+
+/* 将协程从 fd 的等待表中移除，并清除等待状态、移出睡眠红黑树。
+   同时等待多个 fd 时（COROUTINE_STATUS_WAIT_MULTI）忽略 fd，一次从所有 fd 上移出，之后其他 fd 就绪也不会再唤醒它 */
+void schedule_desched_wait(coroutine *co, int fd) {
+
+	schedule *sched = co->sched;
+
+	if (co->status & BIT(COROUTINE_STATUS_WAIT_MULTI)) {
+		nfds_t i = 0;
+		for (i = 0;i < co->nfds;i ++) {
+			schedule_unslot_wait(sched, co, co->pfds[i].fd);
+		}
+		co->pfds = NULL;
+		co->nfds = 0;
+		co->status &= CLEARBIT(COROUTINE_STATUS_WAIT_MULTI);
+	} else {
+		schedule_unslot_wait(sched, co, fd);
 	}
-    // 将协程的状态清零，并调用 schedule_desched_sleepdown 函数将其从睡眠状态中移除，最后返回该协程指针, 未找到返回NULL
-	co->status = 0;
+
+	co->status &= CLEARBIT(COROUTINE_STATUS_WAIT_READ);
+	co->status &= CLEARBIT(COROUTINE_STATUS_WAIT_WRITE);
 	schedule_desched_sleepdown(co);
-	
-	return co;
 }
 
 
-/* 将协程设置为等待状态，等待指定文件描述符上的事件，并将其加入到等待红黑树中 */
-void schedule_sched_wait(coroutine *co, int fd, unsigned short events, uint64_t timeout) { // timeout为 1 则不设置为睡眠状态
-	// 检查协程的当前状态，如果协程已经处于等待读或写事件的状态，则输出错误信息并终止程序。
-    // 这个检查确保了协程在设置等待状态之前不会处于其他等待状态
-	if (co->status & BIT(COROUTINE_STATUS_WAIT_READ) ||
-		co->status & BIT(COROUTINE_STATUS_WAIT_WRITE)) {
-		printf("Unexpected event. lt id %"PRIu64" fd %"PRId32" already in %"PRId32" state\n",
-            co->id, co->fd, co->status);
-		assert(0);
+// fd 将要被关闭：等待它的协程移出等待表和定时器，放入就绪队列，醒来后返回 EBADF；否则 fd 号复用后事件会交给错误的协程
+void schedule_wake_closed(schedule *sched, int fd) {
+
+	if (fd < 0 || fd >= sched->fds_size) return ;
+
+	coroutine *reader = sched->fds[fd].reader;
+	coroutine *writer = sched->fds[fd].writer;
+
+	if (reader != NULL) {
+		reader->status |= BIT(COROUTINE_STATUS_FDCLOSED);
+		reader->fd = fd;
+		schedule_desched_wait(reader, fd);
+		TAILQ_INSERT_TAIL(&sched->ready, reader, ready_next);
+	}
+	if (writer != NULL && writer != reader) {
+		writer->status |= BIT(COROUTINE_STATUS_FDCLOSED);
+		writer->fd = fd;
+		schedule_desched_wait(writer, fd);
+		TAILQ_INSERT_TAIL(&sched->ready, writer, ready_next);
 	}
+}
+
 
-    // 根据参数 events 中的事件类型（POLLIN 或 POLLOUT），设置协程的状态为等待读或等待写状态
+// 按事件把协程放进 fd 的读/写槽位（POLLIN | POLLOUT 时两个都放），并激活 epoll 登记
+static void schedule_slot_wait(coroutine *co, int fd, unsigned short events) {
+
+	schedule *sched = co->sched;
+	coroutine_fd *cfd = schedule_fd(sched, fd);
+	coroutine **slots[2] = {NULL, NULL};
+	int i = 0;
+
+    // 根据参数 events 中的事件类型（POLLIN 或 POLLOUT），选择读或写槽位，设置协程的状态为等待读或等待写状态
 	if (events & POLLIN) { 
-		co->status |= COROUTINE_STATUS_WAIT_READ;
-	} else if (events & POLLOUT) {
-		co->status |= COROUTINE_STATUS_WAIT_WRITE;
-	} else {
+		slots[0] = &cfd->reader;
+		co->status |= BIT(COROUTINE_STATUS_WAIT_READ);
+	}
+	if (events & POLLOUT) {
+		slots[1] = &cfd->writer;
+		co->status |= BIT(COROUTINE_STATUS_WAIT_WRITE);
+	}
+	if (slots[0] == NULL && slots[1] == NULL) {
 		printf("events : %d\n", events);
 		assert(0);
 	}
 
-	co->fd = fd; // 表示协程要等待的文件描述符
-	co->events = events; // 表示协程要等待的事件类型
+	for (i = 0;i < 2;i ++) {
+		coroutine **slot = slots[i];
+		if (slot == NULL) continue;
+
+		// 同一个 fd 的同一方向只能有一个协程等待
+		if (*slot != NULL && *slot != co) {
+			printf("Unexpected event. lt id %"PRIu64" fd %"PRId32" already waited by lt id %"PRIu64"\n",
+	            co->id, fd, (*slot)->id);
+			assert(0);
+		}
+		if (*slot == NULL) {
+			*slot = co;
+			sched->nwaiting ++;
+		}
+	}
+
+	schedule_arm_wait(sched, fd);
+}
 
-    // 将协程插入到等待红黑树中。如果红黑树中已经存在具有相同键值的节点，则会返回非NULL，表示插入失败
-	coroutine *co_tmp = RB_INSERT(_coroutine_rbtree_wait, &co->sched->waiting, co);
 
-	assert(co_tmp == NULL);
+/* 将协程设置为等待状态，等待指定文件描述符上的事件：按 fd 直接放进等待表的读/写槽位，并激活 epoll 登记。
+   同一个 fd 上一个协程等读、另一个协程等写可以同时进行 */
+void schedule_sched_wait(coroutine *co, int fd, unsigned short events, uint64_t timeout) { // timeout为 1 则不设置为睡眠状态
+
+	schedule_slot_wait(co, fd, events);
+
+	co->fd = fd; // 表示协程要等待的文件描述符
+	co->events = events; // 表示协程要等待的事件类型
 
 	//检查参数 timeout 是否为 1。如果是，直接返回。否则，设置协程为睡眠状态
 	if (timeout == 1) return ; //Error
@@ -162,9 +189,101 @@ void schedule_sched_wait(coroutine *co, int fd, unsigned short events, uint64_t
 }
 
 
-// 取消协程的等待状态，并将其从等待红黑树中移除
-void schedule_cancel_wait(coroutine *co) {
-	RB_REMOVE(_coroutine_rbtree_wait, &co->sched->waiting, co);
+/* 等待 fd 上零拷贝发送的完成通知，直到 zc->wait_ticket 之前的发送都已完成（调用者已设置）。
+   协程占用写槽位，调度器收到 EPOLLERR 时取出错误队列中的通知（schedule_zerocopy_reap），到齐或连接出错时才唤醒 */
+void schedule_sched_wait_zerocopy(coroutine *co, int fd) {
+
+	coroutine_zerocopy *zc = co->sched->fds[fd].zc;
+
+	zc->waiter = co; // 先于占用写槽位设置，登记时只登记 EPOLLERR
+	schedule_slot_wait(co, fd, POLLOUT);
+
+	co->fd = fd;
+	co->events = POLLERR;
+}
+
+
+/* 同时等待多个 fd（poll 多个 fd）：协程放进每个 fd 相应的槽位，第一个就绪的 fd 唤醒它，唤醒时一次从所有 fd 上移出。
+   负数的 fd、不关心读写的项被跳过。调度器在协程挂起期间会读取 pfds，调用者保证它不在共享栈上 */
+void schedule_sched_wait_multi(coroutine *co, struct pollfd *pfds, nfds_t nfds) {
+
+	nfds_t i = 0;
+
+	for (i = 0;i < nfds;i ++) {
+		if (pfds[i].fd < 0 || !(pfds[i].events & (POLLIN | POLLOUT))) continue;
+		schedule_slot_wait(co, pfds[i].fd, pfds[i].events);
+	}
+
+	co->fd = -1; // 就绪时记为唤醒它的 fd
+	co->events = 0;
+	co->pfds = pfds;
+	co->nfds = nfds;
+	co->status |= BIT(COROUTINE_STATUS_WAIT_MULTI);
+}
+
+
+// 唤醒 fd 上与事件相应的等待者：可读/出错唤醒读槽位，可写/出错唤醒写槽位
+static void schedule_dispatch_wait(schedule *sched, int fd, uint32_t events) {
+
+	if (fd < 0 || fd >= sched->fds_size) return ;
+
+	sched->fds[fd].armed = 0; // EPOLLONESHOT 已经触发
+
+	// 错误队列中的零拷贝完成通知在这里取走，否则 EPOLLERR 会一直触发，反复唤醒等待读写的协程
+	coroutine_zerocopy *zc = sched->fds[fd].zc;
+	if (zc != NULL && (events & EPOLLERR)) {
+		events = schedule_zerocopy_reap(sched, fd, events);
+	}
+
+	// 检查事件是否为对端关闭连接
+	int is_eof = events & EPOLLHUP;
+	
+	coroutine *reader = NULL, *writer = NULL;
+	if (events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+		reader = sched->fds[fd].reader;
+	}
+	if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+		writer = sched->fds[fd].writer;
+	}
+	if (zc != NULL && zc->waiter != NULL) { // 等待完成通知的协程：通知到齐或连接出错时唤醒
+		int wake = coroutine_zerocopy_reached(zc, zc->wait_ticket) || (events & (EPOLLERR | EPOLLHUP));
+		writer = wake ? zc->waiter : NULL;
+	}
+
+	if (reader != NULL) {
+		if (is_eof) { // 如果事件为对端关闭连接，则设置 errno 为 ECONNRESET，并设置协程状态为已关闭文件描述符
+			errno = ECONNRESET;
+			reader->status |= BIT(COROUTINE_STATUS_FDEOF);
+		}
+		reader->fd = fd; // 唤醒它的 fd 和事件，poll 据此填写 revents
+		reader->revents = events;
+		schedule_desched_wait(reader, fd);
+		coroutine_resume(reader); // 恢复协程的执行
+	}
+
+	// 读协程运行期间状态表可能扩容，也可能关闭了 fd，重新取一次
+	if (writer != NULL && fd < sched->fds_size && sched->fds[fd].writer == writer) {
+		if (is_eof) {
+			errno = ECONNRESET;
+			writer->status |= BIT(COROUTINE_STATUS_FDEOF);
+		}
+		writer->fd = fd;
+		writer->revents = events;
+		schedule_desched_wait(writer, fd);
+		coroutine_resume(writer);
+	}
+
+	// 写合并缓冲区等到可写，交给本轮结束时发送
+	coroutine_cork_buf *cork = fd < sched->fds_size ? sched->fds[fd].cork : NULL;
+	if (cork != NULL && cork->blocked && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+		cork->blocked = 0;
+		schedule_cork_dirty(sched, cork);
+	}
+
+	// 只唤醒了一方时，另一方还在等待，需要重新激活登记
+	if (fd < sched->fds_size && !sched->fds[fd].armed) {
+		schedule_arm_wait(sched, fd);
+	}
 }
 
 
@@ -179,6 +298,18 @@ void schedule_free(schedule *sched) {
 	if (sched->stack != NULL) {
 		free(sched->stack); // 释放栈空间
 	}
+
+	schedule_uring_free(sched); // 释放 io_uring 实例
+	int fd = 0;
+	for (fd = 0;fd < sched->fds_size;fd ++) { // 没有关闭的 fd 上的写合并缓冲区和零拷贝状态
+		free(sched->fds[fd].zc);
+		if (sched->fds[fd].cork == NULL) continue;
+		free(sched->fds[fd].cork->buf);
+		free(sched->fds[fd].cork);
+	}
+	free(sched->fds); // 释放 fd 状态表
+	free(sched->eventlist); // 释放就绪事件数组
+	coroutine_pool_destroy(sched); // 释放缓存的协程结构体与栈
 	
 	free(sched); // 释放结构体
 
@@ -188,11 +319,13 @@ void schedule_free(schedule *sched) {
 
 
 
-// 创建并初始化一个调度器
-int schedule_create(int stack_size) {
+// 创建并初始化一个调度器，flags 选择共享栈（SCHEDULE_SHARED_STACK）或独立栈（SCHEDULE_PRIVATE_STACK）模式
+int schedule_create(int stack_size, int flags) {
 
 	int sched_stack_size = stack_size ? stack_size : CO_MAX_STACKSIZE;
 
+	coroutine_sched_key_init();
+
 	schedule *sched = (schedule*)calloc(1, sizeof(schedule));
 	if (sched == NULL) {
 		printf("Failed to initialize scheduler\n");
@@ -217,77 +350,418 @@ int schedule_create(int stack_size) {
 
 	sched->stack_size = sched_stack_size;
 	sched->page_size = getpagesize();
+	sched->flags = flags;
+
+	coroutine_pool_init(sched);
+
+	if ((flags & SCHEDULE_PRIVATE_STACK) == 0) { // 独立栈模式下协程各自分配栈，调度器不需要共享栈
+		int ret = posix_memalign(&sched->stack, sched->page_size, sched->stack_size); 
+		// 使用 posix_memalign 函数分配调度器的栈空间，并确保分配的内存按页对齐。分配失败时返回错误（工作线程据此报告启动失败）
+		if (ret != 0) {
+			printf("Failed to allocate scheduler stack\n");
+			sched->stack = NULL;
+			schedule_free(sched);
+			return -4;
+		}
+	}
 
-	int ret = posix_memalign(&sched->stack, sched->page_size, sched->stack_size); 
-    // 使用 posix_memalign 函数分配调度器的栈空间，并确保分配的内存按页对齐。如果分配失败，则终止程序
-	assert(ret == 0);
+	// 就绪事件数组按批量分配，不再内嵌 CO_MAX_EVENTS 个元素（约 12MB）
+	sched->event_batch = CO_DEFAULT_EVENTS;
+	sched->event_batch_max = CO_MAX_EVENTS;
+	sched->eventlist = calloc(sched->event_batch, sizeof(struct epoll_event));
+	if (sched->eventlist == NULL) {
+		printf("Failed to allocate eventlist\n");
+		schedule_free(sched);
+		return -3;
+	}
+	sched->eventlist_size = sched->event_batch;
+
+	if ((flags & SCHEDULE_IO_URING) && schedule_uring_init(sched) != 0) { // 内核不支持 io_uring，退回 epoll
+		printf("io_uring unavailable, falling back to epoll\n");
+		sched->flags &= ~SCHEDULE_IO_URING;
+	}
 
 	sched->spawned_coroutines = 0; // 已创建协程数量
 	sched->default_timeout = 3000000u; // 默认超时时间
 
-    // 初始化睡眠红黑树和等待红黑树
-	RB_INIT(&sched->sleeping);
-	RB_INIT(&sched->waiting);
+    // 初始化定时器（睡眠红黑树和时间轮）
+	schedule_timer_init(sched);
 
     // 记录调度器的创建时间
 	sched->birth = coroutine_usec_now();
 
     // 初始化调度器的就绪队列、延迟队列和忙碌链表
 	TAILQ_INIT(&sched->ready);
-	TAILQ_INIT(&sched->defer);
+	atomic_init(&sched->defer, NULL);
 	LIST_INIT(&sched->busy);
+	LIST_INIT(&sched->cork_dirty);
+	atomic_init(&sched->polling, 0);
+	atomic_init(&sched->notified, 0);
 
 
     return 0;
 }
 
 
-// 检查并返回最先超时的协程
+// 检查并返回最先超时的协程，同时清除其睡眠状态、标记为已超时
 static coroutine *schedule_expired(schedule *sched) {
 	
 	uint64_t t_diff_usecs = coroutine_diff_usecs(sched->birth, coroutine_usec_now()); // 计算当前时间与调度器创建时间之间的时间差
-	coroutine *co = RB_MIN(_coroutine_rbtree_sleep, &sched->sleeping); // 获取睡眠红黑树中的最小值，即最先超时的协程
+	coroutine *co = schedule_timer_expired(sched, t_diff_usecs); // 取出一个到期时间不晚于当前时间的协程
 	if (co == NULL) return NULL;
-	
-    // 如果找到了最小超时的协程，则检查其超时时间是否小于等于当前时间与调度器创建时间之间的时间差。
-    // 如果是，则从睡眠红黑树中移除该协程（RB_REMOVE），并将其返回
-	if (co->sleep_usecs <= t_diff_usecs) { 
-		RB_REMOVE(_coroutine_rbtree_sleep, &co->sched->sleeping, co);
-		return co;
-	}
-	return NULL;
+
+	co->status &= CLEARBIT(COROUTINE_STATUS_SLEEPING);
+	co->status |= BIT(COROUTINE_STATUS_EXPIRED);
+	return co;
 }
 
 
 
 // 检查调度器是否已经完成了所有的任务，即等待队列、忙碌链表、睡眠红黑树和就绪队列是否都为空
 static inline int schedule_isdone(schedule *sched) {
-	return (RB_EMPTY(&sched->waiting) && 
+	int done = (sched->nwaiting == 0 && 
+		sched->noffload == 0 &&
+		sched->nparked == 0 &&
+		atomic_load_explicit(&sched->defer, memory_order_relaxed) == NULL &&
+		!schedule_uring_busy(sched) &&
 		LIST_EMPTY(&sched->busy) &&
-		RB_EMPTY(&sched->sleeping) &&
+		schedule_timer_empty(sched) &&
 		TAILQ_EMPTY(&sched->ready));
+
+	if (done && sched->worker != NULL) { // 工作线程还要等到运行时请求停止
+		return schedule_worker_done(sched);
+	}
+	return done;
 }
 
 
 
-// 获取调度器中最小的超时时间，即睡眠红黑树中最小的睡眠时间与当前时间之差
-static uint64_t schedule_min_timeout(schedule *sched) {
-	uint64_t t_diff_usecs = coroutine_diff_usecs(sched->birth, coroutine_usec_now()); // 计算调度器从创建到现在的时间差，并将结果保存在变量 t_diff_usecs 中
-	uint64_t min = sched->default_timeout; // 将min初始化为调度器默认超时时间
+/* 跨线程投递：新协程（coroutine_spawn）、线程池交回的协程、coroutine_wake、schedule_submit 都通过这里交给调度器，
+   任何线程都可以调用。节点压入无锁栈，调度器每轮循环开始时整体摘下处理。
+   只有调度器登记了 polling（将要或正在阻塞）时才写 eventfd，并且在调度器读取之前只写一次；
+   调度器先登记 polling 再检查队列，投递方先入队再检查 polling，两边都是顺序一致的原子操作，至少一方能看到另一方，不会丢失唤醒 */
+void schedule_defer_push(schedule *sched, coroutine_defer_node *node, int kind) {
 
-	coroutine *co = RB_MIN(_coroutine_rbtree_sleep, &sched->sleeping); // 使用 RB_MIN 宏获取睡眠红黑树中最小的协程对象，即具有最小睡眠时间的协程
-	if (!co) return min; // 如果睡眠红黑树为空或者最小睡眠时间大于当前时间差，则返回默认超时时间
+	node->kind = kind;
 
-    // 否则，返回最小睡眠时间与当前时间差之间的差值，即表示还需要等待的时间
-	min = co->sleep_usecs;
-	if (min > t_diff_usecs) {
-		return min - t_diff_usecs;
+	coroutine_defer_node *head = atomic_load_explicit(&sched->defer, memory_order_relaxed);
+	do {
+		node->next = head;
+	} while (!atomic_compare_exchange_weak(&sched->defer, &head, node));
+
+	if (atomic_load(&sched->polling) && !atomic_exchange(&sched->notified, 1)) {
+		eventfd_write(sched->eventfd, 1);
 	}
+}
+
+
+typedef struct schedule_submit_node { // schedule_submit 投递的函数，在调度器线程中创建协程
+	coroutine_defer_node node;
+	proc_coroutine func;
+	void *arg;
+} schedule_submit_node;
+
+
+// 在调度器 sched 上创建一个协程执行 func(arg)，可以在任何线程中调用；sched 必须还在运行
+int schedule_submit(schedule *sched, proc_coroutine func, void *arg) {
+
+	schedule_submit_node *sn = malloc(sizeof(schedule_submit_node)); // 协程要在调度器线程上创建，这里只记下函数
+	if (sn == NULL) return -1;
+
+	sn->func = func;
+	sn->arg = arg;
+	schedule_defer_push(sched, &sn->node, COROUTINE_DEFER_SUBMIT);
 
 	return 0;
+}
+
+
+/* 挂起当前协程，直到被 coroutine_wake 唤醒（返回 0）或经过 msecs 毫秒（返回 -1，errno 为 ETIMEDOUT），msecs < 0 不超时。
+   在挂起之前已经被唤醒则直接返回 0。超时之后才到达的唤醒会留给下一次挂起，所以调用者醒来后要重新检查等待的条件 */
+int coroutine_park_timeout(int64_t msecs) {
+
+	schedule *sched = coroutine_get_sched();
+	coroutine *co = sched->curr_thread;
+
+	if (co->woken) {
+		co->woken = 0;
+		return 0;
+	}
+
+	co->status |= BIT(COROUTINE_STATUS_PARKED);
+	sched->nparked ++;
+	if (msecs >= 0) {
+		schedule_sched_sleepdown(co, msecs);
+	}
+
+	coroutine_yield(co);
+
+	if (co->status & BIT(COROUTINE_STATUS_PARKED)) { // 由定时器恢复
+		co->status &= CLEARBIT(COROUTINE_STATUS_PARKED);
+		co->status &= CLEARBIT(COROUTINE_STATUS_EXPIRED);
+		sched->nparked --;
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	return 0;
+}
+
+
+// 在调度器线程中直接恢复一个 coroutine_park 挂起的协程：撤销超时定时器，放入就绪队列
+void schedule_unpark(coroutine *co) {
+
+	co->status &= CLEARBIT(COROUTINE_STATUS_PARKED);
+	co->sched->nparked --;
+	schedule_desched_sleepdown(co); // 带超时挂起时撤销定时器
+	TAILQ_INSERT_TAIL(&co->sched->ready, co, ready_next);
+}
+
+
+// 挂起当前协程，直到其他协程或线程调用 coroutine_wake；在挂起之前已经被唤醒则直接返回
+void coroutine_park(void) {
+	coroutine_park_timeout(-1);
+}
+
+
+/* 唤醒 coroutine_park 挂起的协程，可以在任何线程中调用。多次唤醒在协程处理之前只算一次；
+   协程还没挂起时记下，下一次 coroutine_park 直接返回。调用者保证协程还没有退出 */
+void coroutine_wake(coroutine *co) {
+
+	if (atomic_exchange(&co->wake_pending, 1)) return ;
+
+	schedule_defer_push(co->sched, &co->wake_node, COROUTINE_DEFER_WAKE);
+}
+
+
+
+/* 截止时间与取消：hook 的 I/O（poll_inner、io_uring 操作）和 coroutine_sleep 在等待前检查，
+   等待时按截止时间设置定时器，被取消或超时后从等待表、定时器中移除，返回 -1，errno 为 ECANCELED / ETIMEDOUT。
+   coroutine_park 挂起的协程（通道、同步原语、join）被取消时提前醒来，由调用者检查后同样返回 ECANCELED / ETIMEDOUT */
+
+// 设置当前协程的截止时间为 msecs 毫秒之后，msecs < 0 清除
+void coroutine_set_deadline(int64_t msecs) {
+
+	coroutine *co = coroutine_get_sched()->curr_thread;
+
+	co->deadline = msecs < 0 ? 0 : coroutine_usec_now() + (uint64_t)msecs * 1000u;
+}
+
+
+// 当前协程是否已经被取消或超过截止时间：是则返回 -1，errno 为 ECANCELED / ETIMEDOUT
+int schedule_interrupted(coroutine *co) {
+
+	if (co->status & BIT(COROUTINE_STATUS_CANCELLED)) {
+		errno = ECANCELED;
+		return -1;
+	}
+	if (co->deadline != 0 && coroutine_usec_now() >= co->deadline) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	return 0;
+}
+
+
+int coroutine_testcancel(void) {
+	return schedule_interrupted(coroutine_get_sched()->curr_thread);
+}
+
+
+// 按截止时间缩短等待时间 msecs（< 0 表示不超时），返回实际的等待毫秒数，< 0 表示不超时
+int64_t schedule_deadline_msecs(coroutine *co, int64_t msecs) {
+
+	if (co->deadline == 0) return msecs;
+
+	uint64_t now = coroutine_usec_now();
+	int64_t left = now < co->deadline ? (int64_t)(co->deadline - now + 999) / 1000 : 0;
+
+	return msecs < 0 || left < msecs ? left : msecs;
+}
+
+
+// 在协程所属的调度器线程中取消：标记后把它从正在等待的结构中移出并放入就绪队列，正在运行或已就绪时只做标记
+static void schedule_cancel(coroutine *co) {
+
+	schedule *sched = co->sched;
+
+	co->status |= BIT(COROUTINE_STATUS_CANCELLED);
+
+	if (co->status & (BIT(COROUTINE_STATUS_WAIT_READ) | BIT(COROUTINE_STATUS_WAIT_WRITE))) {
+		schedule_desched_wait(co, co->fd); // 同时撤销定时器
+		TAILQ_INSERT_TAIL(&sched->ready, co, ready_next);
+	} else if (co->status & BIT(COROUTINE_STATUS_PARKED)) {
+		schedule_unpark(co);
+	} else if (co->status & (BIT(COROUTINE_STATUS_WAIT_IO_READ) | BIT(COROUTINE_STATUS_WAIT_IO_WRITE))) {
+		schedule_uring_cancel_co(sched, co); // 操作以 ECANCELED 完成后恢复
+	} else if (co->status & BIT(COROUTINE_STATUS_SLEEPING)) { // coroutine_sleep
+		schedule_desched_sleepdown(co);
+		TAILQ_INSERT_TAIL(&sched->ready, co, ready_next);
+	}
+}
+
+
+/* 取消协程 co，可以在任何线程中调用：co 正在等待的 hook I/O、coroutine_sleep、通道、同步原语或 join 立即返回 ECANCELED，之后的调用也都返回 ECANCELED。
+   交给线程池执行的阻塞调用不能中断，返回后才生效。调用者保证 co 还没有被释放（可以已经结束） */
+int coroutine_cancel(coroutine *co) {
+
+	schedule *sched = coroutine_get_sched();
+
+	if (sched != NULL && co->sched == sched) {
+		if ((co->status & BIT(COROUTINE_STATUS_EXITED)) == 0) schedule_cancel(co);
+		return 0;
+	}
+
+	int expected = COROUTINE_CANCEL_NONE;
+	if (atomic_compare_exchange_strong(&co->cancel_pending, &expected, COROUTINE_CANCEL_QUEUED)) {
+		schedule_defer_push(co->sched, &co->cancel_node, COROUTINE_DEFER_CANCEL);
+	}
+	return 0;
+}
+
+
+// 取出延迟队列中的节点并处理，压入顺序是后进先出，先反转为投递顺序
+void schedule_defer_drain(schedule *sched) {
+
+	coroutine_defer_node *node = atomic_exchange_explicit(&sched->defer, NULL, memory_order_acquire);
+	coroutine_defer_node *list = NULL;
+
+	while (node != NULL) {
+		coroutine_defer_node *next = node->next;
+		node->next = list;
+		list = node;
+		node = next;
+	}
+
+	while (list != NULL) {
+		node = list;
+		list = list->next;
+
+		switch (node->kind) {
+			case COROUTINE_DEFER_NEW: {
+				coroutine *co = (coroutine *)((char *)node - offsetof(coroutine, defer_node));
+				co->id = sched->spawned_coroutines ++;
+				schedule_ready(co);
+				break;
+			}
+			case COROUTINE_DEFER_RETURN: {
+				coroutine *co = (coroutine *)((char *)node - offsetof(coroutine, defer_node));
+				sched->noffload --;
+				TAILQ_INSERT_TAIL(&sched->ready, co, ready_next);
+				break;
+			}
+			case COROUTINE_DEFER_WAKE: {
+				coroutine *co = (coroutine *)((char *)node - offsetof(coroutine, wake_node));
+				if (co->sched != sched) { // 投递之后协程被其他线程窃取，转交过去
+					schedule_defer_push(co->sched, node, COROUTINE_DEFER_WAKE);
+					break;
+				}
+				atomic_store(&co->wake_pending, 0); // 之后的唤醒重新入队
+				if (co->status & BIT(COROUTINE_STATUS_PARKED)) {
+					schedule_unpark(co);
+				} else {
+					co->woken = 1;
+				}
+				break;
+			}
+			case COROUTINE_DEFER_FREE: {
+				coroutine *co = (coroutine *)((char *)node - offsetof(coroutine, defer_node));
+				coroutine_free(co);
+				break;
+			}
+			case COROUTINE_DEFER_CANCEL: {
+				coroutine *co = (coroutine *)((char *)node - offsetof(coroutine, cancel_node));
+				if (co->sched != sched) { // 投递之后协程被其他线程窃取，转交过去
+					schedule_defer_push(co->sched, node, COROUTINE_DEFER_CANCEL);
+					break;
+				}
+				if (atomic_exchange(&co->cancel_pending, COROUTINE_CANCEL_DONE) == COROUTINE_CANCEL_FREEING) {
+					coroutine_free(co); // 节点在队列中时协程已经结束并要求释放
+				} else if ((co->status & BIT(COROUTINE_STATUS_EXITED)) == 0) {
+					schedule_cancel(co);
+				}
+				break;
+			}
+			case COROUTINE_DEFER_SUBMIT: {
+				schedule_submit_node *sn = (schedule_submit_node *)node;
+				coroutine *co = NULL;
+				coroutine_create(&co, sn->func, sn->arg);
+				free(sn);
+				break;
+			}
+		}
+	}
+}
+
+
+// 缓冲区是否位于共享栈上：协程挂起后这段内存会被其他协程覆盖，交给内核或其他线程异步访问前需要先复制出来
+int schedule_on_shared_stack(schedule *sched, const void *ptr, size_t len) {
+
+	if (sched->stack == NULL || ptr == NULL) return 0;
+
+	return (const char *)ptr < (char *)sched->stack + sched->stack_size &&
+		(const char *)ptr + len > (char *)sched->stack;
+}
+
+
+// 将协程放入就绪队列；工作线程上新建的协程放进可被其他线程窃取的双端队列
+void schedule_ready(coroutine *co) {
+
+	if (co->sched->worker != NULL && (co->status & BIT(COROUTINE_STATUS_NEW)) &&
+		schedule_worker_push(co) == 0) {
+		return ;
+	}
+
+	TAILQ_INSERT_TAIL(&co->sched->ready, co, ready_next);
+}
+
+
+
+// 获取调度器中最小的超时时间，即定时器中最早的到期时间与当前时间之差
+static uint64_t schedule_min_timeout(schedule *sched) {
+	uint64_t t_diff_usecs = coroutine_diff_usecs(sched->birth, coroutine_usec_now()); // 计算调度器从创建到现在的时间差，并将结果保存在变量 t_diff_usecs 中
+	uint64_t min = schedule_timer_next(sched, t_diff_usecs); // 定时器为空时为 UINT64_MAX
+
+	// 定时器为空或者最早的到期时间晚于默认超时时间，则返回默认超时时间
+	return min < sched->default_timeout ? min : sched->default_timeout;
 } 
 
 
+/* 设置单次 epoll_wait 的事件批量：batch 为初始批量，batch_max 为上一批返回满时翻倍增长的上限（不超过 CO_MAX_EVENTS）。
+   事件数组在下一次 epoll_wait 之前才调整大小，协程中调用也不会影响正在处理的这一批事件 */
+int schedule_set_event_batch(schedule *sched, int batch, int batch_max) {
+
+	if (batch <= 0 || batch > CO_MAX_EVENTS) return -1;
+	if (batch_max < batch) batch_max = batch;
+	if (batch_max > CO_MAX_EVENTS) batch_max = CO_MAX_EVENTS;
+
+	sched->event_batch = batch;
+	sched->event_batch_max = batch_max;
+
+	return 0;
+}
+
+
+// 按 event_batch 调整就绪事件数组，上一批返回满说明还有事件没取完，批量翻倍
+static void schedule_eventlist_resize(schedule *sched) {
+
+	if (sched->nevents == sched->eventlist_size && sched->event_batch < sched->event_batch_max) {
+		sched->event_batch = sched->eventlist_size * 2 < sched->event_batch_max ?
+			sched->eventlist_size * 2 : sched->event_batch_max;
+	}
+
+	if (sched->event_batch == sched->eventlist_size) return ;
+
+	struct epoll_event *eventlist = realloc(sched->eventlist, sched->event_batch * sizeof(struct epoll_event));
+	if (eventlist == NULL) { // 分配失败继续使用原来的数组
+		sched->event_batch = sched->eventlist_size;
+		return ;
+	}
+
+	sched->eventlist = eventlist;
+	sched->eventlist_size = sched->event_batch;
+}
+
+
 // 轮询调度器中epoll管理的事件：epoll_wait(sched->poller_fd, sched->eventlist
 static int schedule_epoll(schedule *sched) {
 
@@ -295,20 +769,38 @@ static int schedule_epoll(schedule *sched) {
 
 	struct timespec t = {0, 0};
 	uint64_t usecs = schedule_min_timeout(sched);
-	if (usecs && TAILQ_EMPTY(&sched->ready)) {
+	int block = usecs && TAILQ_EMPTY(&sched->ready);
+	if (block) {
+		usecs = (usecs + 999u) / 1000u * 1000u; // epoll_wait 的精度为毫秒，向上取整，避免在到期前空转
 		t.tv_sec = usecs / 1000000u;
-		if (t.tv_sec != 0) {
-			t.tv_nsec = (usecs % 1000u) * 1000u;
-		} else {
-			t.tv_nsec = usecs * 1000u;
-		}
-	} else {
+		t.tv_nsec = (usecs % 1000000u) * 1000u;
+	} else if (sched->uring == NULL) {
 		return 0;
 	}
+	// io_uring 后端即使不阻塞，也要提交本轮积累的操作并取出已经完成的结果
+
+	if (block) { // 登记 polling 之后再检查一遍延迟队列，与 schedule_defer_push 配合
+		atomic_store(&sched->polling, 1);
+		if (atomic_load(&sched->defer) != NULL) {
+			atomic_store_explicit(&sched->polling, 0, memory_order_relaxed);
+			if (sched->uring == NULL) return 0;
+			block = 0;
+			t.tv_sec = t.tv_nsec = 0;
+		}
+	}
+
+	if (block && sched->worker != NULL && schedule_worker_idle(sched) != 0) { // 登记空闲后发现还有协程可执行，不阻塞
+		atomic_store_explicit(&sched->polling, 0, memory_order_relaxed);
+		if (sched->uring == NULL) return 0;
+		block = 0;
+		t.tv_sec = t.tv_nsec = 0;
+	}
+
+	schedule_eventlist_resize(sched);
 
 	int nready = 0;
 	while (1) {
-		nready = epoller_wait(t);
+		nready = sched->uring ? schedule_uring_wait(sched, t) : epoller_wait(t);
 		if (nready == -1) {
 			if (errno == EINTR) continue;
 			else assert(0);
@@ -316,7 +808,14 @@ static int schedule_epoll(schedule *sched) {
 		break;
 	}
 
-	sched->nevents = 0;
+	if (block) {
+		atomic_store_explicit(&sched->polling, 0, memory_order_relaxed);
+	}
+	if (block && sched->worker != NULL) {
+		schedule_worker_wakeup(sched);
+	}
+
+	sched->nevents = nready;
 	sched->num_new_events = nready; // 就绪事件数量
 
 	return 0;
@@ -331,7 +830,10 @@ void schedule_run(void) {
 	if (sched == NULL) return ;
 
 	while (!schedule_isdone(sched)) {
-		// 1. expried coroutine in sleep rbtree
+		// 0. defer queue
+		schedule_defer_drain(sched);
+
+		// 1. expried coroutine in timers
 		// 获取超时的协程，并逐个执行这些协程的恢复操作
 		coroutine *expired = NULL;
 		while ((expired = schedule_expired(sched)) != NULL) {
@@ -353,7 +855,16 @@ void schedule_run(void) {
 			if (co == last_co_ready) break; // 全部处理完即退出
 		}
 
-		// 3. wait rbtree
+		// 2.1 N:M 运行时：本线程双端队列中的协程，以及从其他线程窃取的协程
+		if (sched->worker != NULL) {
+			schedule_worker_run(sched);
+		}
+
+		schedule_cork_flush(sched); // 本轮写入写合并缓冲区的数据，每个 fd 一次系统调用发出
+
+		if (schedule_isdone(sched)) break; // 最后的协程刚刚结束，不要再阻塞在 epoll_wait 上
+
+		// 3. wait table
 		schedule_epoll(sched); // 调用epoll_wait轮询调度器中epoll管理的文件描述符，并将就绪事件保存到调度器的 eventlist 中
 
 		while (sched->num_new_events) { // 遍历所有就绪事件
@@ -364,27 +875,20 @@ void schedule_run(void) {
 			struct epoll_event *ev = sched->eventlist+idx;
 			
 			int fd = ev->data.fd;
-            // 检查事件是否为对端关闭连接
-			int is_eof = ev->events & EPOLLHUP;
-            // 如果事件为对端关闭连接，则设置 errno 为 ECONNRESET
-			if (is_eof) errno = ECONNRESET;
-
-            // 根据文件描述符在等待红黑树中查找对应的协程
-			coroutine *co = schedule_search_wait(fd);
-
-            // 如果找到了对应的协程，则恢复该协程的执行
-			if (co != NULL) {
-				if (is_eof) { // 如果事件为对端关闭连接，则设置协程状态为已关闭文件描述符
-					co->status |= BIT(COROUTINE_STATUS_FDEOF);
-				}
-                // 恢复协程的执行
-				coroutine_resume(co);
+			if (fd == sched->eventfd) { // 其他线程的唤醒通知，清空计数即可，投递的节点在下一轮开始时处理
+				eventfd_t count;
+				eventfd_read(fd, &count);
+				atomic_store(&sched->notified, 0);
+				continue;
 			}
-            // 将 is_eof 重置为 0，以便下次循环使用
-			is_eof = 0;
+			schedule_dispatch_wait(sched, fd, ev->events); // 按 fd 直接找到等待的协程并恢复执行
 		}
 	}
 
+	if (sched->worker != NULL) { // 等所有工作线程都退出调度循环后再释放，避免其他线程唤醒时访问已释放的 eventfd
+		schedule_worker_exit();
+	}
+
 	schedule_free(sched); // 所有任务都完成后,释放调度器的资源，并返回。
 	
 	return ;
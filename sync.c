@@ -0,0 +1,469 @@
+#include "coroutine.h"
+
+
+
+/*
+协程同步原语：互斥锁、条件变量、信号量、读写锁。等待时只挂起当前协程（coroutine_park），调度器继续运行其他协程，
+不会像 pthread 互斥锁那样阻塞整个线程（持锁的协程让出后，同一线程上等锁的协程会把线程永远阻塞）。
+
+- 等待的协程通过 cond_next 按到达顺序排在原语的 waiters 队列上，释放时直接把锁/信号量交给队首的协程（所有权转移），
+  后来的协程不能插队，保证先来先得。
+- timed 版本的超时基于调度器的定时器（coroutine_park_timeout），超时返回 -1，errno 为 ETIMEDOUT。
+  等待也按协程的截止时间缩短，被取消或超过截止时间时放弃排队，返回 -1，errno 为 ECANCELED / ETIMEDOUT。
+  超时、取消与被授予同时发生时以授予为准；条件变量醒来后重新获取互斥锁时不响应取消，返回时总是持有互斥锁。
+- 默认只在一个调度器内使用：不加锁，授予时直接把等待者放回其调度器的就绪队列。
+  初始化时指定 CO_SYNC_SHARED 则可以被多个调度器（线程）上的协程使用，内部加锁，通过 coroutine_wake 唤醒等待者；
+  N:M 运行时中独立栈的协程可能在线程之间迁移，也需要 CO_SYNC_SHARED。
+
+失败时返回 -1 并设置 errno：try 版本拿不到时为 EBUSY（信号量为 EAGAIN），不在协程中调用会挂起的函数为 EPERM。
+*/
+
+
+
+static inline void sync_lock(coroutine_sync *s) {
+	if (s->flags & CO_SYNC_SHARED) pthread_mutex_lock(&s->lock);
+}
+
+static inline void sync_unlock(coroutine_sync *s) {
+	if (s->flags & CO_SYNC_SHARED) pthread_mutex_unlock(&s->lock);
+}
+
+
+static void sync_init(coroutine_sync *s, int flags) {
+
+	s->flags = flags;
+	TAILQ_INIT(&s->waiters);
+	if (flags & CO_SYNC_SHARED) {
+		pthread_mutex_init(&s->lock, NULL);
+	}
+}
+
+
+static void sync_destroy(coroutine_sync *s) {
+
+	assert(TAILQ_EMPTY(&s->waiters));
+	if (s->flags & CO_SYNC_SHARED) {
+		pthread_mutex_destroy(&s->lock);
+	}
+}
+
+
+// 当前协程，不在协程中时返回 NULL 并设置 errno
+static coroutine *sync_current(void) {
+
+	schedule *sched = coroutine_get_sched();
+	if (sched == NULL || sched->curr_thread == NULL) {
+		errno = EPERM;
+		return NULL;
+	}
+	return sched->curr_thread;
+}
+
+
+// 协程是否还在等待队列上：出队时把 tqe_prev 置空作为标记
+static inline int sync_queued(coroutine *co) {
+	return co->cond_next.tqe_prev != NULL;
+}
+
+static inline void sync_dequeue(coroutine_sync *s, coroutine *co) {
+	TAILQ_REMOVE(&s->waiters, co, cond_next);
+	co->cond_next.tqe_prev = NULL;
+}
+
+
+// 把等待者移出队列并唤醒，调用者持有 s 的锁，并且已经把所有权交给了它
+static void sync_grant(coroutine_sync *s, coroutine *co) {
+
+	sync_dequeue(s, co);
+
+	if (s->flags & CO_SYNC_SHARED) {
+		coroutine_wake(co);
+	} else if (co->status & BIT(COROUTINE_STATUS_PARKED)) { // 同一个调度器，直接放回就绪队列
+		schedule_unpark(co);
+	} // 否则已经被取消或之前的唤醒放回了就绪队列，醒来后看到已出队即为被授予
+}
+
+
+/* 调用者持有 s 的锁：排到队尾并挂起，直到被授予（移出队列）或超时。release 不为 NULL 时在挂起之前释放（条件变量）。
+   intr 不为 0 时被取消或超过截止时间也放弃等待。返回 0 表示被授予，-1 表示超时、被取消或超过截止时间（已移出队列）；
+   返回时持有 s 的锁 */
+static int sync_wait(coroutine_sync *s, coroutine *co, int64_t timeout_ms, coroutine_mutex *release, int intr) {
+
+	uint64_t deadline = timeout_ms > 0 ? coroutine_usec_now() + timeout_ms * 1000u : 0;
+
+	TAILQ_INSERT_TAIL(&s->waiters, co, cond_next);
+	sync_unlock(s);
+
+	if (release != NULL) {
+		coroutine_mutex_unlock(release);
+	}
+
+	while (1) {
+		int64_t wait_ms = -1;
+		if (timeout_ms >= 0) {
+			uint64_t now = coroutine_usec_now();
+			wait_ms = now < deadline ? (int64_t)(deadline - now + 999) / 1000 : 0;
+		}
+		if (intr) {
+			wait_ms = schedule_deadline_msecs(co, wait_ms);
+		}
+		if (wait_ms != 0 && (!intr || schedule_interrupted(co) == 0)) { // 挂起之前已经被取消时不会再被唤醒
+			coroutine_park_timeout(wait_ms);
+		}
+
+		sync_lock(s);
+		if (!sync_queued(co)) return 0;
+
+		if (timeout_ms >= 0 && coroutine_usec_now() >= deadline) { // 超时，放弃排队
+			sync_dequeue(s, co);
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if (intr && schedule_interrupted(co) < 0) { // 被取消或超过截止时间，放弃排队
+			sync_dequeue(s, co);
+			return -1;
+		}
+		sync_unlock(s); // 提前被唤醒（例如通道留下的唤醒），继续等
+	}
+}
+
+
+
+/* 互斥锁 */
+
+int coroutine_mutex_init(coroutine_mutex *m, int flags) {
+
+	sync_init(&m->sync, flags);
+	m->owner = NULL;
+
+	return 0;
+}
+
+
+void coroutine_mutex_destroy(coroutine_mutex *m) {
+	sync_destroy(&m->sync);
+}
+
+
+// timeout_ms < 0 一直等待，为 0 时不等待；intr 为 0 时不响应取消和截止时间
+static int mutex_lock(coroutine_mutex *m, int64_t timeout_ms, int intr) {
+
+	coroutine *co = sync_current();
+	if (co == NULL) return -1;
+
+	sync_lock(&m->sync);
+	if (m->owner == NULL) { // 有等待者时所有权直接转交，不会出现无主而队列非空
+		m->owner = co;
+		sync_unlock(&m->sync);
+		return 0;
+	}
+	if (timeout_ms == 0) {
+		sync_unlock(&m->sync);
+		errno = EBUSY;
+		return -1;
+	}
+
+	int ret = sync_wait(&m->sync, co, timeout_ms, NULL, intr); // 被授予时 owner 已经设为本协程
+	sync_unlock(&m->sync);
+
+	return ret;
+}
+
+
+int coroutine_mutex_lock(coroutine_mutex *m) {
+	return mutex_lock(m, -1, 1);
+}
+
+
+int coroutine_mutex_timedlock(coroutine_mutex *m, int64_t timeout_ms) {
+	return mutex_lock(m, timeout_ms > 0 ? timeout_ms : 1, 1);
+}
+
+
+int coroutine_mutex_trylock(coroutine_mutex *m) {
+	return mutex_lock(m, 0, 1);
+}
+
+
+// 释放互斥锁，有等待者时直接交给队首的协程
+int coroutine_mutex_unlock(coroutine_mutex *m) {
+
+	coroutine *co = sync_current();
+	if (co == NULL) return -1;
+
+	sync_lock(&m->sync);
+	if (m->owner != co) {
+		sync_unlock(&m->sync);
+		errno = EPERM;
+		return -1;
+	}
+
+	coroutine *next = TAILQ_FIRST(&m->sync.waiters);
+	m->owner = next;
+	if (next != NULL) {
+		sync_grant(&m->sync, next);
+	}
+	sync_unlock(&m->sync);
+
+	return 0;
+}
+
+
+
+/* 条件变量：等待者按顺序被唤醒，醒来后重新获取互斥锁 */
+
+int coroutine_cond_init(coroutine_cond *c, int flags) {
+	sync_init(&c->sync, flags);
+	return 0;
+}
+
+
+void coroutine_cond_destroy(coroutine_cond *c) {
+	sync_destroy(&c->sync);
+}
+
+
+static int cond_wait(coroutine_cond *c, coroutine_mutex *m, int64_t timeout_ms) {
+
+	coroutine *co = sync_current();
+	if (co == NULL) return -1;
+	if (m->owner != co) {
+		errno = EPERM;
+		return -1;
+	}
+
+	// 先排队再释放互斥锁，释放之后的 signal 一定能找到本协程
+	sync_lock(&c->sync);
+	int ret = sync_wait(&c->sync, co, timeout_ms, m, 1);
+	sync_unlock(&c->sync);
+
+	int err = errno;
+	mutex_lock(m, -1, 0); // 被取消时也要重新持有互斥锁
+	errno = err;
+
+	return ret;
+}
+
+
+int coroutine_cond_wait(coroutine_cond *c, coroutine_mutex *m) {
+	return cond_wait(c, m, -1);
+}
+
+
+int coroutine_cond_timedwait(coroutine_cond *c, coroutine_mutex *m, int64_t timeout_ms) {
+	return cond_wait(c, m, timeout_ms > 0 ? timeout_ms : 0);
+}
+
+
+// 唤醒最早等待的协程，CO_SYNC_SHARED 时可以在任何线程中调用
+void coroutine_cond_signal(coroutine_cond *c) {
+
+	sync_lock(&c->sync);
+	coroutine *co = TAILQ_FIRST(&c->sync.waiters);
+	if (co != NULL) {
+		sync_grant(&c->sync, co);
+	}
+	sync_unlock(&c->sync);
+}
+
+
+void coroutine_cond_broadcast(coroutine_cond *c) {
+
+	sync_lock(&c->sync);
+	while (!TAILQ_EMPTY(&c->sync.waiters)) {
+		sync_grant(&c->sync, TAILQ_FIRST(&c->sync.waiters));
+	}
+	sync_unlock(&c->sync);
+}
+
+
+
+/* 信号量 */
+
+int coroutine_sem_init(coroutine_sem *s, int flags, long count) {
+
+	if (count < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	sync_init(&s->sync, flags);
+	s->count = count;
+
+	return 0;
+}
+
+
+void coroutine_sem_destroy(coroutine_sem *s) {
+	sync_destroy(&s->sync);
+}
+
+
+static int sem_acquire(coroutine_sem *s, int64_t timeout_ms) {
+
+	coroutine *co = sync_current();
+	if (co == NULL) return -1;
+
+	sync_lock(&s->sync);
+	if (s->count > 0) { // 有等待者时计数一定为 0，post 直接交给等待者
+		s->count --;
+		sync_unlock(&s->sync);
+		return 0;
+	}
+	if (timeout_ms == 0) {
+		sync_unlock(&s->sync);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	int ret = sync_wait(&s->sync, co, timeout_ms, NULL, 1);
+	sync_unlock(&s->sync);
+
+	return ret;
+}
+
+
+int coroutine_sem_wait(coroutine_sem *s) {
+	return sem_acquire(s, -1);
+}
+
+
+int coroutine_sem_timedwait(coroutine_sem *s, int64_t timeout_ms) {
+	return sem_acquire(s, timeout_ms > 0 ? timeout_ms : 1);
+}
+
+
+int coroutine_sem_trywait(coroutine_sem *s) {
+	return sem_acquire(s, 0);
+}
+
+
+// 释放一个单位：有等待者时直接交给队首的协程，否则计数加一。CO_SYNC_SHARED 时可以在任何线程中调用
+void coroutine_sem_post(coroutine_sem *s) {
+
+	sync_lock(&s->sync);
+	coroutine *co = TAILQ_FIRST(&s->sync.waiters);
+	if (co != NULL) {
+		sync_grant(&s->sync, co);
+	} else {
+		s->count ++;
+	}
+	sync_unlock(&s->sync);
+}
+
+
+
+/* 读写锁：读者和写者排在同一个队列里，先来先得。队首是写者时后面的读者也要等待，写者不会饿死 */
+
+int coroutine_rwlock_init(coroutine_rwlock *rw, int flags) {
+
+	sync_init(&rw->sync, flags);
+	rw->readers = 0;
+	rw->writer = NULL;
+
+	return 0;
+}
+
+
+void coroutine_rwlock_destroy(coroutine_rwlock *rw) {
+	sync_destroy(&rw->sync);
+}
+
+
+// 从队首开始授予：一个写者，或者连续的读者
+static void rwlock_grant(coroutine_rwlock *rw) {
+
+	coroutine *co = NULL;
+	while ((co = TAILQ_FIRST(&rw->sync.waiters)) != NULL && rw->writer == NULL) {
+		if (co->sync_mode) {
+			if (rw->readers > 0) break;
+			rw->writer = co;
+		} else {
+			rw->readers ++;
+		}
+		sync_grant(&rw->sync, co);
+	}
+}
+
+
+static int rwlock_lock(coroutine_rwlock *rw, int write, int64_t timeout_ms) {
+
+	coroutine *co = sync_current();
+	if (co == NULL) return -1;
+
+	sync_lock(&rw->sync);
+	if (rw->writer == NULL && TAILQ_EMPTY(&rw->sync.waiters) && (!write || rw->readers == 0)) {
+		if (write) rw->writer = co;
+		else rw->readers ++;
+		sync_unlock(&rw->sync);
+		return 0;
+	}
+	if (timeout_ms == 0) {
+		sync_unlock(&rw->sync);
+		errno = EBUSY;
+		return -1;
+	}
+
+	co->sync_mode = write;
+	int ret = sync_wait(&rw->sync, co, timeout_ms, NULL, 1);
+	if (ret != 0) { // 排在前面的写者超时离开后，后面的读者可能可以授予了
+		rwlock_grant(rw);
+	}
+	sync_unlock(&rw->sync);
+
+	return ret;
+}
+
+
+int coroutine_rwlock_rdlock(coroutine_rwlock *rw) {
+	return rwlock_lock(rw, 0, -1);
+}
+
+
+int coroutine_rwlock_timedrdlock(coroutine_rwlock *rw, int64_t timeout_ms) {
+	return rwlock_lock(rw, 0, timeout_ms > 0 ? timeout_ms : 1);
+}
+
+
+int coroutine_rwlock_tryrdlock(coroutine_rwlock *rw) {
+	return rwlock_lock(rw, 0, 0);
+}
+
+
+int coroutine_rwlock_wrlock(coroutine_rwlock *rw) {
+	return rwlock_lock(rw, 1, -1);
+}
+
+
+int coroutine_rwlock_timedwrlock(coroutine_rwlock *rw, int64_t timeout_ms) {
+	return rwlock_lock(rw, 1, timeout_ms > 0 ? timeout_ms : 1);
+}
+
+
+int coroutine_rwlock_trywrlock(coroutine_rwlock *rw) {
+	return rwlock_lock(rw, 1, 0);
+}
+
+
+// 释放读锁或写锁（由当前协程是否持有写锁决定）
+int coroutine_rwlock_unlock(coroutine_rwlock *rw) {
+
+	coroutine *co = sync_current();
+	if (co == NULL) return -1;
+
+	sync_lock(&rw->sync);
+	if (rw->writer == co) {
+		rw->writer = NULL;
+	} else if (rw->readers > 0) {
+		rw->readers --;
+	} else {
+		sync_unlock(&rw->sync);
+		errno = EPERM;
+		return -1;
+	}
+
+	rwlock_grant(rw);
+	sync_unlock(&rw->sync);
+
+	return 0;
+}
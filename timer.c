@@ -0,0 +1,278 @@
+#include "coroutine.h"
+
+
+
+/*
+调度器的定时器：协程睡眠、hook 调用的超时都挂在这里，到期时间为 co->sleep_usecs（相对调度器创建时间的微秒数）。
+
+默认使用分层时间轮：CO_TIMER_LEVELS 层，每层 CO_TIMER_SLOTS 个槽，第 0 层一个槽为一个 tick（CO_TIMER_TICK_USECS），
+第 n 层一个槽覆盖 64^n 个 tick。插入时按到期 tick 与当前 tick 选层、选槽，撤销直接从槽链表中摘下，都是 O(1)，
+大量连接在同一时刻设置相同的超时也不会退化。时间推进时用每层的位图找出新走进的非空槽，
+高层槽里的协程重新插入，逐层下降到第 0 层后到期。
+
+创建调度器时指定 SCHEDULE_TIMER_RBTREE 则使用原来的睡眠红黑树，按到期时间精确排序（微秒精度）。
+*/
+
+
+#define CO_TIMER_BITS		6 // log2(CO_TIMER_SLOTS)
+#define CO_TIMER_MASK		(CO_TIMER_SLOTS - 1)
+
+
+// 如果 co1 的睡眠时间小于 co2 的睡眠时间，则返回 -1；否则返回 1。
+// 睡眠时间相同时按地址排序，保证键唯一，插入时不会发生冲突
+static inline int coroutine_sleep_cmp(coroutine *co1, coroutine *co2) {
+	if (co1->sleep_usecs < co2->sleep_usecs) {
+		return -1;
+	}
+	if (co1->sleep_usecs > co2->sleep_usecs) {
+		return 1;
+	}
+	if (co1 == co2) {
+		return 0;
+	}
+	return co1 < co2 ? -1 : 1;
+}
+
+
+/* #define	RB_GENERATE(name, type, field, cmp)									\
+        RB_GENERATE_INTERNAL(name, type, field, cmp,)
+*/
+RB_GENERATE(_coroutine_rbtree_sleep, _coroutine, sleep_node, coroutine_sleep_cmp);
+
+
+
+static inline uint64_t rotl(uint64_t v, int c) {
+	c &= 63;
+	return c ? (v << c) | (v >> (64 - c)) : v;
+}
+
+static inline uint64_t rotr(uint64_t v, int c) {
+	c &= 63;
+	return c ? (v >> c) | (v << (64 - c)) : v;
+}
+
+// 最高位 1 的位置（从 1 开始），v 不为 0
+static inline int fls64(uint64_t v) {
+	return 64 - __builtin_clzll(v);
+}
+
+// 到期时间向上取整到 tick，保证不会提前唤醒
+static inline uint64_t schedule_timer_tick(uint64_t usecs) {
+	return (usecs + CO_TIMER_TICK_USECS - 1) / CO_TIMER_TICK_USECS;
+}
+
+
+// 按到期 tick 放入时间轮：到期 tick 与当前 tick 最高的不同位所在的层，到期 tick 在该层的位决定槽；
+// 同一层更高位都相同，所以槽一定在当前位置之后，当前时间走进该槽时协程被重新插入到更低的层。已经到期的放进到期链表
+static void schedule_timer_wheel_add(coroutine_timer_wheel *wheel, coroutine *co, uint64_t expires) {
+
+	coroutine_timer_list *list = NULL;
+
+	if (expires > wheel->now) {
+		int level = (fls64(expires ^ wheel->now) - 1) / CO_TIMER_BITS;
+		int slot = 0;
+
+		if (level < CO_TIMER_LEVELS) {
+			slot = CO_TIMER_MASK & (expires >> (level * CO_TIMER_BITS));
+		} else { // 超出时间轮的范围，放在最高层的第 0 个槽，最高层转完这一圈时重新插入
+			level = CO_TIMER_LEVELS - 1;
+		}
+
+		list = &wheel->slots[level][slot];
+		wheel->pending[level] |= UINT64_C(1) << slot;
+	} else {
+		list = &wheel->expired;
+	}
+
+	LIST_INSERT_HEAD(list, co, timer_next);
+	co->timer_list = list;
+}
+
+
+// 把时间轮推进到 now：每层中当前时间新走进的槽里的协程重新插入（到期的进入到期链表，未到期的下降到更低的层），
+// 每个协程最多被移动 CO_TIMER_LEVELS 次
+static void schedule_timer_wheel_update(coroutine_timer_wheel *wheel, uint64_t now) {
+
+	if (now <= wheel->now) return ;
+
+	coroutine *todo[CO_TIMER_LEVELS * CO_TIMER_SLOTS]; // 摘下的槽链表，全部摘完后再重新插入
+	int ntodo = 0, level = 0, i = 0;
+
+	for (level = 0;level < CO_TIMER_LEVELS;level ++) {
+
+		int shift = level * CO_TIMER_BITS;
+		uint64_t from = wheel->now >> shift, to = now >> shift;
+		uint64_t pending = 0;
+
+		if (from == to) break; // 该层没有前进，更高的层也不会前进
+
+		if (to - from > CO_TIMER_MASK) { // 经过了该层一整圈
+			pending = ~UINT64_C(0);
+		} else { // 从旧位置（不含）到新位置（含）之间的槽
+			pending = rotl((UINT64_C(1) << (to - from)) - 1, CO_TIMER_MASK & (from + 1));
+		}
+
+		pending &= wheel->pending[level];
+		wheel->pending[level] &= ~pending;
+
+		while (pending) {
+			int slot = __builtin_ctzll(pending);
+			coroutine_timer_list *list = &wheel->slots[level][slot];
+
+			todo[ntodo ++] = LIST_FIRST(list); // 整条链表摘下，不逐个移除
+			LIST_INIT(list);
+			pending &= pending - 1;
+		}
+	}
+
+	wheel->now = now;
+
+	for (i = 0;i < ntodo;i ++) {
+		coroutine *co = todo[i];
+		while (co != NULL) {
+			coroutine *next = LIST_NEXT(co, timer_next);
+			schedule_timer_wheel_add(wheel, co, schedule_timer_tick(co->sleep_usecs));
+			co = next;
+		}
+	}
+}
+
+
+// 距离时间轮中最早的非空槽还有多少 tick：第 0 层是精确的到期时间，更高的层是重新插入的时间，只是下界，
+// 用于计算 epoll_wait 的超时时间
+static uint64_t schedule_timer_wheel_next(coroutine_timer_wheel *wheel) {
+
+	uint64_t timeout = ~UINT64_C(0);
+	int level = 0;
+
+	if (!LIST_EMPTY(&wheel->expired)) return 0;
+
+	for (level = 0;level < CO_TIMER_LEVELS;level ++) {
+		int shift = level * CO_TIMER_BITS;
+
+		if (wheel->pending[level]) {
+			uint64_t from = wheel->now >> shift;
+			// 当前位置之后的第一个非空槽，相距 1 ~ 64 格
+			uint64_t d = __builtin_ctzll(rotr(wheel->pending[level], CO_TIMER_MASK & (from + 1))) + 1;
+			uint64_t t = ((from + d) << shift) - wheel->now;
+			if (t < timeout) timeout = t;
+		}
+	}
+
+	return timeout;
+}
+
+
+
+void schedule_timer_init(schedule *sched) {
+
+	int i = 0, j = 0;
+
+	RB_INIT(&sched->sleeping);
+
+	memset(&sched->timers, 0, sizeof(coroutine_timer_wheel));
+	LIST_INIT(&sched->timers.expired);
+	for (i = 0;i < CO_TIMER_LEVELS;i ++) {
+		for (j = 0;j < CO_TIMER_SLOTS;j ++) {
+			LIST_INIT(&sched->timers.slots[i][j]);
+		}
+	}
+}
+
+
+// 按 co->sleep_usecs 加入定时器，调用者保证协程当前不在定时器中
+void schedule_timer_add(coroutine *co) {
+
+	schedule *sched = co->sched;
+
+	if (sched->flags & SCHEDULE_TIMER_RBTREE) {
+		RB_INSERT(_coroutine_rbtree_sleep, &sched->sleeping, co);
+	} else {
+		schedule_timer_wheel_add(&sched->timers, co, schedule_timer_tick(co->sleep_usecs));
+		sched->timers.count ++;
+	}
+}
+
+
+// 从定时器中移除协程
+void schedule_timer_del(coroutine *co) {
+
+	schedule *sched = co->sched;
+
+	if (sched->flags & SCHEDULE_TIMER_RBTREE) {
+		RB_REMOVE(_coroutine_rbtree_sleep, &sched->sleeping, co);
+		return ;
+	}
+
+	coroutine_timer_wheel *wheel = &sched->timers;
+	coroutine_timer_list *list = co->timer_list;
+
+	LIST_REMOVE(co, timer_next);
+	co->timer_list = NULL;
+	wheel->count --;
+
+	if (list != &wheel->expired && LIST_EMPTY(list)) { // 槽空了，清除位图中对应的位
+		long index = list - &wheel->slots[0][0];
+		wheel->pending[index / CO_TIMER_SLOTS] &= ~(UINT64_C(1) << (index % CO_TIMER_SLOTS));
+	}
+}
+
+
+// 取出一个到期时间不晚于 now_usecs 的协程，并将其从定时器中移除；没有则返回 NULL
+coroutine *schedule_timer_expired(schedule *sched, uint64_t now_usecs) {
+
+	if (sched->flags & SCHEDULE_TIMER_RBTREE) {
+		coroutine *co = RB_MIN(_coroutine_rbtree_sleep, &sched->sleeping); // 获取睡眠红黑树中的最小值，即最先超时的协程
+		if (co == NULL || co->sleep_usecs > now_usecs) return NULL;
+
+		RB_REMOVE(_coroutine_rbtree_sleep, &sched->sleeping, co);
+		return co;
+	}
+
+	coroutine_timer_wheel *wheel = &sched->timers;
+	if (wheel->count == 0) return NULL;
+
+	schedule_timer_wheel_update(wheel, now_usecs / CO_TIMER_TICK_USECS);
+
+	coroutine *co = LIST_FIRST(&wheel->expired);
+	if (co == NULL) return NULL;
+
+	LIST_REMOVE(co, timer_next);
+	co->timer_list = NULL;
+	wheel->count --;
+
+	return co;
+}
+
+
+// 距离下一个协程到期还有多少微秒，没有协程在定时器中时返回 UINT64_MAX
+uint64_t schedule_timer_next(schedule *sched, uint64_t now_usecs) {
+
+	if (sched->flags & SCHEDULE_TIMER_RBTREE) {
+		coroutine *co = RB_MIN(_coroutine_rbtree_sleep, &sched->sleeping);
+		if (co == NULL) return UINT64_MAX;
+
+		return co->sleep_usecs > now_usecs ? co->sleep_usecs - now_usecs : 0;
+	}
+
+	coroutine_timer_wheel *wheel = &sched->timers;
+	if (wheel->count == 0) return UINT64_MAX;
+
+	uint64_t now = now_usecs / CO_TIMER_TICK_USECS;
+	schedule_timer_wheel_update(wheel, now);
+
+	uint64_t ticks = schedule_timer_wheel_next(wheel);
+	if (ticks == 0) return 0;
+
+	// 到期 tick 的起点减去当前时间
+	return (now + ticks) * CO_TIMER_TICK_USECS - now_usecs;
+}
+
+
+int schedule_timer_empty(schedule *sched) {
+
+	if (sched->flags & SCHEDULE_TIMER_RBTREE) {
+		return RB_EMPTY(&sched->sleeping);
+	}
+	return sched->timers.count == 0;
+}
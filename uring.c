@@ -0,0 +1,604 @@
+#include "coroutine.h"
+
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+
+/*
+io_uring 后端：schedule_create 时指定 SCHEDULE_IO_URING 启用，内核不支持时退回 epoll。
+
+epoll 后端是就绪通知：fd 可读写后协程被唤醒，再调用一次 read/write 系统调用。
+io_uring 后端是完成通知：hook 的 read/recv/send/accept/connect 直接提交一个操作（SQE）后挂起协程，
+内核完成后把结果放入完成队列（CQE），调度器取出结果恢复协程，协程醒来时数据已经读好/发完。
+一轮调度循环中提交的所有操作在调度器阻塞前通过一次 io_uring_enter 批量提交，并在同一次调用中等待完成，
+每个请求基本不再需要单独的系统调用。
+
+epoll 实例仍然保留（poll、eventfd 唤醒等仍然基于就绪通知），它本身作为一个 fd 通过 IORING_OP_POLL_ADD 挂在 io_uring 上，
+调度器只阻塞在 io_uring_enter 中，epoll 有事件时再用 epoll_wait(0) 取出。
+
+共享栈模式下协程让出后栈内容会被拷走，原地址被其他协程使用，而内核要在协程挂起期间读写缓冲区，
+所以位于共享栈上的缓冲区/地址先复制到堆上的中转缓冲区，完成后再拷回。
+*/
+
+
+#define URING_TAG_EPOLL		((uint64_t)1) // epoll 实例可读
+#define URING_TAG_IGNORE	((uint64_t)2) // 不需要处理结果的操作（取消等）
+
+
+typedef struct coroutine_uring {
+	int fd;
+
+	// 提交队列
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	unsigned sq_local_tail; // 已填写的 SQE，io_uring_enter 之前一次性发布
+	unsigned to_submit;
+
+	// 完成队列
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *ring;
+	size_t ring_size;
+	void *cq_ring; // 不支持 IORING_FEAT_SINGLE_MMAP 时单独映射
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	int inflight; // 等待完成的协程数量
+	int epoll_armed; // epoll 实例是否已经挂在 io_uring 上
+	uint64_t enters; // io_uring_enter 调用次数
+} coroutine_uring;
+
+
+
+static int uring_enter(coroutine_uring *ring, unsigned to_submit, unsigned min_complete, unsigned flags, struct timespec *t) {
+
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	void *argp = NULL;
+	size_t argsz = 0;
+
+	if (t != NULL) { // 带超时的等待（IORING_ENTER_EXT_ARG，5.11）
+		ts.tv_sec = t->tv_sec;
+		ts.tv_nsec = t->tv_nsec;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+		argp = &arg;
+		argsz = sizeof(arg);
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	ring->enters ++;
+	return syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, argp, argsz);
+}
+
+
+// 发布已填写的 SQE 并提交给内核
+static int uring_submit(coroutine_uring *ring, unsigned min_complete, struct timespec *t) {
+
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+	unsigned to_submit = ring->to_submit;
+	unsigned flags = IORING_ENTER_GETEVENTS; // 即使不等待也要带上，DEFER_TASKRUN 模式下完成事件在这里处理
+
+	int ret = uring_enter(ring, to_submit, min_complete, flags, t);
+	if (ret >= 0) {
+		ring->to_submit -= (unsigned)ret < to_submit ? (unsigned)ret : to_submit;
+	}
+	return ret;
+}
+
+
+// 取一个空闲的 SQE，提交队列满时先把已有的提交掉
+static struct io_uring_sqe *uring_get_sqe(coroutine_uring *ring) {
+
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	if (ring->sq_local_tail - head >= ring->sq_entries) {
+		uring_submit(ring, 0, NULL);
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if (ring->sq_local_tail - head >= ring->sq_entries) return NULL;
+	}
+
+	unsigned idx = ring->sq_local_tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	ring->sq_array[idx] = idx;
+	ring->sq_local_tail ++;
+	ring->to_submit ++;
+
+	return sqe;
+}
+
+
+static void uring_arm_epoll(schedule *sched) {
+
+	coroutine_uring *ring = sched->uring;
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+	if (sqe == NULL) return ;
+
+	// 单次 poll：挂上时如果 epoll 中已有未取完的事件会立即完成，不会漏掉
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = sched->poller_fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = URING_TAG_EPOLL;
+
+	ring->epoll_armed = 1;
+}
+
+
+
+int schedule_uring_init(schedule *sched) {
+
+	struct io_uring_params p;
+	unsigned setup_flags[] = {
+		IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN, // 6.1，完成事件只在本线程调用 io_uring_enter 时处理
+		IORING_SETUP_COOP_TASKRUN, // 5.19
+		0,
+	};
+	int fd = -1;
+	size_t i = 0;
+
+	for (i = 0;i < sizeof(setup_flags) / sizeof(setup_flags[0]);i ++) {
+		memset(&p, 0, sizeof(p));
+		p.flags = setup_flags[i];
+		fd = syscall(__NR_io_uring_setup, CO_URING_ENTRIES, &p);
+		if (fd >= 0 || errno != EINVAL) break;
+	}
+	if (fd < 0) return -1;
+
+	if ((p.features & IORING_FEAT_EXT_ARG) == 0) { // 需要带超时的 io_uring_enter
+		close(fd);
+		return -1;
+	}
+
+	coroutine_uring *ring = calloc(1, sizeof(coroutine_uring));
+	if (ring == NULL) {
+		close(fd);
+		return -1;
+	}
+	ring->fd = fd;
+
+	size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+	} else {
+		ring->ring_size = sq_size;
+		ring->cq_ring_size = cq_size;
+	}
+
+	ring->ring = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring->ring == MAP_FAILED) goto err;
+
+	void *cq = ring->ring;
+	if (ring->cq_ring_size) {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			goto err;
+		}
+		cq = ring->cq_ring;
+	}
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto err;
+	}
+
+	ring->sq_head = (unsigned *)((char *)ring->ring + p.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->ring + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->ring + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->ring + p.sq_off.array);
+	ring->sq_entries = p.sq_entries;
+	ring->sq_local_tail = *ring->sq_tail;
+
+	ring->cq_head = (unsigned *)((char *)cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)cq + p.cq_off.cqes);
+
+	sched->uring = ring;
+	return 0;
+
+err:
+	sched->uring = ring;
+	schedule_uring_free(sched);
+	return -1;
+}
+
+
+void schedule_uring_free(schedule *sched) {
+
+	coroutine_uring *ring = sched->uring;
+	if (ring == NULL) return ;
+
+	if (ring->sqes != NULL) munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != NULL) munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->ring != NULL && ring->ring != MAP_FAILED) munmap(ring->ring, ring->ring_size);
+	close(ring->fd);
+
+	free(ring);
+	sched->uring = NULL;
+}
+
+
+// 还有协程在等待 io_uring 的完成事件
+int schedule_uring_busy(schedule *sched) {
+	return sched->uring != NULL && sched->uring->inflight > 0;
+}
+
+
+uint64_t schedule_uring_enters(schedule *sched) {
+	return sched->uring != NULL ? sched->uring->enters : 0;
+}
+
+
+/* 调度器每轮循环调用一次：提交本轮积累的操作，t 不为 0 时阻塞等待至少一个完成事件（或超时），
+   完成的协程放入就绪队列；epoll 实例可读时取出 epoll 事件放入 eventlist，返回 epoll 事件数量 */
+int schedule_uring_wait(schedule *sched, struct timespec t) {
+
+	coroutine_uring *ring = sched->uring;
+	int block = t.tv_sec != 0 || t.tv_nsec != 0;
+	int epoll_ready = 0;
+
+	if (!ring->epoll_armed) {
+		uring_arm_epoll(sched);
+	}
+
+	int ret = uring_submit(ring, block ? 1 : 0, block ? &t : NULL);
+	if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+		printf("io_uring_enter failed, errno %d\n", errno);
+		assert(0);
+	}
+
+	unsigned head = *ring->cq_head;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+		if (cqe->user_data == URING_TAG_EPOLL) {
+			ring->epoll_armed = 0;
+			epoll_ready = 1;
+		} else if (cqe->user_data != URING_TAG_IGNORE) {
+			coroutine *co = (coroutine *)(uintptr_t)cqe->user_data;
+			co->io.ret = cqe->res;
+			ring->inflight --;
+			TAILQ_INSERT_TAIL(&sched->ready, co, ready_next); // 下一轮由就绪队列恢复执行
+		}
+		head ++;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	// 上一批 epoll 事件取满时 epoll 中可能还有事件，poll 不会再次通知，直接再取一次
+	if (!epoll_ready && sched->nevents != sched->eventlist_size) return 0;
+
+	int nready = epoll_wait(sched->poller_fd, sched->eventlist, sched->eventlist_size, 0);
+	if (nready < 0) nready = 0;
+
+	if (!ring->epoll_armed) { // 取完后重新挂上，下一次 io_uring_enter 一起提交
+		uring_arm_epoll(sched);
+	}
+
+	return nready;
+}
+
+
+
+/* 提交已填写好的 SQE 并挂起当前协程，返回 CQE 的结果（负数为 -errno）。
+   协程已被取消或超过截止时间时不提交；有截止时间或 fd 上有 SO_RCVTIMEO / SO_SNDTIMEO 时在后面链接一个 IORING_OP_LINK_TIMEOUT，
+   到时内核取消该操作。被取消的操作以 -ECANCELED 完成，这里按原因换成 -ECANCELED / -ETIMEDOUT / -EAGAIN（fd 的超时） */
+static int uring_wait_completion(schedule *sched, coroutine *co, struct io_uring_sqe *sqe, int fd, int status) {
+
+	if (schedule_interrupted(co) < 0) { // SQE 已经取出，改为空操作
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		sqe->opcode = IORING_OP_NOP;
+		sqe->user_data = URING_TAG_IGNORE;
+		return -errno;
+	}
+
+	sqe->user_data = (uint64_t)(uintptr_t)co;
+
+	coroutine_fd *cfd = schedule_fd(sched, fd);
+	uint32_t fd_ms = status == COROUTINE_STATUS_WAIT_IO_READ ? cfd->rcvtimeo : cfd->sndtimeo;
+	int64_t wait_ms = schedule_deadline_msecs(co, fd_ms != 0 ? (int64_t)fd_ms : -1);
+	uint64_t fd_expire = fd_ms != 0 ? coroutine_usec_now() + (uint64_t)fd_ms * 1000u : 0;
+	coroutine_uring *ring = sched->uring;
+	if (wait_ms >= 0 && ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) < ring->sq_entries) {
+		// 提交队列还有空位才链接：uring_get_sqe 在队列满时会先提交，链接就断开了。没有空位时只在醒来后检查截止时间
+		co->io.timeout.tv_sec = wait_ms / 1000;
+		co->io.timeout.tv_nsec = (wait_ms % 1000) * 1000000;
+
+		sqe->flags |= IOSQE_IO_LINK;
+		struct io_uring_sqe *link = uring_get_sqe(ring);
+		link->opcode = IORING_OP_LINK_TIMEOUT;
+		link->fd = -1;
+		link->addr = (uint64_t)(uintptr_t)&co->io.timeout;
+		link->len = 1;
+		link->user_data = URING_TAG_IGNORE;
+	}
+
+	cfd->uring_ops ++;
+	sched->uring->inflight ++;
+
+	co->status |= BIT(status);
+	coroutine_yield(co); // 由 schedule_uring_wait 放入就绪队列后恢复
+	co->status &= CLEARBIT(status);
+
+	if (fd < sched->fds_size && sched->fds[fd].uring_ops > 0) { // close 时状态已清空
+		sched->fds[fd].uring_ops --;
+	}
+
+	if (co->io.ret == -ECANCELED) {
+		if (schedule_interrupted(co) < 0) return -errno;
+		if (fd_expire != 0 && coroutine_usec_now() >= fd_expire) return -EAGAIN;
+		return -EBADF; // 只剩 close 的取消（schedule_uring_cancel_fd）
+	}
+	return co->io.ret;
+}
+
+
+static ssize_t uring_result(int ret) {
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+
+// 读类操作：opcode 为 IORING_OP_READ 或 IORING_OP_RECV
+static ssize_t uring_read_op(int opcode, int fd, void *buf, size_t len, int flags) {
+
+	schedule *sched = coroutine_get_sched();
+	coroutine *co = sched->curr_thread;
+
+	void *bounce = NULL;
+	size_t cap = 0;
+	void *target = buf;
+
+	if (schedule_on_shared_stack(sched, buf, len)) {
+		bounce = coroutine_pool_stack_alloc(sched, len, &cap);
+		if (bounce == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		target = bounce;
+	}
+
+	struct io_uring_sqe *sqe = uring_get_sqe(sched->uring);
+	if (sqe == NULL) {
+		if (bounce) coroutine_pool_stack_release(sched, bounce, cap);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)target;
+	sqe->len = len;
+	if (opcode == IORING_OP_READ) {
+		sqe->off = (uint64_t)-1; // 从当前文件偏移读
+	} else {
+		sqe->msg_flags = flags;
+	}
+
+	int ret = uring_wait_completion(sched, co, sqe, fd, COROUTINE_STATUS_WAIT_IO_READ);
+
+	if (bounce) {
+		if (ret > 0) memcpy(buf, bounce, ret); // 已经恢复运行，栈内容也已恢复
+		coroutine_pool_stack_release(sched, bounce, cap);
+	}
+
+	return uring_result(ret);
+}
+
+
+// 写类操作：opcode 为 IORING_OP_WRITE 或 IORING_OP_SEND
+static ssize_t uring_write_op(int opcode, int fd, const void *buf, size_t len, int flags) {
+
+	schedule *sched = coroutine_get_sched();
+	coroutine *co = sched->curr_thread;
+
+	void *bounce = NULL;
+	size_t cap = 0;
+	const void *source = buf;
+
+	if (schedule_on_shared_stack(sched, buf, len)) { // 提交发生在协程挂起之后，先把数据拷出共享栈
+		bounce = coroutine_pool_stack_alloc(sched, len, &cap);
+		if (bounce == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		memcpy(bounce, buf, len);
+		source = bounce;
+	}
+
+	struct io_uring_sqe *sqe = uring_get_sqe(sched->uring);
+	if (sqe == NULL) {
+		if (bounce) coroutine_pool_stack_release(sched, bounce, cap);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)source;
+	sqe->len = len;
+	if (opcode == IORING_OP_WRITE) {
+		sqe->off = (uint64_t)-1;
+	} else {
+		sqe->msg_flags = flags | MSG_NOSIGNAL;
+	}
+
+	int ret = uring_wait_completion(sched, co, sqe, fd, COROUTINE_STATUS_WAIT_IO_WRITE);
+
+	if (bounce) {
+		coroutine_pool_stack_release(sched, bounce, cap);
+	}
+
+	return uring_result(ret);
+}
+
+
+ssize_t coroutine_uring_read(int fd, void *buf, size_t count) {
+	return uring_read_op(IORING_OP_READ, fd, buf, count, 0);
+}
+
+ssize_t coroutine_uring_recv(int fd, void *buf, size_t len, int flags) {
+	return uring_read_op(IORING_OP_RECV, fd, buf, len, flags);
+}
+
+ssize_t coroutine_uring_write(int fd, const void *buf, size_t count) {
+	return uring_write_op(IORING_OP_WRITE, fd, buf, count, 0);
+}
+
+ssize_t coroutine_uring_send(int fd, const void *buf, size_t len, int flags) {
+	return uring_write_op(IORING_OP_SEND, fd, buf, len, flags);
+}
+
+
+typedef struct uring_addr { // 共享栈模式下 accept/connect 的地址中转
+	socklen_t len;
+	struct sockaddr_storage addr;
+} uring_addr;
+
+
+int coroutine_uring_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+
+	schedule *sched = coroutine_get_sched();
+	coroutine *co = sched->curr_thread;
+
+	uring_addr *bounce = NULL;
+	size_t cap = 0;
+
+	if (addr != NULL && addrlen != NULL &&
+		(schedule_on_shared_stack(sched, addr, *addrlen) || schedule_on_shared_stack(sched, addrlen, sizeof(socklen_t)))) {
+		bounce = coroutine_pool_stack_alloc(sched, sizeof(uring_addr), &cap);
+		if (bounce == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		bounce->len = *addrlen < sizeof(struct sockaddr_storage) ? *addrlen : sizeof(struct sockaddr_storage);
+	}
+
+	struct io_uring_sqe *sqe = uring_get_sqe(sched->uring);
+	if (sqe == NULL) {
+		if (bounce) coroutine_pool_stack_release(sched, bounce, cap);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	if (bounce) {
+		sqe->addr = (uint64_t)(uintptr_t)&bounce->addr;
+		sqe->addr2 = (uint64_t)(uintptr_t)&bounce->len;
+	} else {
+		sqe->addr = (uint64_t)(uintptr_t)addr;
+		sqe->addr2 = (uint64_t)(uintptr_t)addrlen;
+	}
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+
+	int ret = uring_wait_completion(sched, co, sqe, fd, COROUTINE_STATUS_WAIT_IO_READ);
+
+	if (bounce) {
+		if (ret >= 0) {
+			memcpy(addr, &bounce->addr, bounce->len < *addrlen ? bounce->len : *addrlen);
+			*addrlen = bounce->len;
+		}
+		coroutine_pool_stack_release(sched, bounce, cap);
+	}
+
+	return uring_result(ret);
+}
+
+
+int coroutine_uring_connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+
+	schedule *sched = coroutine_get_sched();
+	coroutine *co = sched->curr_thread;
+
+	uring_addr *bounce = NULL;
+	size_t cap = 0;
+
+	if (addrlen > sizeof(struct sockaddr_storage)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (schedule_on_shared_stack(sched, addr, addrlen)) {
+		bounce = coroutine_pool_stack_alloc(sched, sizeof(uring_addr), &cap);
+		if (bounce == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		memcpy(&bounce->addr, addr, addrlen);
+		addr = (const struct sockaddr *)&bounce->addr;
+	}
+
+	struct io_uring_sqe *sqe = uring_get_sqe(sched->uring);
+	if (sqe == NULL) {
+		if (bounce) coroutine_pool_stack_release(sched, bounce, cap);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	sqe->opcode = IORING_OP_CONNECT;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)addr;
+	sqe->off = addrlen; // connect 的地址长度放在 off 字段
+
+	int ret = uring_wait_completion(sched, co, sqe, fd, COROUTINE_STATUS_WAIT_IO_WRITE);
+
+	if (bounce) {
+		coroutine_pool_stack_release(sched, bounce, cap);
+	}
+
+	return uring_result(ret);
+}
+
+
+/* close 之前调用：取消 fd 上所有未完成的操作，等待中的协程以 ECANCELED 恢复。
+   取消按 fd 号匹配文件，必须在 close 之前立即提交，否则 fd 号被复用后会取消到新文件上的操作 */
+void schedule_uring_cancel_fd(schedule *sched, int fd) {
+
+	if (sched->uring == NULL || fd < 0 || fd >= sched->fds_size || sched->fds[fd].uring_ops == 0) return ;
+
+	struct io_uring_sqe *sqe = uring_get_sqe(sched->uring);
+	if (sqe == NULL) return ;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = fd;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data = URING_TAG_IGNORE;
+
+	uring_submit(sched->uring, 0, NULL);
+}
+
+
+// 取消协程 co 正在等待的操作（coroutine_cancel），操作以 -ECANCELED 完成后协程恢复
+void schedule_uring_cancel_co(schedule *sched, coroutine *co) {
+
+	if (sched->uring == NULL) return ;
+
+	struct io_uring_sqe *sqe = uring_get_sqe(sched->uring);
+	if (sqe == NULL) return ;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)co; // 按 user_data 匹配
+	sqe->user_data = URING_TAG_IGNORE;
+}
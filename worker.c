@@ -0,0 +1,407 @@
+#include <sys/eventfd.h>
+
+#include "coroutine.h"
+
+
+
+/*
+N:M 运行时：启动 N 个工作线程，每个线程拥有自己的调度器和一个 Chase-Lev 无锁双端队列。
+- 工作线程上新建的协程压入本线程双端队列的底部，本线程从底部批量取出执行；
+- 空闲的工作线程从其他线程双端队列的顶部窃取协程；
+- 其他（非工作）线程通过目标调度器的 defer 队列投递新协程（schedule_defer_push），目标线程阻塞时通过 eventfd 唤醒。
+
+共享栈模式下，协程的栈内容里保存着指向原调度器栈地址的指针（栈帧指针、局部变量地址等），
+换到另一个调度器的栈地址上恢复必然出错，所以只有从未运行过的协程才能迁移；
+独立栈模式下栈地址不变，就绪的协程都可以迁移。
+*/
+
+
+#define CO_WORKER_DEQUE_MASK	(CO_WORKER_DEQUE_SIZE - 1)
+#define CO_WORKER_BATCH			64 // 每轮调度最多从本线程双端队列取出的协程数量
+
+
+static struct {
+	schedule_worker *workers;
+	int nworkers;
+	int stack_size;
+	int flags;
+	atomic_int next; // 非工作线程投递时轮询选择目标
+	atomic_int nidle; // 阻塞在 epoll_wait 中的工作线程数量
+	atomic_int stop;
+	pthread_barrier_t exit_barrier; // 所有工作线程与 schedule_workers_stop 都到齐后才释放调度器，此后不会再有人访问它们的 eventfd
+} runtime;
+
+
+
+static int coroutine_deque_push(coroutine_deque *dq, coroutine *co) { // 只能由所属线程调用
+
+	int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+	int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+	if (b - t >= CO_WORKER_DEQUE_SIZE) {
+		return -1; // 满了
+	}
+
+	atomic_store_explicit(&dq->buffer[b & CO_WORKER_DEQUE_MASK], co, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+
+	return 0;
+}
+
+
+static coroutine *coroutine_deque_pop(coroutine_deque *dq) { // 只能由所属线程调用
+
+	int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+	atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+	coroutine *co = NULL;
+	if (t <= b) {
+		co = atomic_load_explicit(&dq->buffer[b & CO_WORKER_DEQUE_MASK], memory_order_relaxed);
+		if (t == b) { // 最后一个元素，与窃取者竞争
+			if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+				memory_order_seq_cst, memory_order_relaxed)) {
+				co = NULL;
+			}
+			atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+		}
+	} else { // 空
+		atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+	}
+
+	return co;
+}
+
+
+static coroutine *coroutine_deque_steal(coroutine_deque *dq) { // 任意线程都可以调用
+
+	int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+
+	if (t >= b) return NULL;
+
+	coroutine *co = atomic_load_explicit(&dq->buffer[t & CO_WORKER_DEQUE_MASK], memory_order_relaxed);
+	if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+		memory_order_seq_cst, memory_order_relaxed)) {
+		return NULL; // 被其他线程抢先
+	}
+
+	return co;
+}
+
+
+static inline int coroutine_deque_empty(coroutine_deque *dq) {
+	return atomic_load_explicit(&dq->bottom, memory_order_acquire) <=
+		atomic_load_explicit(&dq->top, memory_order_acquire);
+}
+
+
+
+// 唤醒一个阻塞在 epoll_wait 中的工作线程去窃取新产生的协程
+static void schedule_worker_kick_idle(schedule_worker *self) {
+
+	int i = 0;
+	for (i = 0;i < runtime.nworkers;i ++) {
+		schedule_worker *w = &runtime.workers[i];
+		int expected = 1;
+
+		if (w == self) continue;
+		if (atomic_compare_exchange_strong(&w->sleeping, &expected, 0)) {
+			eventfd_write(w->sched->eventfd, 1);
+			return ;
+		}
+	}
+}
+
+
+// 协程能否交给其他调度器执行。写合并缓冲区和零拷贝的发送编号记在本调度器的 fd 状态表中，协程迁走后的写会越过还在缓冲的数据，
+// 等待的 ticket 也对不上，所以调度器上有这类 fd 时运行过的协程都留在本线程
+static inline int schedule_worker_migratable(coroutine *co) {
+	return (co->status & BIT(COROUTINE_STATUS_NEW)) ||
+		((co->sched->flags & SCHEDULE_PRIVATE_STACK) && co->sched->nfds_pinned == 0);
+}
+
+
+// 把协程放进本线程的双端队列供窃取，放不进去（不可迁移或队列已满）返回 -1。
+// 协程一旦入队就可能立即在其他线程上恢复，所以只能对没有在运行的协程调用
+int schedule_worker_push(coroutine *co) {
+
+	schedule *sched = co->sched;
+	schedule_worker *w = sched->worker;
+
+	if (!schedule_worker_migratable(co)) return -1;
+	if (coroutine_deque_push(&w->deque, co) != 0) return -1;
+
+	// 队列中的协程不属于任何调度器，取出时再计入取出方的 spawned_coroutines
+	sched->spawned_coroutines --;
+
+	atomic_thread_fence(memory_order_seq_cst); // 先入队再读空闲数量，与 schedule_worker_idle 的先登记再检查相对应
+	if (atomic_load(&runtime.nidle) > 0) {
+		schedule_worker_kick_idle(w);
+	}
+
+	return 0;
+}
+
+
+// 接收从双端队列中取出（或窃取）的协程
+static void schedule_worker_adopt(schedule *sched, coroutine *co) {
+	co->sched = sched;
+	sched->spawned_coroutines ++;
+}
+
+
+// 每轮调度中执行本线程双端队列里的协程，本地没有可执行的协程时去其他线程窃取，返回执行的协程数量
+int schedule_worker_run(schedule *sched) {
+
+	schedule_worker *w = sched->worker;
+	coroutine *batch[CO_WORKER_BATCH];
+	int n = 0, i = 0;
+
+	// 先取出一批再逐个执行，执行中再压入的协程留到下一轮，避免同一个协程反复被取出
+	while (n < CO_WORKER_BATCH && (batch[n] = coroutine_deque_pop(&w->deque)) != NULL) {
+		schedule_worker_adopt(sched, batch[n]);
+		n ++;
+	}
+
+	// 独立栈模式下就绪队列中积压的协程也可以迁移：有空闲线程时把一半挪进双端队列供其窃取。
+	// 此时处于调度器上下文，这些协程都没有在运行
+	if ((sched->flags & SCHEDULE_PRIVATE_STACK) && atomic_load(&runtime.nidle) > 0) {
+		coroutine *co = TAILQ_FIRST(&sched->ready);
+		int nready = 0;
+		while (co != NULL) {
+			nready ++;
+			co = TAILQ_NEXT(co, ready_next);
+		}
+		for (i = 0;i < nready / 2;i ++) {
+			co = TAILQ_LAST(&sched->ready, _coroutine_queue);
+			TAILQ_REMOVE(&sched->ready, co, ready_next);
+			if (schedule_worker_push(co) != 0) {
+				TAILQ_INSERT_TAIL(&sched->ready, co, ready_next);
+				break;
+			}
+		}
+	}
+
+	if (n == 0 && TAILQ_EMPTY(&sched->ready)) { // 本地无事可做，从其他线程窃取
+		int start = w->index + 1;
+		for (i = 0;i < runtime.nworkers - 1 && n == 0;i ++) {
+			schedule_worker *victim = &runtime.workers[(start + i) % runtime.nworkers];
+			coroutine *co = coroutine_deque_steal(&victim->deque);
+			if (co != NULL) {
+				schedule_worker_adopt(sched, co);
+				batch[n ++] = co;
+				w->steals ++;
+			}
+		}
+	}
+
+	for (i = 0;i < n;i ++) {
+		coroutine_resume(batch[i]);
+	}
+
+	return n;
+}
+
+
+// 是否还有待执行的协程（本线程双端队列或 defer 队列）
+int schedule_worker_busy(schedule *sched) {
+
+	schedule_worker *w = sched->worker;
+
+	return atomic_load(&sched->defer) != NULL || !coroutine_deque_empty(&w->deque);
+}
+
+
+// 调度器准备阻塞在 epoll_wait 之前调用：登记为空闲后再检查一遍是否有活可干，
+// 与 schedule_worker_push 中先入队再检查空闲数量配合，保证不会丢失唤醒。返回 0 表示可以阻塞
+int schedule_worker_idle(schedule *sched) {
+
+	schedule_worker *w = sched->worker;
+	int i = 0;
+
+	atomic_store(&w->sleeping, 1);
+	atomic_fetch_add(&runtime.nidle, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	int pending = schedule_worker_busy(sched) || atomic_load(&runtime.stop);
+	for (i = 0;i < runtime.nworkers && !pending;i ++) {
+		pending = !coroutine_deque_empty(&runtime.workers[i].deque);
+	}
+
+	if (pending) {
+		schedule_worker_wakeup(sched);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+// epoll_wait 返回后调用，撤销空闲登记
+void schedule_worker_wakeup(schedule *sched) {
+
+	schedule_worker *w = sched->worker;
+
+	atomic_store(&w->sleeping, 0);
+	atomic_fetch_sub(&runtime.nidle, 1);
+}
+
+
+// 工作线程在请求停止且本地协程全部执行完毕后退出
+int schedule_worker_done(schedule *sched) {
+	return atomic_load(&runtime.stop) && !schedule_worker_busy(sched);
+}
+
+
+// 调度循环结束、释放调度器之前调用
+void schedule_worker_exit(void) {
+	pthread_barrier_wait(&runtime.exit_barrier);
+}
+
+
+
+static void *schedule_worker_main(void *arg) {
+
+	schedule_worker *w = arg;
+
+	if (schedule_create(runtime.stack_size, runtime.flags) != 0) { // 通知 schedule_workers_start 失败，由它停止其他工作线程
+		pthread_mutex_lock(&w->start_mutex);
+		w->failed = 1;
+		pthread_cond_signal(&w->start_cond);
+		pthread_mutex_unlock(&w->start_mutex);
+
+		pthread_barrier_wait(&runtime.exit_barrier);
+		return NULL;
+	}
+
+	schedule *sched = coroutine_get_sched();
+	pthread_mutex_lock(&w->start_mutex);
+	w->sched = sched;
+	sched->worker = w;
+	pthread_cond_signal(&w->start_cond);
+	pthread_mutex_unlock(&w->start_mutex);
+
+	schedule_run(); // 返回时调度器已经释放
+
+	return NULL;
+}
+
+
+// 启动 nworkers 个工作线程，stack_size、flags 与 schedule_create 相同，所有工作线程使用相同的参数。
+// 有工作线程创建调度器失败时停止已经启动的线程，返回 -1。
+// 共享栈模式（SCHEDULE_SHARED_STACK）下只有从未运行过的协程会被窃取，运行过的协程固定在所在线程上；要让就绪的协程也能迁移需使用 SCHEDULE_PRIVATE_STACK
+int schedule_workers_start(int nworkers, int stack_size, int flags) {
+
+	int i = 0;
+
+	if (nworkers <= 0 || runtime.workers != NULL) return -1;
+
+	coroutine_sched_key_init();
+
+	runtime.workers = calloc(nworkers, sizeof(schedule_worker));
+	if (runtime.workers == NULL) {
+		printf("Failed to allocate workers\n");
+		return -1;
+	}
+	runtime.nworkers = nworkers;
+	runtime.stack_size = stack_size;
+	runtime.flags = flags;
+	atomic_store(&runtime.stop, 0);
+	pthread_barrier_init(&runtime.exit_barrier, NULL, nworkers + 1);
+
+	for (i = 0;i < nworkers;i ++) {
+		schedule_worker *w = &runtime.workers[i];
+		w->index = i;
+		pthread_mutex_init(&w->start_mutex, NULL);
+		pthread_cond_init(&w->start_cond, NULL);
+
+		if (pthread_create(&w->tid, NULL, schedule_worker_main, w) != 0) {
+			printf("Failed to create worker thread\n");
+			assert(0);
+		}
+	}
+
+	int failed = 0;
+	for (i = 0;i < nworkers;i ++) { // 等待所有工作线程的调度器就绪，之后才能向它们投递协程
+		schedule_worker *w = &runtime.workers[i];
+		pthread_mutex_lock(&w->start_mutex);
+		while (w->sched == NULL && !w->failed) {
+			pthread_cond_wait(&w->start_cond, &w->start_mutex);
+		}
+		failed |= w->failed;
+		pthread_mutex_unlock(&w->start_mutex);
+	}
+
+	if (failed) {
+		schedule_workers_stop();
+		return -1;
+	}
+	return 0;
+}
+
+
+// 请求所有工作线程停止，等待它们执行完剩余的协程后退出
+void schedule_workers_stop(void) {
+
+	int i = 0;
+
+	if (runtime.workers == NULL) return ;
+
+	atomic_store(&runtime.stop, 1);
+	for (i = 0;i < runtime.nworkers;i ++) {
+		if (runtime.workers[i].sched == NULL) continue; // 调度器创建失败的线程
+		eventfd_write(runtime.workers[i].sched->eventfd, 1);
+	}
+	pthread_barrier_wait(&runtime.exit_barrier);
+
+	for (i = 0;i < runtime.nworkers;i ++) {
+		schedule_worker *w = &runtime.workers[i];
+		pthread_join(w->tid, NULL);
+		pthread_mutex_destroy(&w->start_mutex);
+		pthread_cond_destroy(&w->start_cond);
+	}
+
+	pthread_barrier_destroy(&runtime.exit_barrier);
+	free(runtime.workers);
+	runtime.workers = NULL;
+	runtime.nworkers = 0;
+}
+
+
+// 在 N:M 运行时中创建协程：工作线程内调用时放进本线程的双端队列，其他线程调用时轮询投递给某个工作线程
+int coroutine_spawn(coroutine **new_co, proc_coroutine func, void *arg) {
+
+	schedule *sched = coroutine_get_sched();
+	if (sched != NULL && sched->worker != NULL) {
+		return coroutine_create(new_co, func, arg);
+	}
+
+	if (runtime.workers == NULL) {
+		printf("workers not started\n");
+		return -1;
+	}
+
+	int idx = atomic_fetch_add(&runtime.next, 1) % runtime.nworkers;
+	schedule *target = runtime.workers[idx].sched;
+
+	coroutine *co = calloc(1, sizeof(coroutine)); // 不在目标线程，不能使用目标调度器的缓存
+	if (co == NULL) {
+		printf("Failed to allocate memory for new coroutine\n");
+		return -2;
+	}
+
+	co->sched = target;
+	co->status = BIT(COROUTINE_STATUS_NEW);
+	co->func = func;
+	co->arg = arg;
+	co->birth = coroutine_usec_now();
+
+	*new_co = co;
+
+	schedule_defer_push(target, &co->defer_node, COROUTINE_DEFER_NEW);
+
+	return 0;
+}